@@ -0,0 +1,167 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include <iostream>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include "umps/event.h"
+
+static int failures = 0;
+
+static void check(bool cond, const char* what)
+{
+    if (!cond) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+static Event::Tag makeTag(Word kind)
+{
+    Event::Tag tag = { kind, { 0, 0, 0 } };
+    return tag;
+}
+
+static void record(std::vector<int>* log, int id)
+{
+    log->push_back(id);
+}
+
+static void runAll(EventQueue* queue)
+{
+    while (!queue->IsEmpty())
+        queue->RunHead();
+}
+
+// Events due at the same tick must happen in scheduling order, even
+// when they are interleaved with earlier and later ones
+static void testOrdering()
+{
+    EventQueue queue;
+    std::vector<int> log;
+
+    queue.InsertQ(0, 10, boost::bind(record, &log, 0), makeTag(0));
+    queue.InsertQ(0, 5, boost::bind(record, &log, 1), makeTag(1));
+    queue.InsertQ(0, 10, boost::bind(record, &log, 2), makeTag(2));
+    queue.InsertQ(5, 0, boost::bind(record, &log, 3), makeTag(3));
+    queue.InsertQ(8, 2, boost::bind(record, &log, 4), makeTag(4));
+    queue.InsertQ(0, 20, boost::bind(record, &log, 5), makeTag(5));
+    for (int i = 6; i < 40; i++)
+        queue.InsertQ(0, 10, boost::bind(record, &log, i), makeTag(i));
+
+    std::vector<Event::Info> events;
+    queue.GetEvents(&events);
+    check(events.size() == 40, "GetEvents lists every event");
+    check(events.front().tag.kind == 1 && events.back().tag.kind == 5,
+          "GetEvents lists events in order");
+    check(queue.nextDeadline() == 5, "nextDeadline");
+
+    runAll(&queue);
+
+    static const int expected[] = { 1, 3, 0, 2, 4 };
+    bool ok = log.size() == 40;
+    for (int i = 0; ok && i < 5; i++)
+        ok = log[i] == expected[i];
+    for (int i = 5; ok && i < 39; i++)
+        ok = log[i] == i + 1;
+    ok = ok && log.back() == 5;
+    check(ok, "same-tick events happen in scheduling order");
+}
+
+// A handle must no longer refer to anything once its event has
+// happened or has been cancelled, even if the slot is reused
+static void testCancel()
+{
+    EventQueue queue;
+    std::vector<int> log;
+
+    check(!queue.Cancel(Event::Handle()), "cancel a default handle");
+
+    Event::Handle fired = queue.InsertQ(0, 1, boost::bind(record, &log, 0), makeTag(0));
+    queue.RunHead();
+    check(log.size() == 1, "event happened");
+    check(!queue.Cancel(fired), "cancel a fired event");
+
+    Event::Handle cancelled = queue.InsertQ(0, 1, boost::bind(record, &log, 1), makeTag(1));
+    check(queue.Cancel(cancelled), "cancel a scheduled event");
+    check(queue.IsEmpty(), "cancelled event is gone");
+    check(!queue.Cancel(cancelled), "cancel an event twice");
+
+    // The pool hands back the slot just freed: the stale handles must
+    // not reach the new event
+    Event::Handle reused = queue.InsertQ(0, 1, boost::bind(record, &log, 2), makeTag(2));
+    check(!queue.Cancel(fired), "cancel through a fired handle to a reused slot");
+    check(!queue.Cancel(cancelled), "cancel through a cancelled handle to a reused slot");
+    check(!queue.IsEmpty(), "reused slot is still scheduled");
+
+    // Cancelling from the middle of the heap keeps the others in order
+    Event::Handle handles[8];
+    for (int i = 0; i < 8; i++)
+        handles[i] = queue.InsertQ(0, 8 - i, boost::bind(record, &log, 10 + i), makeTag(i));
+    check(queue.Cancel(handles[3]), "cancel inside the heap");
+    check(queue.Cancel(handles[6]), "cancel inside the heap");
+    check(queue.Cancel(reused), "cancel a reused slot through its own handle");
+
+    log.clear();
+    runAll(&queue);
+    static const int expected[] = { 17, 15, 14, 12, 11, 10 };
+    check(log == std::vector<int>(expected, expected + 6),
+          "remaining events happen in order after cancellations");
+
+    queue.InsertQ(0, 1, boost::bind(record, &log, 0), makeTag(0));
+    Event::Handle cleared = queue.InsertQ(0, 2, boost::bind(record, &log, 0), makeTag(0));
+    queue.Clear();
+    check(queue.IsEmpty(), "Clear empties the queue");
+    check(!queue.Cancel(cleared), "cancel a cleared event");
+}
+
+struct Rescheduler {
+    EventQueue* queue;
+    std::vector<int>* log;
+    uint64_t now;
+    int remaining;
+
+    void operator()()
+    {
+        log->push_back(remaining);
+        if (remaining > 0) {
+            Rescheduler next = *this;
+            next.remaining--;
+            // A zero delay event is due now, but after the ones
+            // already scheduled for this tick
+            queue->InsertQ(now, 0, next, makeTag(0));
+            // Grow the pool while the handler is running
+            for (int i = 0; i < 16; i++)
+                queue->Cancel(queue->InsertQ(now, 1000, next, makeTag(1)));
+        }
+    }
+};
+
+// Handlers may schedule further events
+static void testInsertFromHandler()
+{
+    EventQueue queue;
+    std::vector<int> log;
+
+    Rescheduler first = { &queue, &log, 0, 3 };
+    queue.InsertQ(0, 0, first, makeTag(0));
+    queue.InsertQ(0, 0, boost::bind(record, &log, 100), makeTag(1));
+    runAll(&queue);
+
+    static const int expected[] = { 3, 100, 2, 1, 0 };
+    check(log == std::vector<int>(expected, expected + 5),
+          "events scheduled from a handler happen after the pending ones");
+}
+
+int main(int argc, char** argv)
+{
+    testOrdering();
+    testCancel();
+    testInsertFromHandler();
+
+    if (failures)
+        return 1;
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,324 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include <stdio.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/blockdev_params.h"
+#include "umps/error.h"
+#include "umps/snapshot.h"
+#include "umps/machine_config.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/systembus.h"
+#include "umps/stoppoint.h"
+
+static int failures = 0;
+
+static void check(bool cond, const char* what)
+{
+    if (!cond) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+void Panic(const char* message)
+{
+    std::cerr << "PANIC: " << message << std::endl;
+    exit(1);
+}
+
+static const char* const kConfigFile = "test_snapshot-config.json";
+static const char* const kRomFile = "test_snapshot-boot.rom";
+static const char* const kSnapshotFile = "test_snapshot-state.bin";
+static const char* const kPrinterFile = "test_snapshot-printer.out";
+
+// Bootstrap ROM: fill RAM from RAMBASE + 0x1000 with a running count
+static const Word kProgram[] = {
+    0x3C082000,     // lui   t0, 0x2000
+    0x250A1000,     // addiu t2, t0, 0x1000
+    0x25290001,     // loop: addiu t1, t1, 1
+    0xAD490000,     // sw    t1, 0(t2)
+    0x254A0004,     // addiu t2, t2, 4
+    0x1000FFFC,     // beq   zero, zero, loop
+    0x00000000      // nop
+};
+
+static void writeFile(const char* fileName, const std::vector<unsigned char>& data)
+{
+    FILE* file = fopen(fileName, "w");
+    if (file == NULL || fwrite(&data[0], 1, data.size(), file) != data.size())
+        Panic("Cannot write test file");
+    fclose(file);
+}
+
+static std::vector<unsigned char> readFile(const char* fileName)
+{
+    std::vector<unsigned char> data;
+    FILE* file = fopen(fileName, "r");
+    if (file == NULL)
+        Panic("Cannot read test file");
+    int c;
+    while ((c = fgetc(file)) != EOF)
+        data.push_back(c);
+    fclose(file);
+    return data;
+}
+
+static void writeRom()
+{
+    SnapshotWriter out(kRomFile);
+    out.PutWord(BIOSFILEID);
+    out.PutWord(sizeof(kProgram) / sizeof(kProgram[0]));
+    out.PutWords(kProgram, sizeof(kProgram) / sizeof(kProgram[0]));
+    out.Close();
+}
+
+// This function returns TRUE if reading from buffer with read fails
+// with InvalidFileFormatError
+template <typename Reader>
+static bool rejects(const SnapshotBuffer& buffer, Reader read)
+{
+    SnapshotReader in(&buffer);
+    try {
+        read(&in);
+        in.ExpectEnd();
+    } catch (const InvalidFileFormatError&) {
+        return true;
+    }
+    return false;
+}
+
+static void readU64(SnapshotReader* in) { in->GetU64(); }
+static void readBool(SnapshotReader* in) { in->GetBool(); }
+static void readString(SnapshotReader* in) { in->GetString(); }
+static void readWord(SnapshotReader* in) { in->GetWord(); }
+
+static void testReaderWriter()
+{
+    static const Word words[] = { 1, 2, 0xdeadbeef };
+
+    SnapshotBuffer buffer;
+    SnapshotWriter out(&buffer);
+    out.PutWord(42);
+    out.PutU64(0x123456789abcdefULL);
+    out.PutBool(true);
+    out.PutWords(words, 3);
+    out.PutString("");
+    out.PutString("terminal0");
+    out.Close();
+
+    SnapshotReader in(&buffer);
+    bool ok = in.GetWord() == 42;
+    ok = ok && in.GetU64() == 0x123456789abcdefULL;
+    ok = ok && in.GetBool();
+    Word back[3];
+    in.GetWords(back, 3);
+    ok = ok && back[0] == words[0] && back[1] == words[1] && back[2] == words[2];
+    ok = ok && in.GetString().empty();
+    ok = ok && in.GetString() == "terminal0";
+    in.ExpectEnd();
+    check(ok, "values read back as written");
+
+    // Truncated values
+    SnapshotBuffer shortBuffer(4);
+    check(rejects(shortBuffer, readU64), "truncated 64-bit value");
+    check(rejects(SnapshotBuffer(), readWord), "empty buffer");
+
+    SnapshotBuffer badBool;
+    SnapshotWriter(&badBool).PutWord(2);
+    check(rejects(badBool, readBool), "boolean other than 0 or 1");
+
+    // Strings: cut short, and with an unreasonable length
+    SnapshotBuffer cutString;
+    SnapshotWriter(&cutString).PutString("terminal0");
+    cutString.resize(cutString.size() - 1);
+    check(rejects(cutString, readString), "truncated string");
+
+    SnapshotBuffer longString;
+    SnapshotWriter(&longString).PutWord(~0U);
+    longString.resize(longString.size() + 64);
+    check(rejects(longString, readString), "over-long string");
+
+    // Trailing data
+    SnapshotBuffer trailing;
+    SnapshotWriter(&trailing).PutWord(0);
+    trailing.push_back(0);
+    check(rejects(trailing, readWord), "trailing data");
+
+    // Files
+    {
+        SnapshotWriter fileOut(kSnapshotFile);
+        fileOut.PutU64(7);
+        fileOut.PutString("tape0");
+        fileOut.Close();
+    }
+    {
+        SnapshotReader fileIn(kSnapshotFile);
+        check(fileIn.GetU64() == 7 && fileIn.GetString() == "tape0",
+              "values read back from a file");
+        fileIn.ExpectEnd();
+    }
+    std::vector<unsigned char> data = readFile(kSnapshotFile);
+    data.resize(data.size() - 2);
+    writeFile(kSnapshotFile, data);
+    try {
+        SnapshotReader fileIn(kSnapshotFile);
+        fileIn.GetU64();
+        fileIn.GetString();
+        check(false, "truncated file");
+    } catch (const InvalidFileFormatError&) {
+    }
+
+    try {
+        SnapshotReader fileIn("test_snapshot-missing.bin");
+        check(false, "missing file");
+    } catch (const FileError&) {
+    }
+}
+
+struct MachineState {
+    Word pc;
+    SWord gpr[32];
+    Word todHi, todLo;
+    std::vector<Word> ram;
+
+    bool operator==(const MachineState& other) const
+    {
+        for (unsigned int i = 0; i < 32; i++)
+            if (gpr[i] != other.gpr[i])
+                return false;
+        return (pc == other.pc && todHi == other.todHi && todLo == other.todLo &&
+                ram == other.ram);
+    }
+};
+
+static MachineState getState(Machine* machine, const MachineConfig* config)
+{
+    MachineState state;
+    Processor* cpu = machine->getProcessor(0);
+    state.pc = cpu->getPC();
+    for (unsigned int i = 0; i < 32; i++)
+        state.gpr[i] = cpu->getGPR(i);
+    state.todHi = machine->getBus()->getToDHI();
+    state.todLo = machine->getBus()->getToDLO();
+    for (Word addr = RAMBASE; addr < RAMBASE + config->getRamSize() * FRAMESIZE * WORDLEN; addr += WORDLEN) {
+        Word data;
+        machine->ReadMemory(addr, &data);
+        state.ram.push_back(data);
+    }
+    return state;
+}
+
+static void run(Machine* machine, unsigned int cycles)
+{
+    while (cycles > 0) {
+        unsigned int stepped;
+        machine->step(cycles, &stepped);
+        cycles -= stepped;
+    }
+}
+
+// This function returns TRUE if a new machine built from config
+// refuses to load the snapshot in data
+static bool refusesSnapshot(const MachineConfig* config, const std::vector<unsigned char>& data)
+{
+    writeFile(kSnapshotFile, data);
+    StoppointSet breakpoints, suspects, tracepoints;
+    Machine machine(config, &breakpoints, &suspects, &tracepoints);
+    try {
+        machine.LoadSnapshot(kSnapshotFile);
+    } catch (const InvalidFileFormatError&) {
+        return true;
+    }
+    return false;
+}
+
+static void testMachine()
+{
+    writeRom();
+
+    std::auto_ptr<MachineConfig> config(MachineConfig::Create(kConfigFile));
+    config->setLoadCoreEnabled(false);
+    config->setDeviceEnabled(EXT_IL_INDEX(IL_TERMINAL), 0, false);
+    config->setROM(ROM_TYPE_BOOT, kRomFile);
+    config->setROM(ROM_TYPE_BIOS, kRomFile);
+    check(config->Validate(NULL), "test configuration is valid");
+
+    StoppointSet breakpoints, suspects, tracepoints;
+    std::vector<unsigned char> snapshot;
+    MachineState saved, expected;
+    {
+        Machine machine(config.get(), &breakpoints, &suspects, &tracepoints);
+        run(&machine, 20000);
+        machine.SaveSnapshot(kSnapshotFile);
+        snapshot = readFile(kSnapshotFile);
+        saved = getState(&machine, config.get());
+        run(&machine, 20000);
+        expected = getState(&machine, config.get());
+    }
+    check(saved.ram[0x1000 / WORDLEN] != 0, "test program has run");
+
+    {
+        // Restore over a machine which has run a different course
+        Machine machine(config.get(), &breakpoints, &suspects, &tracepoints);
+        run(&machine, 30000);
+        machine.LoadSnapshot(kSnapshotFile);
+        check(getState(&machine, config.get()) == saved, "state restored from a snapshot");
+        run(&machine, 20000);
+        check(getState(&machine, config.get()) == expected, "restored machine runs the same");
+    }
+
+    // Corrupted snapshots
+    std::vector<unsigned char> data = snapshot;
+    data.resize(data.size() / 2);
+    check(refusesSnapshot(config.get(), data), "truncated snapshot");
+
+    data = snapshot;
+    data.resize(data.size() - 1);
+    check(refusesSnapshot(config.get(), data), "snapshot missing its last byte");
+
+    data = snapshot;
+    data.push_back(0);
+    check(refusesSnapshot(config.get(), data), "snapshot with trailing data");
+
+    data = snapshot;
+    data[0] ^= 0xff;
+    check(refusesSnapshot(config.get(), data), "snapshot with a wrong magic number");
+
+    data = snapshot;
+    data[WORDLEN] ^= 0xff;
+    check(refusesSnapshot(config.get(), data), "snapshot of another version");
+
+    // Another configuration
+    config->setRamSize(config->getRamSize() * 2);
+    check(refusesSnapshot(config.get(), snapshot), "snapshot of a machine with more RAM");
+    config->setRamSize(config->getRamSize() / 2);
+    config->setTLBSize(config->getTLBSize() * 2);
+    check(refusesSnapshot(config.get(), snapshot), "snapshot of a machine with a larger TLB");
+    config->setTLBSize(config->getTLBSize() / 2);
+    config->setDeviceEnabled(EXT_IL_INDEX(IL_PRINTER), 0, true);
+    config->setDeviceFile(EXT_IL_INDEX(IL_PRINTER), 0, kPrinterFile);
+    check(refusesSnapshot(config.get(), snapshot), "snapshot of a machine with other devices");
+
+    remove(kConfigFile);
+    remove(kRomFile);
+    remove(kPrinterFile);
+}
+
+int main(int argc, char** argv)
+{
+    testReaderWriter();
+    testMachine();
+    remove(kSnapshotFile);
+
+    if (failures)
+        return 1;
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -53,6 +53,10 @@ public:
     // ofs (Word items) offset, range [0..BLOCKSIZE - 1]. Warning:
     // in-bounds checking is leaved to caller
     void setWord(unsigned int ofs, Word value);
+
+    // This method returns the location of the Block contents, for
+    // transfers of whole ranges of words
+    Word* getBuffer() { return blkBuf; }
 			
 private:
     // Block contents
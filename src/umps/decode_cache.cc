@@ -0,0 +1,113 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * Copyright (C) 2011 Tomislav Jonjic
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "umps/decode_cache.h"
+
+#include <assert.h>
+#include <algorithm>
+
+#include "umps/const.h"
+
+DecodeCache::DecodeCache(Word ramSize, Word biosSize, Word bootSize)
+{
+    initArea(AREA_RAM, RAMBASE, ramSize);
+    initArea(AREA_BIOS, BIOSBASE, biosSize);
+    initArea(AREA_BOOT, BOOTBASE, bootSize);
+}
+
+DecodeCache::~DecodeCache()
+{
+    for (unsigned int i = 0; i < N_AREAS; i++)
+        foreach (DecodedInstr* frame, areas[i].frames)
+            delete [] frame;
+}
+
+void DecodeCache::initArea(unsigned int area, Word base, Word size)
+{
+    areas[area].base = base;
+    areas[area].size = size;
+    areas[area].frames.resize((size + FRAMESIZE * WORDLEN - 1) / (FRAMESIZE * WORDLEN), NULL);
+}
+
+// Processors running in parallel may look up a missing frame at
+// once: each allocates a table, and all but the first to install
+// theirs drop it
+DecodedInstr* DecodeCache::Lookup(Word paddr)
+{
+    for (unsigned int i = 0; i < N_AREAS; i++) {
+        Word offset = paddr - areas[i].base;
+        if (offset < areas[i].size) {
+            offset >>= WORDSHIFT;
+            DecodedInstr** slot = &areas[i].frames[offset / FRAMESIZE];
+            DecodedInstr* frame = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+            if (frame == NULL) {
+                DecodedInstr* table = new DecodedInstr[FRAMESIZE]();
+                if (__sync_bool_compare_and_swap(slot, (DecodedInstr*) NULL, table)) {
+                    frame = table;
+                } else {
+                    delete [] table;
+                    frame = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+                }
+            }
+            return &frame[offset % FRAMESIZE];
+        }
+    }
+    return NULL;
+}
+
+void DecodeCache::Invalidate(Word paddr)
+{
+    // Only RAM is writable
+    Word offset = (paddr - RAMBASE) >> WORDSHIFT;
+    if (offset < areas[AREA_RAM].size >> WORDSHIFT) {
+        DecodedInstr* frame = frameAt(AREA_RAM, offset / FRAMESIZE);
+        if (frame != NULL)
+            __atomic_store_n(&frame[offset % FRAMESIZE].op, DecodedInstr::kEmpty, __ATOMIC_RELEASE);
+    }
+}
+
+void DecodeCache::Invalidate(Word paddr, Word nWords)
+{
+    Word offset = (paddr - RAMBASE) >> WORDSHIFT;
+    assert(offset + nWords <= areas[AREA_RAM].size >> WORDSHIFT);
+
+    const Word end = offset + nWords;
+    while (offset < end) {
+        Word n = std::min(end - offset, (Word) FRAMESIZE - offset % FRAMESIZE);
+        DecodedInstr* frame = frameAt(AREA_RAM, offset / FRAMESIZE);
+        if (frame != NULL) {
+            for (Word i = offset % FRAMESIZE; i < offset % FRAMESIZE + n; i++)
+                __atomic_store_n(&frame[i].op, DecodedInstr::kEmpty, __ATOMIC_RELEASE);
+        }
+        offset += n;
+    }
+}
+
+void DecodeCache::InvalidateRam()
+{
+    for (size_t i = 0; i < areas[AREA_RAM].frames.size(); i++) {
+        DecodedInstr* frame = frameAt(AREA_RAM, i);
+        if (frame != NULL) {
+            for (unsigned int j = 0; j < FRAMESIZE; j++)
+                __atomic_store_n(&frame[j].op, DecodedInstr::kEmpty, __ATOMIC_RELEASE);
+        }
+    }
+}
@@ -0,0 +1,169 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * Copyright (C) 2011 Tomislav Jonjic
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_DECODE_CACHE_H
+#define UMPS_DECODE_CACHE_H
+
+#include <vector>
+
+#include "base/lang.h"
+#include "base/basic_types.h"
+#include "umps/types.h"
+
+// A DecodedInstr holds a MIPS instruction as produced by the
+// Processor decoder: the code of the handler which executes it, and
+// the operand fields that handler needs, extracted once and for all.
+struct DecodedInstr {
+    // op value of a slot not yet filled
+    static const uint8_t kEmpty = 0;
+
+    // instruction code, used by Processor to dispatch execution
+    uint8_t op;
+
+    // TRUE if the next instruction is in a branch delay slot
+    bool isBranch;
+
+    // register operands and shift amount; for MFC0/MTC0 rd holds the
+    // simulator internal CP0 register code
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+    uint8_t shamt;
+
+    // slot version, odd while the slot is being filled (see
+    // DecodeCache::Read())
+    uint16_t seq;
+
+    // immediate operand, already sign- or zero-extended as needed by
+    // the instruction; branch offsets are in bytes, jump targets are
+    // the low 28 bits of the destination address
+    Word imm;
+
+    // the raw instruction word
+    Word instr;
+};
+
+// This class holds the decoded form of the instructions fetched from
+// RAM and ROM areas, one lazily allocated table per memory frame.
+// Decoding depends on the instruction word only, so a single cache
+// is shared by all processors; SystemBus invalidates slots whenever
+// the memory they were decoded from is written.
+//
+// Processors running in parallel may fill, empty and read the same
+// slot at once, and allocate the same frame table. Slots are therefore
+// only accessed through Read() and Fill(), which work as a sequence
+// lock: a reader retries (i.e. decodes the instruction itself) if it
+// sees a slot version change under it.
+class DecodeCache {
+public:
+    DecodeCache(Word ramSize, Word biosSize, Word bootSize);
+    ~DecodeCache();
+
+    // This method returns the cache slot for the instruction at
+    // physical address paddr, or NULL if paddr does not lie in RAM
+    // or ROM. The slot op is kEmpty if it has not been filled yet
+    DecodedInstr* Lookup(Word paddr);
+
+    // This method copies slot into di and returns TRUE, or returns
+    // FALSE if the slot is empty or is being filled meanwhile
+    static bool Read(const DecodedInstr* slot, DecodedInstr* di);
+
+    // This method fills slot with di, unless another processor is
+    // already filling it
+    static void Fill(DecodedInstr* slot, const DecodedInstr& di);
+
+    // This method empties the slot for physical address paddr, if any
+    void Invalidate(Word paddr);
+
+    // This method empties the slots for the nWords words starting at
+    // physical address paddr, which must all lie in RAM
+    void Invalidate(Word paddr, Word nWords);
+
+    // This method empties all the slots for RAM, when its contents
+    // are replaced as a whole
+    void InvalidateRam();
+
+private:
+    enum {
+        AREA_RAM,
+        AREA_BIOS,
+        AREA_BOOT,
+        N_AREAS
+    };
+
+    struct Area {
+        Word base;
+        Word size;
+        std::vector<DecodedInstr*> frames;
+    };
+
+    Area areas[N_AREAS];
+
+    void initArea(unsigned int area, Word base, Word size);
+
+    // This method returns the table for frame frameNo of area, or NULL
+    // if none has been allocated yet
+    DecodedInstr* frameAt(unsigned int area, Word frameNo) const
+    {
+        return __atomic_load_n(&areas[area].frames[frameNo], __ATOMIC_ACQUIRE);
+    }
+
+    DISABLE_COPY_AND_ASSIGNMENT(DecodeCache);
+};
+
+inline bool DecodeCache::Read(const DecodedInstr* slot, DecodedInstr* di)
+{
+    uint16_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+    di->op = __atomic_load_n(&slot->op, __ATOMIC_RELAXED);
+    di->isBranch = __atomic_load_n(&slot->isBranch, __ATOMIC_RELAXED);
+    di->rs = __atomic_load_n(&slot->rs, __ATOMIC_RELAXED);
+    di->rt = __atomic_load_n(&slot->rt, __ATOMIC_RELAXED);
+    di->rd = __atomic_load_n(&slot->rd, __ATOMIC_RELAXED);
+    di->shamt = __atomic_load_n(&slot->shamt, __ATOMIC_RELAXED);
+    di->imm = __atomic_load_n(&slot->imm, __ATOMIC_RELAXED);
+    di->instr = __atomic_load_n(&slot->instr, __ATOMIC_RELAXED);
+    di->seq = seq;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(seq & 1) && di->op != DecodedInstr::kEmpty &&
+        __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+inline void DecodeCache::Fill(DecodedInstr* slot, const DecodedInstr& di)
+{
+    uint16_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || !__sync_bool_compare_and_swap(&slot->seq, seq, seq + 1))
+        return;
+
+    __atomic_store_n(&slot->op, di.op, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->isBranch, di.isBranch, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->rs, di.rs, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->rt, di.rt, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->rd, di.rd, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->shamt, di.shamt, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->imm, di.imm, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->instr, di.instr, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, (uint16_t) (seq + 2), __ATOMIC_RELEASE);
+}
+
+#endif // UMPS_DECODE_CACHE_H
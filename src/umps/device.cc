@@ -35,8 +35,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include <boost/bind.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include <umps/const.h>
 #include "umps/types.h"
@@ -53,6 +61,7 @@
 #include "umps/error.h"
 #include "umps/vde_network.h"
 #include "umps/machine.h"
+#include "umps/snapshot.h"
 
 
 // last operation result description
@@ -68,6 +77,173 @@ HIDDEN const char* const opResult[2] = {
 HIDDEN char strbuf[STRBUFSIZE];
 
 
+// device output buffer size and minimum host time between flushes
+// (secs) under FLUSH_INTERVAL
+#define LOGBUFSIZE      4096
+#define LOGFLUSHPERIOD  1
+
+// initial terminal input buffer size
+#define INPUTRINGSIZE   4096
+
+
+// OutputLog class holds the output of a printer or terminal for its log
+// file, and writes it out as the device flush policy asks for (see
+// OutputFlushPolicy), so that characters do not cost a write each.
+// Its methods return FALSE on write errors (errno is set)
+
+class OutputLog {
+public:
+    OutputLog(FILE* file, OutputFlushPolicy policy)
+        : file(file),
+          policy(policy),
+          count(0),
+          lastFlush(time(NULL))
+    {}
+
+    bool Put(char c);
+    bool Write(const char* data, size_t length);
+    bool Flush();
+    bool FlushExpired();
+
+private:
+    FILE* const file;
+    const OutputFlushPolicy policy;
+
+    char buf[LOGBUFSIZE];
+    size_t count;
+
+    time_t lastFlush;
+};
+
+bool OutputLog::Put(char c)
+{
+    buf[count++] = c;
+
+    switch (policy) {
+    case FLUSH_CHAR:
+        return Flush();
+    case FLUSH_LINE:
+        if (c == '\n')
+            return Flush();
+        break;
+    case FLUSH_INTERVAL:
+        if (time(NULL) - lastFlush >= LOGFLUSHPERIOD)
+            return Flush();
+        break;
+    default:
+        break;
+    }
+
+    return count < LOGBUFSIZE || Flush();
+}
+
+bool OutputLog::Write(const char* data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        if (!Put(data[i]))
+            return false;
+    return true;
+}
+
+
+// InputRing class holds the input a terminal has yet to receive, in a
+// circular buffer which grows as needed. Data may also be read straight
+// into its free space, with FreeSpace() and Commit()
+
+class InputRing {
+public:
+    InputRing()
+        : buf(INPUTRINGSIZE),
+          head(0),
+          count(0)
+    {}
+
+    size_t Size() const { return count; }
+
+    unsigned char Get()
+    {
+        unsigned char c = buf[head];
+        head = (head + 1) % buf.size();
+        count--;
+        return c;
+    }
+
+    void Put(const char* data, size_t length);
+    void Clear() { head = count = 0; }
+
+    char* FreeSpace(size_t* length);
+    void Commit(size_t length) { count += length; }
+
+    std::string Contents() const;
+
+private:
+    std::vector<char> buf;
+    size_t head;
+    size_t count;
+};
+
+void InputRing::Put(const char* data, size_t length)
+{
+    if (count + length > buf.size()) {
+        std::vector<char> newBuf(std::max(2 * buf.size(), count + length));
+        for (size_t i = 0; i < count; i++)
+            newBuf[i] = buf[(head + i) % buf.size()];
+        buf.swap(newBuf);
+        head = 0;
+    }
+
+    size_t tail = (head + count) % buf.size();
+    size_t first = std::min(length, buf.size() - tail);
+    memcpy(&buf[tail], data, first);
+    memcpy(&buf[0], data + first, length - first);
+    count += length;
+}
+
+// This method returns the contiguous free space following the data,
+// *length chars long
+char* InputRing::FreeSpace(size_t* length)
+{
+    if (count == 0)
+        head = 0;
+
+    size_t tail = (head + count) % buf.size();
+    if (count == buf.size())
+        *length = 0;
+    else if (tail < head)
+        *length = head - tail;
+    else
+        *length = buf.size() - tail;
+    return &buf[tail];
+}
+
+std::string InputRing::Contents() const
+{
+    std::string contents;
+    for (size_t i = 0; i < count; i++)
+        contents += buf[(head + i) % buf.size()];
+    return contents;
+}
+
+bool OutputLog::Flush()
+{
+    if (count > 0 && fwrite(buf, 1, count, file) != count)
+        return false;
+    count = 0;
+    lastFlush = time(NULL);
+    return true;
+}
+
+// This method flushes the buffer if the FLUSH_INTERVAL policy is in
+// force and the interval has gone by, so that output written just
+// before the machine went quiet does not wait for more output
+bool OutputLog::FlushExpired()
+{
+    if (policy == FLUSH_INTERVAL && count > 0 && time(NULL) - lastFlush >= LOGFLUSHPERIOD)
+        return Flush();
+    return true;
+}
+
+
 // common device register definitions
 #define STATUS 	0
 #define COMMAND 1
@@ -83,6 +259,11 @@ HIDDEN char strbuf[STRBUFSIZE];
 #define RESET   0
 #define ACK     1
 
+// operation completion time in fast I/O mode (in cycles): short, but
+// leaves the cpu a few instructions before the interrupt, as real
+// devices always do
+#define FASTIOTICKS     16
+
 //
 // PrinterDevice specific commands, error codes, completion times (in microseconds)
 //
@@ -138,6 +319,10 @@ HIDDEN char strbuf[STRBUFSIZE];
 // controller reset time (microsecs)
 #define DISKRESETTIME   400     
 
+// minimum host time between syncs of disk image changes (secs), under
+// DISK_SYNC_PERIODIC
+#define DISKSYNCPERIOD  5
+
 // other performance figures are loaded from file
 
 // controller commands
@@ -222,6 +407,7 @@ HIDDEN char strbuf[STRBUFSIZE];
 // This function decodes device STATUS field and tells if previous operation
 // has been successful or not
 HIDDEN const char * isSuccess(unsigned int devType, Word regVal);
+HIDDEN void restoreStatStr(SnapshotReader* in, char* buf, size_t size);
 
 
 /****************************************************************************/
@@ -338,6 +524,16 @@ void Device::Input(const char * inputstr)
     Panic("Input directed to a non-Terminal device in Device::Input()");
 }
 
+void Device::Flush()
+{
+    // nothing to write out
+}
+
+void Device::FlushExpired()
+{
+    // nothing to write out
+}
+
 // This method allows to load/unload tapes inside a TapeDevice. For it, if
 // tFName == NULL or EMPTYSTR, method returns TRUE if a new tape may be
 // loaded, FALSE otherwise; else, if tFName != NULL it tries to load the
@@ -358,7 +554,34 @@ bool Device::isBusy() const
 
 uint64_t Device::scheduleIOEvent(uint64_t delay)
 {
-    return bus->scheduleEvent(delay, boost::bind(&Device::CompleteDevOp, this));
+    // Capping (rather than replacing) the delay leaves operations that
+    // were already short untouched; all others complete FASTIOTICKS
+    // after they were started, i.e. in the order they were started,
+    // which need not be the order nominal timings would give
+    if (bus->getConfig()->isFastIOEnabled())
+        delay = std::min(delay, (uint64_t) FASTIOTICKS);
+    return schedulePollEvent(delay);
+}
+
+uint64_t Device::schedulePollEvent(uint64_t delay)
+{
+    bus->scheduleEvent(delay, SystemBus::EVENT_DEVICE_OP, intL, devNum);
+    return bus->getEventClock() + delay;
+}
+
+void Device::Save(SnapshotWriter* out) const
+{
+    out->PutWords(reg, DEVREGLEN);
+    out->PutU64(complTime);
+    out->PutBool(isWorking);
+}
+
+void Device::Restore(SnapshotReader* in)
+{
+    in->GetWords(reg, DEVREGLEN);
+    complTime = in->GetU64();
+    isWorking = in->GetBool();
+    SignalConditionChanged(isWorking);
 }
 
 /****************************************************************************/
@@ -370,7 +593,7 @@ uint64_t Device::scheduleIOEvent(uint64_t delay)
 // It adds to Device data structure:
 // a pointer to SetupInfo object containing printer log file name;
 // a static buffer for device operation & status description;
-// a FILE structure for log file access.
+// a FILE structure for log file access, and a buffer for it.
 
 //
 // See Device class methods description for interface
@@ -390,10 +613,16 @@ PrinterDevice::PrinterDevice(SystemBus* bus, const MachineConfig* cfg,
         sprintf(strbuf, "Cannot open printer %u file : %s", devNum, strerror(errno));
         Panic(strbuf);
     }
+    // output is buffered by prntLog
+    setvbuf(prntFile, (char *) NULL, _IONBF, 0);
+    prntLog = new OutputLog(prntFile, config->getDeviceFlushPolicy(il, devNo));
 }
 
 PrinterDevice::~PrinterDevice()
 {
+    Flush();
+    delete prntLog;
+
     // tries to close log file
     if (fclose(prntFile) == EOF) {
         sprintf(strbuf, "Cannot close printer file %u : %s", devNum, strerror(errno));
@@ -464,6 +693,35 @@ const char* PrinterDevice::getDevSStr()
     return statStr;
 }
 
+void PrinterDevice::Flush()
+{
+    if (!prntLog->Flush()) {
+        sprintf(strbuf, "Error writing printer %u file : %s", devNum, strerror(errno));
+        Panic(strbuf);
+    }
+}
+
+void PrinterDevice::FlushExpired()
+{
+    if (!prntLog->FlushExpired()) {
+        sprintf(strbuf, "Error writing printer %u file : %s", devNum, strerror(errno));
+        Panic(strbuf);
+    }
+}
+
+void PrinterDevice::Save(SnapshotWriter* out) const
+{
+    Device::Save(out);
+    out->PutString(statStr);
+}
+
+void PrinterDevice::Restore(SnapshotReader* in)
+{
+    Device::Restore(in);
+    restoreStatStr(in, statStr, sizeof(statStr));
+    SignalStatusChanged(getDevSStr());
+}
+
 unsigned int PrinterDevice::CompleteDevOp()
 {
     // checks which operation must be completed: for each, sets device
@@ -480,11 +738,11 @@ unsigned int PrinterDevice::CompleteDevOp()
     case PRNTCHR:
         if (isWorking) {
             // normal operation
-            if (fputc((unsigned char) reg[DATA0], prntFile) == EOF) {
+            if (!prntLog->Put((unsigned char) reg[DATA0])) {
                 sprintf(strbuf, "Error writing printer %u file : %s", devNum, strerror(errno));
                 Panic(strbuf);
             }
-            fflush(prntFile);
+            SignalPrinted.emit((unsigned char) reg[DATA0]);
             sprintf(statStr, "Printed char 0x%.2X : waiting for ACK", (unsigned char) reg[DATA0]);
             reg[STATUS] = READY;
         } else {
@@ -515,8 +773,9 @@ unsigned int PrinterDevice::CompleteDevOp()
 // It adds to Device data structure:
 // a pointer to SetupInfo object containing terminal log file name;
 // a static buffer for device operation & status description;
-// a FILE structure for log file access;
-// some structures for handling terminal transmitter and receiver.
+// a FILE structure for log file access, and a buffer for it;
+// some structures for handling terminal transmitter and receiver,
+// including a host file descriptor for input.
 
 //
 // See Device class methods description for interface
@@ -529,8 +788,10 @@ TerminalDevice::TerminalDevice(SystemBus* bus, const MachineConfig* cfg,
 {
     dType = TERMDEV;
     isWorking = true;
-    recvBuf = NULL;
-    recvBp = 0;
+    recvRing = new InputRing();
+    inputFd = -1;
+    inputPty = false;
+    inputRegular = false;
     reg[RECVSTATUS] = READY;
     reg[TRANSTATUS] = READY;
     sprintf(recvStatStr, "Idle");
@@ -545,13 +806,24 @@ TerminalDevice::TerminalDevice(SystemBus* bus, const MachineConfig* cfg,
         sprintf(strbuf, "Cannot open terminal %u file : %s", devNum, strerror(errno));
         Panic(strbuf);
     }
-    // else file has been open with success: set it to no buffering for quick 
-    // terminal screen update
+    // else file has been open with success: set it to no buffering, as
+    // output is buffered by termLog
     setvbuf(termFile, (char *) NULL, _IONBF, 0);
+    termLog = new OutputLog(termFile, config->getDeviceFlushPolicy(il, devNo));
+
+    if (!config->getTerminalInput(devNo).empty())
+        attachInput(config->getTerminalInput(devNo));
 }
 
 TerminalDevice::~TerminalDevice()
 {
+    if (inputFd >= 0)
+        close(inputFd);
+    delete recvRing;
+
+    Flush();
+    delete termLog;
+
     if (fclose(termFile) == EOF) {
         sprintf(strbuf, "Cannot close terminal file %u : %s", devNum, strerror(errno));
         Panic(strbuf);
@@ -675,8 +947,8 @@ void TerminalDevice::WriteDevReg(unsigned int regnum, Word data)
 
 const char* TerminalDevice::getDevSStr()
 {
-    sprintf(strbuf, "%s\n%s", recvStatStr, tranStatStr); 
-    return strbuf;
+    sprintf(statStr, "%s\n%s", recvStatStr, tranStatStr);
+    return statStr;
 }
 
 const char* TerminalDevice::getTXStatus() const
@@ -694,6 +966,38 @@ std::string TerminalDevice::getCTimeInfo() const
     return getRXCTimeInfo() + "\n" + getTXCTimeInfo();
 }
 
+void TerminalDevice::Save(SnapshotWriter* out) const
+{
+    Device::Save(out);
+
+    // Only input yet to be received is saved, and not what the input
+    // file may still hold
+    out->PutString(recvRing->Contents());
+    out->PutString(recvStatStr);
+    out->PutString(tranStatStr);
+    out->PutU64(recvCTime);
+    out->PutU64(tranCTime);
+    out->PutBool(recvIntPend);
+    out->PutBool(tranIntPend);
+}
+
+void TerminalDevice::Restore(SnapshotReader* in)
+{
+    Device::Restore(in);
+
+    std::string input = in->GetString();
+    recvRing->Clear();
+    recvRing->Put(input.data(), input.size());
+
+    restoreStatStr(in, recvStatStr, sizeof(recvStatStr));
+    restoreStatStr(in, tranStatStr, sizeof(tranStatStr));
+    recvCTime = in->GetU64();
+    tranCTime = in->GetU64();
+    recvIntPend = in->GetBool();
+    tranIntPend = in->GetBool();
+    SignalStatusChanged(getDevSStr());
+}
+
 std::string TerminalDevice::getTXCTimeInfo() const
 {
     if (reg[TRANSTATUS] == BUSY)
@@ -748,15 +1052,17 @@ unsigned int TerminalDevice::CompleteDevOp()
             break;
 
         case RECVCHR:
-            if (recvBuf == NULL || recvBuf[recvBp] == EOS) {
+            if (recvRing->Size() == 0 && inputFd >= 0)
+                readInput();
+            if (recvRing->Size() == 0) {
                 // no char in input: wait another receiver cycle
-                recvCTime = scheduleIOEvent(RECVCHRTIME * config->getClockRate());
+                recvCTime = schedulePollEvent(RECVCHRTIME * config->getClockRate());
             } else {
                 // buffer is not empty
                 if (isWorking) {
-                    sprintf(recvStatStr, "Received char 0x%.2X : waiting for ACK", recvBuf[recvBp]);
-                    reg[RECVSTATUS] = (((Word) recvBuf[recvBp]) << BYTELEN) | RECVD;
-                    recvBp++;
+                    unsigned char c = recvRing->Get();
+                    sprintf(recvStatStr, "Received char 0x%.2X : waiting for ACK", c);
+                    reg[RECVSTATUS] = (((Word) c) << BYTELEN) | RECVD;
                 } else {
                     // no operation & error simulation
                     sprintf(recvStatStr, "Error receiving char : waiting for ACK");
@@ -790,12 +1096,18 @@ unsigned int TerminalDevice::CompleteDevOp()
 
         case TRANCHR:
             if (isWorking) {
-                if (fputc((unsigned char) ((reg[TRANCOMMAND] >> BYTELEN) & BYTEMASK), termFile) == EOF) {
+                if (!termLog->Put((unsigned char) ((reg[TRANCOMMAND] >> BYTELEN) & BYTEMASK))) {
                     sprintf(strbuf, "Error writing terminal %u file : %s", devNum, strerror(errno));
                     Panic(strbuf);
                 }
                 // else operation is successful:
-                fflush(termFile);
+                if (inputPty) {
+                    // a pseudo-terminal shows output too; chars are
+                    // dropped if nobody is reading them
+                    char c = (reg[TRANCOMMAND] >> BYTELEN) & BYTEMASK;
+                    ssize_t n = write(inputFd, &c, 1);
+                    (void) n;
+                }
                 SignalTransmitted.emit((unsigned char) ((reg[TRANCOMMAND] >> BYTELEN) & BYTEMASK));
                 sprintf(tranStatStr, "Transm. char 0x%.2lX : waiting for ACK",
                         (reg[TRANCOMMAND] >> BYTELEN) & BYTEMASK);
@@ -822,32 +1134,87 @@ unsigned int TerminalDevice::CompleteDevOp()
     return devMod;
 }
 
-void TerminalDevice::Input(const char* inputstr)
+void TerminalDevice::Flush()
 {
-    char* strp;
+    if (!termLog->Flush()) {
+        sprintf(strbuf, "Error writing terminal %u file : %s", devNum, strerror(errno));
+        Panic(strbuf);
+    }
+}
 
-    if (recvBuf != NULL && recvBuf[recvBp] == EOS) {
-        // buffer exausted: delete it
-        delete recvBuf;
-        recvBuf = NULL;
+void TerminalDevice::FlushExpired()
+{
+    if (!termLog->FlushExpired()) {
+        sprintf(strbuf, "Error writing terminal %u file : %s", devNum, strerror(errno));
+        Panic(strbuf);
     }
+}
+
+void TerminalDevice::Input(const char* inputstr)
+{
+    // input is received with a trailing newline
+    size_t length = strlen(inputstr);
+    recvRing->Put(inputstr, length);
+    recvRing->Put("\n", 1);
+
+    // writes input to log file 
+    logInput(inputstr, length);
+    logInput("\n", 1);
+}
 
-    if (recvBuf == NULL) {
-        // simply copies inputstr into it, adding a trailing '\n'
-        recvBuf = new char[strlen(inputstr) + 2];
-        sprintf(recvBuf, "%s\n", inputstr);
+// This method opens input file name, or creates a pseudo-terminal if
+// name is "pty"; either is read without blocking, as input is needed
+void TerminalDevice::attachInput(const std::string& name)
+{
+    if (name == "pty") {
+        inputFd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (inputFd < 0 || grantpt(inputFd) < 0 || unlockpt(inputFd) < 0 ||
+            ptsname(inputFd) == NULL || fcntl(inputFd, F_SETFL, O_NONBLOCK) < 0)
+        {
+            sprintf(strbuf, "Cannot create terminal %u pseudo-terminal : %s", devNum, strerror(errno));
+            Panic(strbuf);
+        }
+        inputName = ptsname(inputFd);
+        inputPty = true;
     } else {
-        // copies the unreceived buffer part plus the new input into
-        // a new buffer
-        strp = new char [(strlen(recvBuf) - recvBp) + strlen(inputstr) + 2];
-        sprintf(strp, "%s%s\n",&(recvBuf[recvBp]), inputstr);
-        delete recvBuf;
-        recvBuf = strp;
+        // O_NONBLOCK keeps a FIFO from blocking until a writer shows up
+        struct stat st;
+        if ((inputFd = open(name.c_str(), O_RDONLY | O_NONBLOCK)) < 0 || fstat(inputFd, &st) < 0) {
+            sprintf(strbuf, "Cannot open terminal %u input file : %s", devNum, strerror(errno));
+            Panic(strbuf);
+        }
+        inputName = name;
+        inputRegular = S_ISREG(st.st_mode);
     }
-    recvBp = 0;
+}
 
-    // writes input to log file 
-    if (fprintf(termFile, "%s\n", inputstr) < 0) {
+// This method moves the input available on the host file descriptor,
+// if any, straight into the receiver buffer; it requires the buffer
+// to have some room
+void TerminalDevice::readInput()
+{
+    size_t length;
+    char* space = recvRing->FreeSpace(&length);
+    assert(length > 0);
+
+    ssize_t n = read(inputFd, space, length);
+    if (n > 0) {
+        logInput(space, n);
+        recvRing->Commit(n);
+    } else if (n == 0 && inputRegular) {
+        // end of file
+        close(inputFd);
+        inputFd = -1;
+    } else if (n < 0 && errno != EAGAIN && errno != EINTR && errno != EIO) {
+        // EIO is what a pseudo-terminal gives with no slave open
+        sprintf(strbuf, "Error reading terminal %u input file : %s", devNum, strerror(errno));
+        Panic(strbuf);
+    }
+}
+
+void TerminalDevice::logInput(const char* data, size_t length)
+{
+    if (!termLog->Write(data, length)) {
         sprintf(strbuf, "Error writing terminal %u file : %s", devNum, strerror(errno));
         Panic(strbuf);
     }
@@ -866,7 +1233,7 @@ void TerminalDevice::Input(const char* inputstr)
 // It adds to Device data structure:
 // a pointer to SetupInfo object containing disk image file name;
 // a static buffer for device operation & status description;
-// a FILE structure for disk image file access;
+// the disk image file, mapped in memory;
 // a set of disk parameters (read from disk image file header);
 // a Block object for file handling;
 // some items for performance computation.
@@ -884,6 +1251,7 @@ DiskDevice::DiskDevice(SystemBus* bus, const MachineConfig* cfg,
     diskBuf = new Block();
 
     // tries to access disk image file 
+    FILE* diskFile;
     if ((diskFile = fopen(config->getDeviceFile(intL, devNum).c_str(), "r+")) == NULL) {
         sprintf(strbuf, "Cannot open disk %u file : %s", devNum, strerror(errno));
         Panic(strbuf);
@@ -892,12 +1260,37 @@ DiskDevice::DiskDevice(SystemBus* bus, const MachineConfig* cfg,
     // else file has been open with success: tests if it is a valid disk file
     diskP = new DriveParams(diskFile, &diskOfs);
 
-    if (diskOfs == 0) {
+    // the file must hold the whole image, as sectors are accessed
+    // through the mapping; the geometry comes from the file header
+    // and is checked before the image size is worked out from it
+    unsigned int cyl = diskP->getCylNum();
+    unsigned int head = diskP->getHeadNum();
+    unsigned int sect = diskP->getSectNum();
+    bool validGeometry = INBOUNDS(cyl, 1, MAXCYL + 1) &&
+        INBOUNDS(head, 1, MAXHEAD + 1) && INBOUNDS(sect, 1, MAXSECT + 1);
+    uint64_t imageSize = 0;
+    if (validGeometry && diskOfs > 0)
+        imageSize = ((uint64_t) diskOfs + (uint64_t) cyl * head * sect * BLOCKSIZE) * WORDLEN;
+    diskMapSize = (size_t) imageSize;
+
+    struct stat st;
+    if (imageSize == 0 || diskMapSize != imageSize ||
+        fstat(fileno(diskFile), &st) < 0 || (uint64_t) st.st_size < imageSize)
+    {
         // file is not a valid disk file
         sprintf(strbuf, "Cannot open disk %u file : invalid/corrupted file", devNum);
         Panic(strbuf);
     }
 
+    diskMap = mmap(NULL, diskMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(diskFile), 0);
+    if (diskMap == MAP_FAILED) {
+        sprintf(strbuf, "Cannot map disk %u file : %s", devNum, strerror(errno));
+        Panic(strbuf);
+    }
+    fclose(diskFile);
+    lastSync = time(NULL);
+    unsynced = false;
+
     // DATA1 format == drive geometry: CYL CYL HEAD SECT
     reg[DATA1] = (diskP->getCylNum() << HWORDLEN) | (diskP->getHeadNum() << BYTELEN) | diskP->getSectNum();
 
@@ -908,13 +1301,11 @@ DiskDevice::DiskDevice(SystemBus* bus, const MachineConfig* cfg,
 
 DiskDevice::~DiskDevice()
 {
+    syncImage(NULL);
+    munmap(diskMap, diskMapSize);
+
     delete diskBuf;
     delete diskP;
-
-    if (fclose(diskFile) == EOF) {
-        sprintf(strbuf, "Cannot close disk file %u : %s", devNum, strerror(errno));
-        Panic(strbuf);
-    }
 }
 
 // Disk device register write: only COMMAND and DATA0 registers are
@@ -1089,10 +1480,91 @@ const char* DiskDevice::getDevSStr()
     return statStr;
 }
 
+// The disk image itself is not saved: snapshots only hold the sector
+// buffer and the drive state
+void DiskDevice::Save(SnapshotWriter* out) const
+{
+    Device::Save(out);
+    out->PutString(statStr);
+    for (unsigned int i = 0; i < BLOCKSIZE; i++)
+        out->PutWord(diskBuf->getWord(i));
+    out->PutWord(cylBuf);
+    out->PutWord(headBuf);
+    out->PutWord(sectBuf);
+    out->PutWord(currCyl);
+}
+
+void DiskDevice::Restore(SnapshotReader* in)
+{
+    Device::Restore(in);
+    restoreStatStr(in, statStr, sizeof(statStr));
+    for (unsigned int i = 0; i < BLOCKSIZE; i++)
+        diskBuf->setWord(i, in->GetWord());
+    cylBuf = in->GetWord();
+    headBuf = in->GetWord();
+    sectBuf = in->GetWord();
+    currCyl = in->GetWord();
+    SignalStatusChanged(getDevSStr());
+}
+
+// This method returns the location of sector (currCyl, head, sect)
+// in the disk image
+Word* DiskDevice::sectorPtr(unsigned int head, unsigned int sect) const
+{
+    return (Word*) diskMap + diskOfs +
+        ((currCyl * diskP->getHeadNum() * diskP->getSectNum()) +
+         (head * diskP->getSectNum()) + sect) * BLOCKSIZE;
+}
+
+// This method writes image changes back to the disk file as the sync
+// policy asks for, after sector has been written; a NULL sector means
+// the whole image must be synced
+void DiskDevice::syncImage(const Word* sector)
+{
+    char* start = (char*) diskMap;
+    size_t length = diskMapSize;
+    time_t now = time(NULL);
+
+    if (sector != NULL) {
+        switch (config->getDiskSyncPolicy()) {
+        case DISK_SYNC_WRITE: {
+            // msync() wants a page aligned start
+            size_t pageSize = sysconf(_SC_PAGESIZE);
+            size_t ofs = (char*) sector - start;
+            start += ofs - ofs % pageSize;
+            length = ofs % pageSize + BLOCKSIZE * WORDLEN;
+            break;
+        }
+        case DISK_SYNC_PERIODIC:
+            if (now - lastSync < DISKSYNCPERIOD) {
+                unsynced = true;
+                return;
+            }
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (msync(start, length, MS_SYNC) < 0) {
+        sprintf(strbuf, "Unable to write disk %u file : %s", devNum, strerror(errno));
+        Panic(strbuf);
+    }
+    lastSync = now;
+    unsynced = false;
+}
+
+// This method syncs the sectors written since the last sync under the
+// DISK_SYNC_PERIODIC policy once the period is over, even if no sector
+// is written afterwards
+void DiskDevice::FlushExpired()
+{
+    if (unsynced && time(NULL) - lastSync >= DISKSYNCPERIOD)
+        syncImage(NULL);
+}
+
 unsigned int DiskDevice::CompleteDevOp()
 {
-    // for file access
-    SWord blkOfs;
     unsigned int head, sect;
 
     // checks which operation must be completed: for each, sets device
@@ -1125,29 +1597,22 @@ unsigned int DiskDevice::CompleteDevOp()
         head = (reg[COMMAND] >> HWORDLEN) & BYTEMASK;
         sect = (reg[COMMAND] >> BYTELEN) & BYTEMASK;
         if (isWorking) {
-            blkOfs = (diskOfs + ((currCyl * diskP->getHeadNum() * diskP->getSectNum()) +
-                                 (head * diskP->getSectNum()) + sect) * BLOCKSIZE) * WORDLEN;
-
-            if (cylBuf != MAXWORDVAL || !diskBuf->ReadBlock(diskFile, blkOfs)) {
-                // Wanted sector is already in buffer or has been read correctly
-                cylBuf = currCyl;
-                headBuf = head;
-                sectBuf = sect;
-                if (bus->DMATransfer(diskBuf, reg[DATA0], true)) {
-                    // DMA transfer error
-                    reg[STATUS] = DMAERR;
-                    sprintf(statStr, "DMA error reading C/H/S 0x%.4X/0x%.2X/0x%.2X : waiting for ACK",
-                            currCyl, head, sect);
-                } else {
-                    // all ok
-                    sprintf(statStr, "C/H/S 0x%.4X/0x%.2X/0x%.2X block read: waiting for ACK",
-                            currCyl, head, sect);
-                    reg[STATUS] = READY;
-                }
+            // Wanted sector may already be in buffer
+            if (cylBuf == MAXWORDVAL)
+                memcpy(diskBuf->getBuffer(), sectorPtr(head, sect), BLOCKSIZE * WORDLEN);
+            cylBuf = currCyl;
+            headBuf = head;
+            sectBuf = sect;
+            if (bus->DMATransfer(diskBuf, reg[DATA0], true)) {
+                // DMA transfer error
+                reg[STATUS] = DMAERR;
+                sprintf(statStr, "DMA error reading C/H/S 0x%.4X/0x%.2X/0x%.2X : waiting for ACK",
+                        currCyl, head, sect);
             } else {
-                // ReadBlock() has failed for sure
-                sprintf(strbuf, "Unable to read disk %u file : invalid/corrupted file", devNum);
-                Panic(strbuf);
+                // all ok
+                sprintf(statStr, "C/H/S 0x%.4X/0x%.2X/0x%.2X block read: waiting for ACK",
+                        currCyl, head, sect);
+                reg[STATUS] = READY;
             }
         } else {
             // error simulation
@@ -1164,15 +1629,10 @@ unsigned int DiskDevice::CompleteDevOp()
         head = (reg[COMMAND] >> HWORDLEN) & BYTEMASK;
         sect = (reg[COMMAND] >> BYTELEN) & BYTEMASK;
         if (isWorking) {
-            blkOfs = (diskOfs +
-                      ((currCyl * diskP->getHeadNum() * diskP->getSectNum()) +
-                       (head * diskP->getSectNum()) + sect) * BLOCKSIZE) * WORDLEN;
-            if (diskBuf->WriteBlock(diskFile, blkOfs)) {
-                // error writing block to disk file
-                sprintf(strbuf, "Unable to write disk %u file : invalid/corrupted file", devNum);
-                Panic(strbuf);
-            }
-            // else all is ok: buffer is still valid
+            Word* sector = sectorPtr(head, sect);
+            memcpy(sector, diskBuf->getBuffer(), BLOCKSIZE * WORDLEN);
+            syncImage(sector);
+            // buffer is still valid
             sprintf(statStr, "C/H/S 0x%.4X/0x%.2X/0x%.2X block written : waiting for ACK",
                     currCyl, head, sect);
             reg[STATUS] = READY;
@@ -1204,8 +1664,8 @@ unsigned int DiskDevice::CompleteDevOp()
 // It adds to Device data structure:
 // a pointer to the configuration object containing tape cartridge log
 // file name; a static buffer for device operation & status
-// description; a FILE structure for log file access; a Block object
-// for file handling.
+// description; the cartridge file mapping; a Block object for file
+// handling.
 
 TapeDevice::TapeDevice(SystemBus* bus, const MachineConfig* config,
                        unsigned int line, unsigned int devNo)
@@ -1214,6 +1674,8 @@ TapeDevice::TapeDevice(SystemBus* bus, const MachineConfig* config,
 {
     dType = TAPEDEV;
     isWorking = true;
+    tapeMap = NULL;
+    tapeMapSize = 0;
     tapeFName = NULL;
     tapeBlk = new Block();
     tapeBp = 0;
@@ -1232,14 +1694,8 @@ TapeDevice::~TapeDevice()
 {
     delete tapeBlk;
 
-    if (tapeLoaded) {
-        delete tapeFName;
-        
-        if (fclose(tapeFile) == EOF) {
-            sprintf(strbuf, "Cannot close tape file %u : %s", devNum, strerror(errno));
-            Panic(strbuf);
-        }
-    }
+    if (tapeLoaded)
+        unloadTape();
 }
 
 // If tFName == NULL or EMPTYSTR, method returns TRUE if 
@@ -1258,24 +1714,35 @@ bool TapeDevice::TapeLoad(const char* tFName)
             // rewound: a safeguard to avoid tape ejection during I/O operations
             return false;
         } else {
-            if (tapeLoaded) {
+            if (tapeLoaded)
                 // a tape is currently loaded
-                delete tapeFName;
-                if (fclose(tapeFile) == EOF) {
-                    sprintf(strbuf, "Cannot close tape file %u : %s", devNum, strerror(errno));
-                    Panic(strbuf);
-                }
-                // else all is OK
-            }
+                unloadTape();
             tapeFName = new char [strlen(tFName) + 1];
             strcpy(tapeFName, tFName);
-            if ((tapeFile = fopen(tapeFName, "r")) == NULL ||
-                fread((void *) &tapeid, WORDLEN, 1, tapeFile) != 1 ||
-                tapeid != TAPEFILEID)
+            int fd;
+            struct stat st;
+            if ((fd = open(tapeFName, O_RDONLY)) < 0 ||
+                fstat(fd, &st) < 0 ||
+                (size_t) st.st_size < WORDLEN)
             {
                 sprintf(strbuf, "Cannot open tape %u file : invalid/corrupted file", devNum);
                 Panic(strbuf);
             }
+            tapeMapSize = st.st_size;
+            tapeMap = mmap(NULL, tapeMapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (tapeMap == MAP_FAILED) {
+                sprintf(strbuf, "Cannot map tape %u file : %s", devNum, strerror(errno));
+                Panic(strbuf);
+            }
+            close(fd);
+            // the tape is read from start to end, so the kernel may
+            // read ahead aggressively; failure here is harmless
+            madvise(tapeMap, tapeMapSize, MADV_SEQUENTIAL);
+            tapeid = *((Word*) tapeMap);
+            if (tapeid != TAPEFILEID) {
+                sprintf(strbuf, "Cannot open tape %u file : invalid/corrupted file", devNum);
+                Panic(strbuf);
+            }
             // else file opening is OK: setting tape parameters
             reg[DATA1] = TAPESTART;
             tapeLoaded = true;
@@ -1381,6 +1848,51 @@ const char* TapeDevice::getDevSStr()
     return statStr;
 }
 
+void TapeDevice::Save(SnapshotWriter* out) const
+{
+    Device::Save(out);
+    out->PutBool(tapeLoaded);
+    if (tapeLoaded)
+        out->PutString(tapeFName);
+    out->PutWord(tapeBp);
+    for (unsigned int i = 0; i < BLOCKSIZE; i++)
+        out->PutWord(tapeBlk->getWord(i));
+    out->PutString(statStr);
+}
+
+void TapeDevice::Restore(SnapshotReader* in)
+{
+    Device::Restore(in);
+
+    // The cartridge is put back into the drive unless it is already
+    // there; the register values saved above are left untouched
+    Word savedReg[DEVREGLEN];
+    for (unsigned int i = 0; i < DEVREGLEN; i++)
+        savedReg[i] = reg[i];
+
+    if (in->GetBool()) {
+        std::string fileName = in->GetString();
+        in->Expect(!fileName.empty());
+        if (!tapeLoaded || fileName != tapeFName) {
+            reg[STATUS] = READY;
+            reg[DATA1] = TAPESTART;
+            TapeLoad(fileName.c_str());
+        }
+    } else if (tapeLoaded) {
+        unloadTape();
+        tapeLoaded = false;
+    }
+
+    for (unsigned int i = 0; i < DEVREGLEN; i++)
+        reg[i] = savedReg[i];
+
+    tapeBp = in->GetWord();
+    for (unsigned int i = 0; i < BLOCKSIZE; i++)
+        tapeBlk->setWord(i, in->GetWord());
+    restoreStatStr(in, statStr, sizeof(statStr));
+    SignalStatusChanged(getDevSStr());
+}
+
 unsigned int TapeDevice::CompleteDevOp()
 {
     // checks which operation must be completed: for each, sets device
@@ -1397,10 +1909,8 @@ unsigned int TapeDevice::CompleteDevOp()
 
     case SKIPBLK:
         // a SKIPBLK is always successful (isWorking status does not matter)
-        if (tapeBlk->ReadBlock(tapeFile, (tapeBp * BLOCKSIZE * WORDLEN) + ((tapeBp + 1) * WORDLEN)) || \
-            fread((void *) &(reg[DATA1]), WORDLEN, 1, tapeFile) != 1 || reg[DATA1] > TAPEEOB)
-        {
-            sprintf(strbuf, "Error reading tape %u file : %s", devNum, strerror(errno));
+        if (readBlock(tapeBp)) {
+            sprintf(strbuf, "Error reading tape %u file : invalid/corrupted file", devNum);
             Panic(strbuf);
         }
         // else operation is successful: 
@@ -1410,10 +1920,8 @@ unsigned int TapeDevice::CompleteDevOp()
         break;
 
     case READBLK:
-        if (tapeBlk->ReadBlock(tapeFile, (tapeBp * BLOCKSIZE * WORDLEN) + ((tapeBp + 1) * WORDLEN)) ||
-            fread((void *) &(reg[DATA1]), WORDLEN, 1, tapeFile) != 1 || reg[DATA1] > TAPEEOB)
-        {
-            sprintf(strbuf, "Error reading tape %u file : %s", devNum, strerror(errno));
+        if (readBlock(tapeBp)) {
+            sprintf(strbuf, "Error reading tape %u file : invalid/corrupted file", devNum);
             Panic(strbuf);
         }
         // else read operation is successful:
@@ -1442,10 +1950,8 @@ unsigned int TapeDevice::CompleteDevOp()
             reg[DATA1] = TAPESTART;
         else
             // read previous block for terminator value 
-            if (tapeBlk->ReadBlock(tapeFile, ((tapeBp - 1) * BLOCKSIZE * WORDLEN) + (tapeBp * WORDLEN)) ||
-                fread((void *) &(reg[DATA1]), WORDLEN, 1, tapeFile) != 1 || reg[DATA1] > TAPEEOB)
-            {
-                sprintf(strbuf, "Error reading tape %u file : %s", devNum, strerror(errno));
+            if (readBlock(tapeBp - 1)) {
+                sprintf(strbuf, "Error reading tape %u file : invalid/corrupted file", devNum);
                 Panic(strbuf);
             }
         // else operation is successful:
@@ -1466,6 +1972,33 @@ unsigned int TapeDevice::CompleteDevOp()
     return STATUS;
 }
 
+// This method releases the cartridge file of the loaded tape
+void TapeDevice::unloadTape()
+{
+    delete [] tapeFName;
+    tapeFName = NULL;
+    munmap(tapeMap, tapeMapSize);
+    tapeMap = NULL;
+    tapeMapSize = 0;
+}
+
+// This method copies block blockNo of the loaded tape into tapeBlk,
+// and its terminator into DATA1. It returns TRUE if the tape file is
+// too short or the terminator is invalid, FALSE otherwise
+bool TapeDevice::readBlock(unsigned int blockNo)
+{
+    // the file holds TAPEFILEID, then each block followed by its
+    // terminator
+    size_t ofs = 1 + (size_t) blockNo * (BLOCKSIZE + 1);
+    if ((ofs + BLOCKSIZE + 1) * WORDLEN > tapeMapSize)
+        return true;
+
+    const Word* block = (const Word*) tapeMap + ofs;
+    memcpy(tapeBlk->getBuffer(), block, BLOCKSIZE * WORDLEN);
+    reg[DATA1] = block[BLOCKSIZE];
+    return reg[DATA1] > TAPEEOB;
+}
+
 /****************************************************************************/
 /* Definitions strictly local to the module.                                */
 /****************************************************************************/
@@ -1501,6 +2034,15 @@ HIDDEN const char * isSuccess(unsigned int devType, Word regVal)
     return(result);
 }       
 
+// This function reads a device status description saved by
+// SnapshotWriter::PutString() into buf, of the given size
+HIDDEN void restoreStatStr(SnapshotReader* in, char* buf, size_t size)
+{
+    std::string s = in->GetString();
+    in->Expect(s.size() < size);
+    strcpy(buf, s.c_str());
+}
+
 
 // EthDevice class allows to emulate an ethernet interface
 
@@ -1522,11 +2064,11 @@ EthDevice::EthDevice(SystemBus* bus, const MachineConfig* cfg, unsigned int line
         throw EthError(devNo);
 
     /* open the net */
-    netint = new netinterface(config->getDeviceFile(intL, devNum).c_str(),
+    netint = opennetinterface(config->getDeviceFile(intL, devNum).c_str(),
                               (const char*) config->getMACId(devNum),
                               devNum);
     if (netint->getmode() & INTERRUPT) {
-        scheduleIOEvent(POLLNETTIME * config->getClockRate());
+        schedulePollEvent(POLLNETTIME * config->getClockRate());
         polling = true;
     } else {
         polling = false;
@@ -1625,6 +2167,30 @@ const char* EthDevice::getDevSStr()
     return statStr;
 }
 
+// The network interface state is not saved
+void EthDevice::Save(SnapshotWriter* out) const
+{
+    Device::Save(out);
+    for (unsigned int i = 0; i < BLOCKSIZE; i++) {
+        out->PutWord(readbuf->getWord(i));
+        out->PutWord(writebuf->getWord(i));
+    }
+    out->PutString(statStr);
+    out->PutBool(polling);
+}
+
+void EthDevice::Restore(SnapshotReader* in)
+{
+    Device::Restore(in);
+    for (unsigned int i = 0; i < BLOCKSIZE; i++) {
+        readbuf->setWord(i, in->GetWord());
+        writebuf->setWord(i, in->GetWord());
+    }
+    restoreStatStr(in, statStr, sizeof(statStr));
+    polling = in->GetBool();
+    SignalStatusChanged(getDevSStr());
+}
+
 unsigned int EthDevice::CompleteDevOp()
 {
     int rp = reg[STATUS] & READPENDING;
@@ -1644,7 +2210,7 @@ unsigned int EthDevice::CompleteDevOp()
                 /* there are no waiting packets;
                    continue polling if the user hasn't changed her mind */
                 if (netint->getmode() & INTERRUPT) {
-                    scheduleIOEvent(POLLNETTIME * config->getClockRate());
+                    schedulePollEvent(POLLNETTIME * config->getClockRate());
                     polling = true;
                 }
             }
@@ -1746,7 +2312,7 @@ unsigned int EthDevice::CompleteDevOp()
         // there are no pending read requests, schedule another poll
         // event.
         if (netint->getmode() & INTERRUPT && !polling && !rp) {
-            scheduleIOEvent(POLLNETTIME * config->getClockRate());
+            schedulePollEvent(POLLNETTIME * config->getClockRate());
             polling = true;
         }
     }
@@ -22,6 +22,8 @@
 #ifndef UMPS_DEVICE_H
 #define UMPS_DEVICE_H
 
+#include <time.h>
+
 #include "umps/types.h"
 #include "umps/const.h"
 
@@ -48,6 +50,10 @@ class Block;
 class DriveParams;
 class netinterface;
 class MachineConfig;
+class SnapshotWriter;
+class SnapshotReader;
+class OutputLog;
+class InputRing;
 
 // Device class defines the interface to all device types, and represents
 // the "uninstalled device" (NULLDEV) itself. Device objects are created and
@@ -96,6 +102,16 @@ public:
     // devices (NULLDEV included) and produces a panic message
     virtual void Input(const char* inputstr);
 
+    // This method writes out any device output still buffered (see
+    // OutputFlushPolicy); only printers and terminals buffer output
+    virtual void Flush();
+
+    // This method writes out whatever the device has kept buffered
+    // for longer than its policy allows; it is called periodically
+    // while the machine runs, as devices otherwise only look at the
+    // host clock when they are used
+    virtual void FlushExpired();
+
     // This method allows to load/unload tapes inside a TapeDevice. For
     // it, if tFName == NULL or EMPTYSTR, method returns TRUE if a new
     // tape may be loaded, FALSE otherwise; else, if tFName != NULL it
@@ -122,12 +138,26 @@ public:
     void setCondition(bool working);
     bool getCondition() const { return isWorking; }
 
+    // These methods save and restore the device state, including any
+    // operation in progress, as part of a machine snapshot (see
+    // Machine::SaveSnapshot())
+    virtual void Save(SnapshotWriter* out) const;
+    virtual void Restore(SnapshotReader* in);
+
     sigc::signal<void, const char*> SignalStatusChanged;
     sigc::signal<void, bool> SignalConditionChanged;
 
 protected:
     virtual bool isBusy() const;
+
+    // These methods schedule the completion of the current device
+    // operation after delay cycles, and return its timestamp. In fast
+    // I/O mode scheduleIOEvent() shortens the delay (see
+    // MachineConfig::isFastIOEnabled()); schedulePollEvent() is for
+    // periodic checks on the host side, e.g. for incoming data, and
+    // always waits the full delay
     uint64_t scheduleIOEvent(uint64_t delay);
+    uint64_t schedulePollEvent(uint64_t delay);
 
     // Interrupt line and device number
     unsigned int intL;
@@ -160,7 +190,7 @@ protected:
 // It adds to Device data structure:
 // a pointer to SetupInfo object containing printer log file name;
 // a static buffer for device operation & status description;
-// a FILE structure for log file access.
+// a FILE structure for log file access, and a buffer for it.
 
 class PrinterDevice : public Device {
 public:
@@ -169,12 +199,19 @@ public:
     virtual void WriteDevReg(unsigned int regnum, Word data);
     virtual unsigned int CompleteDevOp();
     virtual const char* getDevSStr();
+    virtual void Save(SnapshotWriter* out) const;
+    virtual void Restore(SnapshotReader* in);
+    virtual void Flush();
+    virtual void FlushExpired();
+
+    sigc::signal<void, char> SignalPrinted;
 
 private:
     const MachineConfig* const config;
 
     // log file handling
     FILE * prntFile;
+    OutputLog * prntLog;
 
     char statStr[PRNTBUFSIZE];
 };
@@ -191,8 +228,9 @@ private:
 // It adds to Device data structure:
 // a pointer to SetupInfo object containing terminal log file name;
 // a static buffer for device operation & status description;
-// a FILE structure for log file access;
-// some structures for handling terminal transmitter and receiver.
+// a FILE structure for log file access, and a buffer for it;
+// some structures for handling terminal transmitter and receiver,
+// including a host file descriptor for input.
 
 class TerminalDevice : public Device {
 public:
@@ -211,6 +249,15 @@ public:
     virtual std::string getCTimeInfo() const;
 
     virtual void Input(const char * inputstr);
+    virtual void Save(SnapshotWriter* out) const;
+    virtual void Restore(SnapshotReader* in);
+    virtual void Flush();
+    virtual void FlushExpired();
+
+    // This method returns the name of the host file input is read
+    // from (see MachineConfig::setTerminalInput()), which is the
+    // slave device for a pseudo-terminal; it is empty if there is none
+    const std::string& getInputName() const { return inputName; }
 
     sigc::signal<void, char> SignalTransmitted;
 
@@ -219,10 +266,18 @@ private:
 
     // for log file handling
     FILE * termFile;
-
-    // receiver buffer and pointer to first character to receive from it
-    char * recvBuf;
-    unsigned int recvBp;
+    OutputLog * termLog;
+
+    // input yet to be received
+    InputRing * recvRing;
+
+    // host input file descriptor (-1 if none), and its name; input
+    // stops at the end of a regular file, but not of FIFOs and
+    // pseudo-terminals, which may get more later
+    int inputFd;
+    bool inputPty;
+    bool inputRegular;
+    std::string inputName;
 		
     // static buffer for receiver
     char recvStatStr[TERMBUFSIZE];
@@ -230,6 +285,10 @@ private:
     // static buffer for transmitter
     char tranStatStr[TERMBUFSIZE];
 
+    // buffer for the whole device status, which is not shared with
+    // other devices as machines may run on different threads
+    char statStr[2 * TERMBUFSIZE];
+
     // Completion time for current receiver operation (if any)
     uint64_t recvCTime;
 
@@ -241,6 +300,10 @@ private:
 
     // transmitter operation pending flag
     bool tranIntPend;
+
+    void attachInput(const std::string& name);
+    void readInput();
+    void logInput(const char* data, size_t length);
 };
 
 
@@ -259,7 +322,7 @@ private:
 // It adds to Device data structure:
 // a pointer to SetupInfo object containing printer log file name;
 // a static buffer for device operation & status description;
-// a FILE structure for disk image file access;
+// the disk image file, mapped in memory;
 // a set of disk parameters (read from disk image file header);
 // a Block object for file handling;
 // some items for performance computation.
@@ -271,12 +334,21 @@ public:
     virtual void WriteDevReg(unsigned int regnum, Word data);
     virtual unsigned int CompleteDevOp();
     virtual const char * getDevSStr();
+    virtual void Save(SnapshotWriter* out) const;
+    virtual void Restore(SnapshotReader* in);
+    virtual void FlushExpired();
 
 private:
     const MachineConfig* const config;
 
-    // to handle it
-    FILE * diskFile;
+    // disk image file, mapped in memory as a whole
+    void* diskMap;
+    size_t diskMapSize;
+
+    // host time of the last sync of the image (see DiskSyncPolicy),
+    // and whether sectors have been written since
+    time_t lastSync;
+    bool unsynced;
 		
     // static buffer
     char statStr[DISKBUFSIZE];
@@ -296,6 +368,9 @@ private:
 
     // current cylinder
     unsigned int currCyl;
+
+    Word* sectorPtr(unsigned int head, unsigned int sect) const;
+    void syncImage(const Word* sector);
 };
 
 
@@ -310,7 +385,7 @@ private:
 // It adds to Device data structure:
 // a pointer to SetupInfo object containing tape cartridge log file name;
 // a static buffer for device operation & status description;
-// a FILE structure for log file access;
+// the cartridge file, mapped in memory;
 // a Block object for file handling.
 
 class TapeDevice : public Device {
@@ -321,12 +396,16 @@ public:
     virtual unsigned int CompleteDevOp();
     virtual const char * getDevSStr();
     virtual bool TapeLoad(const char * tFName);
+    virtual void Save(SnapshotWriter* out) const;
+    virtual void Restore(SnapshotReader* in);
 
 private:
     const MachineConfig* const config;
 
-    // to access tape image file
-    FILE * tapeFile;
+    // tape image file, mapped in memory as a whole: blocks are read
+    // sequentially, and the mapping lets the host read ahead of them
+    void* tapeMap;
+    size_t tapeMapSize;
     char * tapeFName;
 
     // to read tape blocks and know current position (starts with block 0)
@@ -338,6 +417,9 @@ private:
 
     // static buffer
     char statStr[TAPEBUFSIZE];
+
+    void unloadTape();
+    bool readBlock(unsigned int blockNo);
 };
 
 
@@ -356,6 +438,8 @@ public:
     virtual void WriteDevReg(unsigned int regnum, Word data);
     virtual unsigned int CompleteDevOp();
     virtual const char* getDevSStr();
+    virtual void Save(SnapshotWriter* out) const;
+    virtual void Restore(SnapshotReader* in);
 
 protected:
     virtual bool isBusy() const;
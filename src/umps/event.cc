@@ -31,125 +31,171 @@
 
 #include "umps/event.h"
 
-#include <stdio.h>
-#include <stdlib.h>
+#include <algorithm>
 
 #include "base/debug.h"
-#include "umps/const.h"
-#include "umps/utility.h"
-#include "umps/time_stamp.h"
 
 
-Event::Event(uint64_t ts, Word inc, Callback callback)
-    : deadline(ts + inc),
-      callback(callback),
-      next(NULL)
+// This method creates a new (empty) queue
+EventQueue::EventQueue()
+    : nextSeq(0)
 {}
 
-// This method links an Event to its successor in a structure
-void Event::AddBefore(Event * ev)
+uint64_t EventQueue::nextDeadline() const
 {
-    next = ev;
+    assert(!IsEmpty());
+    return heap[0].deadline;
 }
 
-// This method inserts an Event after another, linking the former to the 
-// successor of the latter
-void Event::InsAfter(Event * ev)
+// This method schedules callback for clock tick tod + delay, and
+// returns a handle to the new event
+Event::Handle EventQueue::InsertQ(uint64_t tod, uint64_t delay,
+                                  const Event::Callback& callback, const Event::Tag& tag)
 {
-    next = ev->next;
-    ev->next = this;
+    uint32_t slot;
+    if (freeSlots.empty()) {
+        slot = pool.size();
+        pool.push_back(Event());
+    } else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+
+    Event& ev = pool[slot];
+    ev.callback = callback;
+    ev.tag = tag;
+
+    HeapEntry entry;
+    entry.deadline = tod + delay;
+    entry.seq = nextSeq++;
+    entry.slot = slot;
+    heap.push_back(entry);
+    siftUp(heap.size() - 1, entry);
+
+    return Event::Handle(slot, ev.generation);
 }
 
-// This method returns the pointer to the successor of an Event
-Event *Event::Next()
+// This method removes the event referred to by handle from the queue;
+// it returns FALSE if there was no such event
+bool EventQueue::Cancel(Event::Handle handle)
 {
-    return (next);
+    if (handle.slot >= pool.size())
+        return false;
+
+    Event& ev = pool[handle.slot];
+    if (ev.generation != handle.generation || ev.heapPos == kNotQueued)
+        return false;
+
+    remove(ev.heapPos);
+    release(handle.slot);
+    return true;
 }
 
+// This method removes the head of a (not empty) queue and calls its
+// handler
+void EventQueue::RunHead()
+{
+    assert(!IsEmpty());
 
-// This method creates a new (empty) queue
-EventQueue::EventQueue()
+    const uint32_t slot = heap[0].slot;
+    remove(0);
+
+    // The handler is called in place; its slot cannot be reused
+    // before it returns
+    pool[slot].callback();
+    release(slot);
+}
+
+// This method lists the events in the queue, in the order they are
+// due to happen
+void EventQueue::GetEvents(std::vector<Event::Info>* events) const
 {
-    head = NULL;
-    lastIns = NULL;
+    std::vector<HeapEntry> sorted(heap);
+    std::sort(sorted.begin(), sorted.end(), before);
+
+    events->clear();
+    foreach (const HeapEntry& entry, sorted) {
+        Event::Info info;
+        info.deadline = entry.deadline;
+        info.tag = pool[entry.slot].tag;
+        events->push_back(info);
+    }
 }
 
-// This method deletes the queue and its associated structures
-EventQueue::~EventQueue()
+// This method empties the queue
+void EventQueue::Clear()
 {
-    Event *p, *q;
-
-    p = head;
-    q = NULL;
-    while (p != NULL) {
-        q = p->Next();
-        delete p;
-        p = q;
+    while (!heap.empty()) {
+        const uint32_t slot = heap.back().slot;
+        remove(heap.size() - 1);
+        release(slot);
     }
 }
 
-uint64_t EventQueue::nextDeadline() const
+// This method returns TRUE if the event in a is due before the one in b
+bool EventQueue::before(const HeapEntry& a, const HeapEntry& b)
 {
-    assert(!IsEmpty());
-    return head->getDeadline();
+    return a.deadline < b.deadline || (a.deadline == b.deadline && a.seq < b.seq);
 }
 
-Event::Callback EventQueue::nextCallback() const
+void EventQueue::place(uint32_t pos, const HeapEntry& entry)
 {
-    assert(!IsEmpty());
-    return head->getCallback();
+    heap[pos] = entry;
+    pool[entry.slot].heapPos = pos;
 }
 
-// This method creates a new Event object and inserts it in the
-// EventQueue; EventQueue is sorted on ascending time order
+// These methods move entry, which is to be stored at heap position
+// pos, up or down the heap to where it belongs
+void EventQueue::siftUp(uint32_t pos, const HeapEntry& entry)
+{
+    while (pos > 0) {
+        const uint32_t parent = (pos - 1) / 2;
+        if (!before(entry, heap[parent]))
+            break;
+        place(pos, heap[parent]);
+        pos = parent;
+    }
+    place(pos, entry);
+}
 
-uint64_t EventQueue::InsertQ(uint64_t tod, Word delay, Event::Callback callback)
+void EventQueue::siftDown(uint32_t pos, const HeapEntry& entry)
 {
-    Event *ins, *p, *q;
-
-    ins = new Event(tod, delay, callback);
-    if (IsEmpty()) {
-        head = ins;
-    } else if (ins->getDeadline() <= head->getDeadline()) {
-        // "ins" has to happen before that at the head of the queue;
-        // should be put before it
-        ins->AddBefore(head);
-        head = ins;
-    } else {
-        // should find place in queue: check lastIns to shorten search time 
-        if (lastIns != NULL && !(ins->getDeadline() <= lastIns->getDeadline()))
-            // can start from lastIns
-            p = lastIns;
-        else
-            // must start from the head
-            p = head;
-
-        q = p;
-        while (p != NULL && p->getDeadline() <= ins->getDeadline()) {
-            q = p;
-            p = p->Next();
-        }
-        // place found: insert after q and before p
-        ins->InsAfter(q);
+    const uint32_t size = heap.size();
+    for (;;) {
+        uint32_t child = 2 * pos + 1;
+        if (child >= size)
+            break;
+        if (child + 1 < size && before(heap[child + 1], heap[child]))
+            child++;
+        if (!before(heap[child], entry))
+            break;
+        place(pos, heap[child]);
+        pos = child;
     }
-    lastIns = ins;
-    return ins->getDeadline();
+    place(pos, entry);
 }
 
-// This method removes the head of a (not empty) queue and sets it to the
-// following Event
-void EventQueue::RemoveHead()
+// This method takes the entry at heap position pos out of the heap
+void EventQueue::remove(uint32_t pos)
 {
-    Event *p;
+    pool[heap[pos].slot].heapPos = kNotQueued;
 
-    if (!IsEmpty()) {
-        p = head;
-        head = head->Next();
+    const HeapEntry last = heap.back();
+    heap.pop_back();
+    if (pos == heap.size())
+        return;
 
-        if (p == lastIns)
-	    // reposition lastIns to the new head  
-	    lastIns = head;
+    if (pos > 0 && before(last, heap[(pos - 1) / 2]))
+        siftUp(pos, last);
+    else
+        siftDown(pos, last);
+}
 
-	delete p;
-    }
+// This method puts the Event in slot back in the pool
+void EventQueue::release(uint32_t slot)
+{
+    Event& ev = pool[slot];
+    ev.callback.clear();
+    ev.generation++;
+    freeSlots.push_back(slot);
 }
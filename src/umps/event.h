@@ -22,80 +22,138 @@
 #ifndef UMPS_EVENT_H
 #define UMPS_EVENT_H
 
+#include <vector>
+#include <deque>
+
 #include <boost/function.hpp>
 
+#include "base/lang.h"
 #include "umps/types.h"
 
 // Event class is used to keep track of the external events of the
 // system: device operations and interrupt generation.
-// Every object contains a device number saying what device will complete
-// its operation and generate a interrupt, a TimeStamp saying when it 
-// will happen, and a pointer to the next event in a structure, if needed
-// (set to NULL otherwise) 
+// Every object holds the handler to be called when the event happens,
+// and a Tag describing it; Event objects live in the EventQueue pool
+// and are reused.
 
 class Event {
 public:
     typedef boost::function<void ()> Callback;
 
-    Event(uint64_t ts, Word inc, Callback callback);
-
-    uint64_t getDeadline() const { return deadline; }
-    Callback getCallback() const { return callback; }
-
-    // This method links an Event to its successor in a structure
-    void AddBefore(Event* ev);
-
-    // This method inserts an Event after another, linking the former to the
-    // successor of the latter
-    void InsAfter(Event* ev);
-
-    // This method returns the pointer to the successor of an Event
-    Event *Next();
+    // What an event is about, in a form which can be saved in a
+    // machine snapshot: the kind of event and its arguments (see
+    // SystemBus::scheduleEvent())
+    struct Tag {
+        Word kind;
+        Word args[3];
+    };
+
+    // A scheduled event, as listed by EventQueue::GetEvents()
+    struct Info {
+        uint64_t deadline;
+        Tag tag;
+    };
+
+    // An Event::Handle refers to a scheduled event, so that it can be
+    // cancelled. It no longer refers to anything once the event has
+    // happened or has been cancelled
+    class Handle {
+    public:
+        Handle() : slot(0), generation(0) {}
+
+    private:
+        Handle(uint32_t slot, uint32_t generation)
+            : slot(slot), generation(generation) {}
+
+        uint32_t slot;
+        uint32_t generation;
+
+        friend class EventQueue;
+    };
 
 private:
-    // Event verification time
-    uint64_t deadline;
+    Event() : tag(), heapPos(~0U), generation(1) {}
 
     // Event handler
     Callback callback;
+    Tag tag;
+
+    // position in the EventQueue heap, or kNotQueued
+    uint32_t heapPos;
 
-    Event *next;
+    // advanced whenever the object is reused (see Handle)
+    uint32_t generation;
+
+    friend class EventQueue;
 };
 
 
-// This class implements a NULL-terminated sorted queue of Event objects,
-// used to schedule the device events in the system.
-// An object contains a pointer to the head of the queue, and a pointer to
-// the last inserted Event (to speed up insertion).
-// The queue is sorted on ascending timestamp order
+// This class implements a time-ordered queue of Event objects, used to
+// schedule the device events in the system.
+// Events are kept in a binary heap ordered on ascending deadline, and
+// on scheduling order for events due at the same time. Event objects
+// come from a pool which only grows, so that scheduling an event
+// allocates no memory in the long run.
 
 class EventQueue {
 public:
     // This method creates a new (empty) queue
     EventQueue();
 
-    ~EventQueue();
-
     // This method returns TRUE if the queue is empty, FALSE otherwise
-    bool IsEmpty() const { return head == NULL; }
+    bool IsEmpty() const { return heap.empty(); }
 
     uint64_t nextDeadline() const;
-    Event::Callback nextCallback() const;
 
-    // This method creates a new Event object and inserts it in the
-    // EventQueue; EventQueue is sorted on ascending time order
-    uint64_t InsertQ(uint64_t tod, Word delay, Event::Callback callback);
+    // This method schedules callback for clock tick tod + delay, and
+    // returns a handle to the new event
+    Event::Handle InsertQ(uint64_t tod, uint64_t delay,
+                          const Event::Callback& callback, const Event::Tag& tag);
 
-    // This method removes the head of a (not empty) queue and sets it to the
-    // following Event          
-    void RemoveHead();
+    // This method removes the event referred to by handle from the
+    // queue; it returns FALSE if there was no such event (e.g. it has
+    // already happened)
+    bool Cancel(Event::Handle handle);
+
+    // This method removes the head of a (not empty) queue and calls
+    // its handler
+    void RunHead();
+
+    // This method lists the events in the queue, in the order they
+    // are due to happen
+    void GetEvents(std::vector<Event::Info>* events) const;
+
+    // This method empties the queue
+    void Clear();
 
 private:
-    // head of the queue
-    Event* head;
+    static const uint32_t kNotQueued = ~0U;
+
+    struct HeapEntry {
+        uint64_t deadline;
+        uint64_t seq;
+        uint32_t slot;
+    };
+
+    std::vector<HeapEntry> heap;
+
+    // scheduling order of the next event
+    uint64_t nextSeq;
+
+    // Event pool: a deque never moves its elements, so handlers run
+    // in place even if they schedule more events. Free slots are
+    // listed in freeSlots
+    std::deque<Event> pool;
+    std::vector<uint32_t> freeSlots;
+
+    static bool before(const HeapEntry& a, const HeapEntry& b);
+    void place(uint32_t pos, const HeapEntry& entry);
+    void siftUp(uint32_t pos, const HeapEntry& entry);
+    void siftDown(uint32_t pos, const HeapEntry& entry);
+    void remove(uint32_t pos);
+    void release(uint32_t slot);
 
-    // last Event inserted
-    Event* lastIns;
+    DISABLE_COPY_AND_ASSIGNMENT(EventQueue);
 };
 
 #endif // UMPS_EVENT_H
@@ -22,6 +22,11 @@
 #include "umps/machine.h"
 
 #include <cstdlib>
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
 
 #include "base/lang.h"
 #include "base/debug.h"
@@ -32,17 +37,28 @@
 #include "umps/machine_config.h"
 #include "umps/stoppoint.h"
 #include "umps/systembus.h"
+#include "umps/device.h"
+#include "umps/error.h"
+#include "umps/snapshot.h"
+
+// Snapshot file magic number, which also tells apart files saved on
+// hosts of different endianness, and format version
+HIDDEN const Word kSnapshotMagic = 0x53504d55;
+HIDDEN const Word kSnapshotVersion = 2;
 
 Machine::Machine(const MachineConfig* config,
                  StoppointSet* breakpoints,
                  StoppointSet* suspects,
                  StoppointSet* tracepoints)
     : stopMask(0),
+      debugHooks(false),
       config(config),
       halted(false),
+      fastForward(false),
       breakpoints(breakpoints),
       suspects(suspects),
-      tracepoints(tracepoints)
+      tracepoints(tracepoints),
+      stopThreads(false)
 {
     assert(config->Validate(NULL));
 
@@ -56,15 +72,24 @@ Machine::Machine(const MachineConfig* config,
         cpu->StatusChanged.connect(
             sigc::bind(sigc::mem_fun(this, &Machine::onCpuStatusChanged), cpu)
         );
+        cpu->SpinDetected.connect(sigc::mem_fun(this, &Machine::onCpuSpinDetected));
         pd[i].stopCause = 0;
         cpus.push_back(cpu);
     }
 
+    updateDebugHooks();
+
     cpus[0]->Reset(MCTL_DEFAULT_BOOT_PC, MCTL_DEFAULT_BOOT_SP);
 }
 
 Machine::~Machine()
 {
+    if (cpuThreads) {
+        stopThreads = true;
+        quantumStart->wait();
+        cpuThreads->join_all();
+    }
+
     foreach (Processor* p, cpus)
         delete p;
 }
@@ -75,18 +100,148 @@ void Machine::step(unsigned int steps, unsigned int* stepped, bool* stopped)
     foreach (Processor* cpu, cpus)
         pd[cpu->Id()].stopCause = 0;
 
-    unsigned int i;
-    for (i = 0; !halted && i < steps && !stopRequested && !pauseRequested; ++i) {
-        bus->ClockTick();
-        for (CpuVector::iterator it = cpus.begin(); it != cpus.end(); ++it)
-            (*it)->Cycle();
+    // Stoppoints may have been added, removed, enabled or disabled
+    // since the last call
+    updateDebugHooks();
+
+    // Cpus only run in parallel when nothing may stop the machine in
+    // the middle of a quantum: stoppoints (see debugHooks) and
+    // exception stops keep them in lockstep
+    const bool excStops = stopMask & (SC_EXCEPTION | SC_UTLB_USER | SC_UTLB_KERNEL);
+    const unsigned int quantum = (cpus.size() > 1 && !excStops) ? config->getSMPQuantum() : 0;
+
+    unsigned int i = 0;
+    while (!halted && i < steps && !stopRequested && (fastForward || !pauseRequested)) {
+        if (fastForward) {
+            // A cpu going to sleep is no reason to return: if they
+            // all are, skip to the time something happens
+            pauseRequested = false;
+            uint32_t skipped = idleCycles();
+            if (skipped == 0 && quantum == 0 && !debugHooks)
+                skipped = spinCycles();
+            if (skipped > 0) {
+                skipped = std::min(skipped, (uint32_t) (steps - i));
+                skip(skipped);
+                i += skipped;
+                continue;
+            }
+        }
+
+        uint32_t idle = debugHooks ? 0 : bus->IdleCycles();
+        if (idle > 0 && quantum > 0) {
+            i += runParallel(std::min(std::min(idle, (uint32_t) quantum), (uint32_t) (steps - i)));
+        } else if (idle > 0) {
+            i += runIdleBus(std::min(idle, (uint32_t) (steps - i)));
+        } else {
+            bus->ClockTick();
+            for (CpuVector::iterator it = cpus.begin(); it != cpus.end(); ++it)
+                (*it)->Cycle();
+            ++i;
+        }
     }
+
+    // Devices see the host clock only when they are used, so they are
+    // given a chance to write out output held back on a time basis
+    bus->FlushExpiredDevices();
+
     if (stepped)
         *stepped = i;
     if (stopped)
         *stopped = stopRequested;
 }
 
+// This method runs the machine for up to steps cycles while nothing
+// can happen on the bus but the clock advancing, i.e. with no device
+// event due and no interval timer underflow, and with no stoppoint to
+// check. The cpus still execute in lockstep with the bus clock, as
+// they may read it. The run is cut short when a cpu schedules a
+// device event or writes the interval timer. Returns the number of
+// cycles executed
+unsigned int Machine::runIdleBus(unsigned int steps)
+{
+    bus->ClearScheduleChanged();
+
+    unsigned int i = 0;
+    if (cpus.size() == 1) {
+        Processor* cpu = cpus[0];
+        do {
+            bus->IdleTick();
+            cpu->Cycle();
+        } while (++i < steps && !halted && !stopRequested && !pauseRequested &&
+                 !bus->ScheduleChanged());
+    } else {
+        do {
+            bus->IdleTick();
+            for (CpuVector::iterator it = cpus.begin(); it != cpus.end(); ++it)
+                (*it)->Cycle();
+        } while (++i < steps && !halted && !stopRequested && !pauseRequested &&
+                 !bus->ScheduleChanged());
+    }
+
+    return i;
+}
+
+// This method runs each cpu on its own host thread for cycles cycles,
+// under the same conditions as runIdleBus(). The cpus do not run in
+// lockstep with each other: the bus clock stands still during the
+// quantum, and catches up with them at its end. Device register
+// accesses and interrupt delivery are serialized by the bus, and cpu
+// signals are delivered on this thread once the quantum is over (see
+// Processor::EndQuantum()); no stop may be requested during a
+// quantum. Returns the number of cycles executed, which is less than
+// cycles if something was scheduled to happen before the end
+unsigned int Machine::runParallel(unsigned int cycles)
+{
+    if (!cpuThreads)
+        startCpuThreads();
+
+    // A timer write or a device event scheduled by a cpu may cut the
+    // quantum short, when the other cpus may have already gone past
+    // the new limit: the others are then brought up to them, and the
+    // quantum ends late rather than unevenly
+    uint32_t minCycles = 0;
+    for (;;) {
+        bus->BeginQuantum(cpus.size(), cycles, minCycles);
+        quantumStart->wait();
+        bus->ServeQuantum();
+
+        uint64_t least = cpus[0]->QuantumTicks(), most = least;
+        foreach (Processor* cpu, cpus) {
+            least = std::min(least, cpu->QuantumTicks());
+            most = std::max(most, cpu->QuantumTicks());
+        }
+        cycles = minCycles = (uint32_t) most;
+        if (least == most)
+            break;
+    }
+
+    foreach (Processor* cpu, cpus)
+        cpu->EndQuantum();
+    bus->EndQuantum(cycles);
+
+    return cycles;
+}
+
+void Machine::startCpuThreads()
+{
+    quantumStart.reset(new boost::barrier(cpus.size() + 1));
+    cpuThreads.reset(new boost::thread_group);
+    foreach (Processor* cpu, cpus)
+        cpuThreads->create_thread(boost::bind(&Machine::cpuThread, this, cpu));
+}
+
+// This method is the body of the host thread running cpu
+void Machine::cpuThread(Processor* cpu)
+{
+    for (;;) {
+        quantumStart->wait();
+        if (stopThreads)
+            break;
+        cpu->RunQuantum();
+        bus->QuantumDone();
+    }
+}
+
 void Machine::step(bool* stopped)
 {
     step(1, NULL, stopped);
@@ -108,6 +263,28 @@ uint32_t Machine::idleCycles() const
     return c;
 }
 
+uint32_t Machine::spinCycles() const
+{
+    uint32_t c;
+
+    if ((c = bus->IdleCycles()) == 0)
+        return 0;
+
+    // Nothing must have changed what the spinning cpus read since
+    // they last went round their loops
+    uint64_t lastChange = bus->LastEventTick();
+    foreach (Processor* cpu, cpus)
+        lastChange = std::max(lastChange, cpu->LastStoreTick());
+
+    foreach (Processor* cpu, cpus) {
+        c = std::min(c, cpu->isRunning() ? cpu->SpinCycles(lastChange) : cpu->IdleCycles());
+        if (c == 0)
+            return 0;
+    }
+
+    return c;
+}
+
 void Machine::skip(uint32_t cycles)
 {
     bus->Skip(cycles);
@@ -120,6 +297,104 @@ void Machine::skip(uint32_t cycles)
 void Machine::Halt()
 {
     halted = true;
+    bus->FlushDevices();
+}
+
+void Machine::SaveSnapshot(const std::string& fileName) const
+{
+    SnapshotWriter out(fileName);
+    saveState(&out, true);
+    out.Close();
+}
+
+void Machine::LoadSnapshot(const std::string& fileName)
+{
+    SnapshotReader in(fileName);
+    if (!loadState(&in, true))
+        throw InvalidFileFormatError(fileName, "Snapshot taken on a machine of different configuration");
+}
+
+Machine* Machine::Clone(const MachineConfig* config,
+                        StoppointSet* breakpoints,
+                        StoppointSet* suspects,
+                        StoppointSet* tracepoints)
+{
+    SnapshotBuffer state;
+    SnapshotWriter out(&state);
+    saveState(&out, false);
+
+    std::auto_ptr<Machine> clone(new Machine(config, breakpoints, suspects, tracepoints));
+    SnapshotReader in(&state);
+    if (!clone->loadState(&in, false))
+        throw Error("Clone configuration does not match the machine's");
+
+    clone->bus->ShareRam(bus.get());
+    foreach (Processor* cpu, cpus)
+        cpu->HostMappingChanged();
+    foreach (Processor* cpu, clone->cpus)
+        cpu->HostMappingChanged();
+
+    return clone.release();
+}
+
+// This method writes the machine state, and RAM contents if withRam
+// is TRUE, in snapshot format
+void Machine::saveState(SnapshotWriter* out, bool withRam) const
+{
+    out->PutWord(kSnapshotMagic);
+    out->PutWord(kSnapshotVersion);
+
+    // Configuration the snapshot is bound to
+    out->PutWord(cpus.size());
+    out->PutWord(config->getRamSize());
+    out->PutWord(config->getTLBSize());
+    for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+        for (unsigned int devNo = 0; devNo < DEVPERINT; devNo++)
+            out->PutWord(bus->getDev(intl, devNo)->Type());
+
+    out->PutBool(halted);
+    if (withRam)
+        bus->SaveRam(out);
+    bus->Save(out);
+    foreach (const Processor* cpu, cpus)
+        cpu->Save(out);
+
+    out->PutWord(kSnapshotMagic);
+}
+
+// This method reads back the state written by saveState(). It returns
+// FALSE, without changing anything, if the state belongs to a machine
+// of different configuration
+bool Machine::loadState(SnapshotReader* in, bool withRam)
+{
+    Word magic = in->GetWord();
+    in->Expect(magic == kSnapshotMagic && in->GetWord() == kSnapshotVersion);
+
+    Word nCpus = in->GetWord();
+    Word ramSize = in->GetWord();
+    Word tlbSize = in->GetWord();
+    bool sameConfig = (nCpus == cpus.size() &&
+                       ramSize == config->getRamSize() &&
+                       tlbSize == config->getTLBSize());
+    for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+        for (unsigned int devNo = 0; devNo < DEVPERINT; devNo++)
+            if (in->GetWord() != bus->getDev(intl, devNo)->Type())
+                sameConfig = false;
+    if (!sameConfig)
+        return false;
+
+    halted = in->GetBool();
+    if (withRam)
+        bus->RestoreRam(in);
+    bus->Restore(in);
+    foreach (Processor* cpu, cpus) {
+        cpu->Restore(in);
+        pd[cpu->Id()].stopCause = 0;
+    }
+
+    in->Expect(in->GetWord() == kSnapshotMagic);
+    in->ExpectEnd();
+    return true;
 }
 
 void Machine::onCpuException(unsigned int excCode, Processor* cpu)
@@ -143,7 +418,32 @@ void Machine::onCpuStatusChanged(const Processor* cpu)
         pauseRequested = true;
 }
 
-void Machine::HandleBusAccess(Word pAddr, Word access, Processor* cpu)
+void Machine::onCpuSpinDetected()
+{
+    // A busy-waiting cpu may let the machine fast-forward too
+    if (fastForward)
+        pauseRequested = true;
+}
+
+HIDDEN bool hasEnabledStoppoints(const StoppointSet* set)
+{
+    foreach (const Stoppoint::Ptr& p, *set)
+        if (p->IsEnabled())
+            return true;
+    return false;
+}
+
+// This method decides whether memory accesses have to be checked
+// against stoppoints at all: the tracepoints are always probed, while
+// breakpoints and suspects only matter if the stop mask includes them
+void Machine::updateDebugHooks()
+{
+    debugHooks = (hasEnabledStoppoints(tracepoints) ||
+                  ((stopMask & SC_BREAKPOINT) && hasEnabledStoppoints(breakpoints)) ||
+                  ((stopMask & SC_SUSPECT) && hasEnabledStoppoints(suspects)));
+}
+
+void Machine::checkBusAccess(Word pAddr, Word access, Processor* cpu)
 {
     // Check for breakpoints and suspects
     switch (access) {
@@ -183,7 +483,17 @@ void Machine::HandleBusAccess(Word pAddr, Word access, Processor* cpu)
     }
 }
 
-void Machine::HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu)
+void Machine::checkDMAAccess(Word start, Word end, Word access)
+{
+    // Suspects stop the processor making the access, and DMA is not
+    // made by any; only traced ranges are of interest
+    if (access == WRITE) {
+        Stoppoint* tracepoint = tracepoints->ProbeRange(MAXASID, start, end, AM_WRITE, NULL);
+        (void) tracepoint;
+    }
+}
+
+void Machine::checkVMAccess(Word asid, Word vaddr, Word access, Processor* cpu)
 {
     switch (access) {
     case READ:
@@ -234,6 +544,7 @@ SystemBus* Machine::getBus()
 void Machine::setStopMask(unsigned int mask)
 {
     stopMask = mask;
+    updateDebugHooks();
 }
 
 unsigned int Machine::getStopMask() const
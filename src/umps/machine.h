@@ -22,6 +22,7 @@
 #ifndef UMPS_MACHINE_H
 #define UMPS_MACHINE_H
 
+#include <string>
 #include <vector>
 
 #include "base/lang.h"
@@ -36,10 +37,17 @@ enum StopCause {
     SC_UTLB_USER    = 1 << 5
 };
 
+namespace boost {
+class barrier;
+class thread_group;
+}
+
 class Processor;
 class SystemBus;
 class Device;
 class StoppointSet;
+class SnapshotWriter;
+class SnapshotReader;
 
 class Machine {
 public:
@@ -55,9 +63,49 @@ public:
     uint32_t idleCycles() const;
     void skip(uint32_t cycles);
 
+    // This method returns the number of cycles the machine may be
+    // fast-forwarded by with skip() while each cpu is either idle or
+    // stuck in a busy-wait loop (see Processor::SpinCycles())
+    uint32_t spinCycles() const;
+
+    // In fast-forward mode, step() skips over idle periods by itself:
+    // whenever all cpus are idle, halted or busy-waiting, the machine
+    // jumps straight to the next device event or timer deadline, and
+    // such cycles are counted as stepped
+    void setFastForward(bool setting) { fastForward = setting; }
+    bool isFastForward() const { return fastForward; }
+
     void Halt();
     bool IsHalted() const { return halted; }
 
+    // These methods save the whole machine state to a snapshot file,
+    // and restore it from one, so that a run can later be resumed
+    // exactly where it was left. Snapshots hold RAM, processors, bus,
+    // controllers and device registers, including device operations
+    // and other events in progress; the contents of disk images and
+    // tape cartridges are left out, as are the peers of network
+    // devices. A snapshot can only be restored on a machine with the
+    // same configuration of processors, memory and devices.
+    // Both throw FileError on I/O failures; LoadSnapshot() throws
+    // InvalidFileFormatError for a corrupted or mismatching file, in
+    // which case the machine may be left in an inconsistent state
+    void SaveSnapshot(const std::string& fileName) const;
+    void LoadSnapshot(const std::string& fileName);
+
+    // This method creates a copy of the machine in its current state,
+    // which then runs independently of it, and may do so on another
+    // host thread. RAM is shared copy-on-write by the two machines, so
+    // that a clone costs little more than the memory frames either of
+    // them writes afterwards. The clone is built from config, which
+    // must describe the same processors, memory and devices (Error is
+    // thrown otherwise) but may differ in anything else, e.g. device
+    // files; disk images and network peers are not copied, like in
+    // snapshots. Stoppoint sets are as in the constructor
+    Machine* Clone(const MachineConfig* config,
+                   StoppointSet* breakpoints,
+                   StoppointSet* suspects,
+                   StoppointSet* tracepoints);
+
     Processor* getProcessor(unsigned int cpuId);
     Device* getDevice(unsigned int line, unsigned int devNo);
     SystemBus* getBus();
@@ -72,8 +120,31 @@ public:
     bool ReadMemory(Word physAddr, Word* data);
     bool WriteMemory(Word paddr, Word data);
 
-    void HandleBusAccess(Word pAddr, Word access, Processor* cpu);
-    void HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu);
+    // These methods notify the machine of memory accesses, so that
+    // stoppoints can be checked. They do nothing unless some
+    // stoppoint could actually be hit (see updateDebugHooks())
+    void HandleBusAccess(Word pAddr, Word access, Processor* cpu)
+    {
+        if (debugHooks)
+            checkBusAccess(pAddr, access, cpu);
+    }
+
+    void HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu)
+    {
+        if (debugHooks)
+            checkVMAccess(asid, vaddr, access, cpu);
+    }
+
+    // This method notifies the machine of a DMA transfer over the
+    // physical range [start, end], as a whole
+    void HandleDMAAccess(Word start, Word end, Word access)
+    {
+        if (debugHooks)
+            checkDMAAccess(start, end, access);
+    }
+
+    // This method returns TRUE if memory accesses have to be notified
+    bool DebugHooksEnabled() const { return debugHooks; }
 
 private:
     struct ProcessorData {
@@ -83,10 +154,26 @@ private:
     };
 
     void onCpuStatusChanged(const Processor* cpu);
+    void onCpuSpinDetected();
     void onCpuException(unsigned int, Processor* cpu);
 
+    void checkBusAccess(Word pAddr, Word access, Processor* cpu);
+    void checkVMAccess(Word asid, Word vaddr, Word access, Processor* cpu);
+    void checkDMAAccess(Word start, Word end, Word access);
+    void updateDebugHooks();
+    void saveState(SnapshotWriter* out, bool withRam) const;
+    bool loadState(SnapshotReader* in, bool withRam);
+    unsigned int runIdleBus(unsigned int steps);
+    unsigned int runParallel(unsigned int cycles);
+    void startCpuThreads();
+    void cpuThread(Processor* cpu);
+
     unsigned int stopMask;
 
+    // TRUE if enabled stoppoints are of interest under the current
+    // stop mask
+    bool debugHooks;
+
     const MachineConfig* const config;
 
     scoped_ptr<SystemBus> bus;
@@ -99,10 +186,17 @@ private:
     bool halted;
     bool stopRequested;
     bool pauseRequested;
+    bool fastForward;
 
     StoppointSet* breakpoints;
     StoppointSet* suspects;
     StoppointSet* tracepoints;
+
+    // parallel execution state (see runParallel()); threads are
+    // started on first use
+    scoped_ptr<boost::thread_group> cpuThreads;
+    scoped_ptr<boost::barrier> quantumStart;
+    bool stopThreads;
 };
 
 #endif // UMPS_MACHINE_H
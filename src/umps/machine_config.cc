@@ -55,6 +55,19 @@ const char* const MachineConfig::deviceKeyPrefix[N_EXT_IL] = {
     "terminal"
 };
 
+const char* const MachineConfig::diskSyncNames[N_DISK_SYNC_POLICIES] = {
+    "write",
+    "periodic",
+    "shutdown"
+};
+
+const char* const MachineConfig::flushPolicyNames[N_FLUSH_POLICIES] = {
+    "char",
+    "line",
+    "interval",
+    "halt"
+};
+
 MachineConfig* MachineConfig::LoadFromFile(const std::string& fileName, std::string& error)
 {
     std::ifstream inputStream(fileName.c_str());
@@ -87,8 +100,23 @@ MachineConfig* MachineConfig::LoadFromFile(const std::string& fileName, std::str
             config->setClockRate(root->Get("clock-rate")->AsNumber());
         if (root->HasMember("tlb-size"))
             config->setTLBSize(root->Get("tlb-size")->AsNumber());
+        if (root->HasMember("smp-quantum"))
+            config->setSMPQuantum(root->Get("smp-quantum")->AsNumber());
         if (root->HasMember("num-ram-frames"))
             config->setRamSize(root->Get("num-ram-frames")->AsNumber());
+        if (root->HasMember("disk-sync")) {
+            std::string name = root->Get("disk-sync")->AsString();
+            unsigned int i = 0;
+            while (i < N_DISK_SYNC_POLICIES && name != diskSyncNames[i])
+                i++;
+            if (i == N_DISK_SYNC_POLICIES) {
+                error = boost::str(boost::format("Invalid machine configuration file (unknown disk sync policy `%s')") %name);
+                return NULL;
+            }
+            config->setDiskSyncPolicy((DiskSyncPolicy) i);
+        }
+        if (root->HasMember("fast-io"))
+            config->setFastIOEnabled(root->Get("fast-io")->AsBool());
 
         if (root->HasMember("boot")) {
             JsonObject* bootOpt = root->Get("boot")->AsObject();
@@ -121,6 +149,20 @@ MachineConfig* MachineConfig::LoadFromFile(const std::string& fileName, std::str
                             if (ParseMACId(devObj->Get("address")->AsString(), macId))
                                 config->setMACId(devNo, macId);
                         }
+                        if (il == EXT_IL_INDEX(IL_TERMINAL) && devObj->HasMember("input"))
+                            config->setTerminalInput(devNo, devObj->Get("input")->AsString());
+                        if (devObj->HasMember("flush")) {
+                            std::string name = devObj->Get("flush")->AsString();
+                            unsigned int i = 0;
+                            while (i < N_FLUSH_POLICIES && name != flushPolicyNames[i])
+                                i++;
+                            if (i == N_FLUSH_POLICIES) {
+                                error = boost::str(boost::format("Invalid machine configuration file (unknown flush policy `%s' for %s)")
+                                                   %name %key);
+                                return NULL;
+                            }
+                            config->setDeviceFlushPolicy(il, devNo, (OutputFlushPolicy) i);
+                        }
                     }
                 }
             }
@@ -155,7 +197,10 @@ void MachineConfig::Save()
     root->Set("num-processors", (int) getNumProcessors());
     root->Set("clock-rate", (int) getClockRate());
     root->Set("tlb-size", (int) getTLBSize());
+    root->Set("smp-quantum", (int) getSMPQuantum());
     root->Set("num-ram-frames", (int) getRamSize());
+    root->Set("disk-sync", diskSyncNames[getDiskSyncPolicy()]);
+    root->Set("fast-io", isFastIOEnabled());
 
     JsonObject* bootOpt = new JsonObject;
     bootOpt->Set("load-core-file", isLoadCoreEnabled());
@@ -179,6 +224,10 @@ void MachineConfig::Save()
                 object->Set("file", devFiles[il][devNo]);
                 if (il == EXT_IL_INDEX(IL_ETHERNET) && getMACId(devNo))
                     object->Set("address", MACIdToString(getMACId(devNo)));
+                if (il == EXT_IL_INDEX(IL_PRINTER) || il == EXT_IL_INDEX(IL_TERMINAL))
+                    object->Set("flush", flushPolicyNames[devFlush[il][devNo]]);
+                if (il == EXT_IL_INDEX(IL_TERMINAL) && !termInput[devNo].empty())
+                    object->Set("input", termInput[devNo]);
                 std::string key = boost::str(boost::format("%s%u") %deviceKeyPrefix[il] %devNo);
                 devicesObject->Set(key, object);
             }
@@ -242,6 +291,11 @@ void MachineConfig::setTLBSize(Word size)
     tlbSize = bumpProperty(MIN_TLB, size, MAX_TLB);
 }
 
+void MachineConfig::setSMPQuantum(unsigned int value)
+{
+    smpQuantum = bumpProperty(MIN_SMP_QUANTUM, value, MAX_SMP_QUANTUM);
+}
+
 void MachineConfig::setROM(ROMType type, const std::string& fileName)
 {
     romFiles[type] = fileName;
@@ -295,6 +349,31 @@ const std::string& MachineConfig::getDeviceFile(unsigned int il, unsigned int de
     return devFiles[il][devNo];
 }
 
+void MachineConfig::setDeviceFlushPolicy(unsigned int il, unsigned int devNo,
+                                         OutputFlushPolicy policy)
+{
+    assert(il < N_EXT_IL && devNo < N_DEV_PER_IL);
+    devFlush[il][devNo] = policy;
+}
+
+OutputFlushPolicy MachineConfig::getDeviceFlushPolicy(unsigned int il, unsigned int devNo) const
+{
+    assert(il < N_EXT_IL && devNo < N_DEV_PER_IL);
+    return devFlush[il][devNo];
+}
+
+void MachineConfig::setTerminalInput(unsigned int devNo, const std::string& name)
+{
+    assert(devNo < N_DEV_PER_IL);
+    termInput[devNo] = name;
+}
+
+const std::string& MachineConfig::getTerminalInput(unsigned int devNo) const
+{
+    assert(devNo < N_DEV_PER_IL);
+    return termInput[devNo];
+}
+
 const uint8_t* MachineConfig::getMACId(unsigned int devNo) const
 {
     assert(devNo < N_DEV_PER_IL);
@@ -318,7 +397,10 @@ void MachineConfig::resetToFactorySettings()
     setNumProcessors(DEFAULT_NUM_CPUS);
     setClockRate(DEFAULT_CLOCK_RATE);
     setTLBSize(DEFAULT_TLB_SIZE);
+    setSMPQuantum(DEFAULT_SMP_QUANTUM);
     setRamSize(DEFAUlT_RAM_SIZE);
+    setDiskSyncPolicy(DISK_SYNC_SHUTDOWN);
+    setFastIOEnabled(false);
 
     std::string dataDir = PACKAGE_DATA_DIR;
 
@@ -330,9 +412,12 @@ void MachineConfig::resetToFactorySettings()
     setROM(ROM_TYPE_STAB, "kernel.stab.umps");
     setSymbolTableASID(MAX_ASID);
 
-    for (unsigned int i = 0; i < N_EXT_IL; ++i)
-        for (unsigned int j = 0; j < N_DEV_PER_IL; ++j)
+    for (unsigned int i = 0; i < N_EXT_IL; ++i) {
+        for (unsigned int j = 0; j < N_DEV_PER_IL; ++j) {
             devEnabled[i][j] = false;
+            devFlush[i][j] = FLUSH_CHAR;
+        }
+    }
 }
 
 bool MachineConfig::validFileMagic(Word tag, const char* fName)
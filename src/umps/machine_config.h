@@ -38,10 +38,33 @@ enum ROMType {
     N_ROM_TYPES
 };
 
+// When disk image changes are synced to permanent storage: when each
+// write completes, every so often, or only when the machine is shut
+// down. Disk images are mapped in memory, so writes are visible to
+// other host processes in any case
+enum DiskSyncPolicy {
+    DISK_SYNC_WRITE,
+    DISK_SYNC_PERIODIC,
+    DISK_SYNC_SHUTDOWN,
+    N_DISK_SYNC_POLICIES
+};
+
+// When the output of a printer or terminal is written to its file:
+// right away for each character, at each newline, every so often, or
+// only when the machine halts. Output is written anyway whenever the
+// device buffer fills up
+enum OutputFlushPolicy {
+    FLUSH_CHAR,
+    FLUSH_LINE,
+    FLUSH_INTERVAL,
+    FLUSH_HALT,
+    N_FLUSH_POLICIES
+};
+
 class MachineConfig {
 public:
     static const Word MIN_RAM = 8;
-    static const Word MAX_RAM = 512;
+    static const Word MAX_RAM = 262144;
     static const Word DEFAUlT_RAM_SIZE = 64;
 
     static const unsigned int MIN_CPUS = 1;
@@ -53,9 +76,16 @@ public:
     static const unsigned int DEFAULT_CLOCK_RATE = 1;
 
     static const Word MIN_TLB = 4;
-    static const Word MAX_TLB = 64;
+    static const Word MAX_TLB = 4096;
     static const Word DEFAULT_TLB_SIZE = 16;
 
+    // Number of cycles the processors run for on their own host
+    // threads between synchronizations; zero disables parallel
+    // execution
+    static const unsigned int MIN_SMP_QUANTUM = 0;
+    static const unsigned int MAX_SMP_QUANTUM = 1000000;
+    static const unsigned int DEFAULT_SMP_QUANTUM = 0;
+
     static const Word MIN_ASID = 0;
     static const Word MAX_ASID = 64;
 
@@ -83,6 +113,21 @@ public:
     void setTLBSize(Word size);
     Word getTLBSize() const { return tlbSize; }
 
+    void setSMPQuantum(unsigned int value);
+    unsigned int getSMPQuantum() const { return smpQuantum; }
+
+    void setDiskSyncPolicy(DiskSyncPolicy policy) { diskSync = policy; }
+    DiskSyncPolicy getDiskSyncPolicy() const { return diskSync; }
+
+    // In fast I/O mode, device operations complete after a short fixed
+    // delay instead of their nominal seek, rotation and transfer
+    // times. Operations longer than that delay complete in the order
+    // they were started, which may differ from the order their nominal
+    // timings would give; they interrupt the same way, but the machine
+    // spends far fewer cycles waiting on them
+    void setFastIOEnabled(bool setting) { fastIO = setting; }
+    bool isFastIOEnabled() const { return fastIO; }
+
     void setROM(ROMType type, const std::string& fileName);
     const std::string& getROM(ROMType type) const;
 
@@ -94,6 +139,14 @@ public:
     void setDeviceEnabled(unsigned int il, unsigned int devNo, bool setting);
     void setDeviceFile(unsigned int il, unsigned int devNo, const std::string& fileName);
     const std::string& getDeviceFile(unsigned int il, unsigned int devNo) const;
+    void setDeviceFlushPolicy(unsigned int il, unsigned int devNo, OutputFlushPolicy policy);
+    OutputFlushPolicy getDeviceFlushPolicy(unsigned int il, unsigned int devNo) const;
+    // Terminal input may come from a host file or FIFO, or from a
+    // pseudo-terminal created for the purpose (given as "pty"), in
+    // addition to the user interface; an empty name means none
+    void setTerminalInput(unsigned int devNo, const std::string& name);
+    const std::string& getTerminalInput(unsigned int devNo) const;
+
     const uint8_t* getMACId(unsigned int devNo) const;
     void setMACId(unsigned int devNo, const uint8_t* value);
 
@@ -111,15 +164,22 @@ private:
     unsigned int cpus;
     unsigned int clockRate;
     Word tlbSize;
+    unsigned int smpQuantum;
+    DiskSyncPolicy diskSync;
+    bool fastIO;
 
     std::string romFiles[N_ROM_TYPES];
     Word symbolTableASID;
 
     std::string devFiles[N_EXT_IL][N_DEV_PER_IL];
     bool devEnabled[N_EXT_IL][N_DEV_PER_IL];
+    OutputFlushPolicy devFlush[N_EXT_IL][N_DEV_PER_IL];
     scoped_array<uint8_t> macId[N_DEV_PER_IL];
+    std::string termInput[N_DEV_PER_IL];
 
     static const char* const deviceKeyPrefix[N_EXT_IL];
+    static const char* const diskSyncNames[N_DISK_SYNC_POLICIES];
+    static const char* const flushPolicyNames[N_FLUSH_POLICIES];
 };
 
 #endif // UMPS_MACHINE_CONFIG_H
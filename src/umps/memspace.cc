@@ -31,6 +31,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include <algorithm>
 
 #include <boost/format.hpp>
 
@@ -39,44 +44,129 @@
 #include "umps/blockdev_params.h"
 #include "umps/error.h"
 
+Word RamSpace::zeroFrame[FRAMESIZE];
+
 // This method creates a RamSpace object of a given size (in words) and
 // fills it with core file contents if needed
 RamSpace::RamSpace(Word size_, const char* fName)
-    : ram(new Word[size_]),
+    : hosts(size_ / FRAMESIZE, zeroFrame),
+      frames(size_ / FRAMESIZE, (Frame*) NULL),
       size(size_)
 {
-    if (fName != NULL && *fName) {
-        FILE* cFile;
-        if ((cFile = fopen(fName, "r")) == NULL)
-            throw FileError(fName);
-
-        // Check validity
-        Word tag;
-        if (fread((void *) &tag, WORDLEN, 1, cFile) != 1 ||
-            tag != COREFILEID)
-        {
-            fclose(cFile);
-            throw InvalidCoreFileError(fName, "Invalid core file");
-        }
+    assert(size % FRAMESIZE == 0);
 
-        fread((void *) ram.get(), WORDLEN, size, cFile);
-        if (!feof(cFile)) {
-            fclose(cFile);
-            throw CoreFileOverflow();
-        }
+    if (fName != NULL && *fName)
+        loadCore(fName);
+}
 
-        fclose(cFile);
+RamSpace::RamSpace(const RamSpace& source)
+    : hosts(source.hosts),
+      frames(source.frames),
+      size(source.size)
+{
+    foreach (Frame* frame, frames) {
+        if (frame != NULL)
+            __sync_fetch_and_add(&frame->refs, 1);
+    }
+}
+
+RamSpace::~RamSpace()
+{
+    ReleaseUnshared();
+    foreach (Frame* frame, frames) {
+        if (frame != NULL)
+            release(frame);
     }
 }
 
+// This method returns TRUE if frame frameNo is used by other RamSpace
+// objects too, or is not held by a frame of its own. A frame which is
+// not shared cannot become so behind this object's back, as it would
+// have to be copied from it; a shared one may stop being so at any
+// time, as the other objects may be used from other threads
+bool RamSpace::IsShared(Word frameNo) const
+{
+    const Frame* frame = frames[frameNo];
+    return frame == NULL || __atomic_load_n(&frame->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+Word* RamSpace::Unshare(Word frameNo)
+{
+    if (IsShared(frameNo)) {
+        Frame* frame = new Frame;
+        frame->refs = 1;
+        memcpy(frame->words, hosts[frameNo], sizeof(frame->words));
+        if (frames[frameNo] != NULL)
+            unshared.push_back(frames[frameNo]);
+        frames[frameNo] = frame;
+        hosts[frameNo] = frame->words;
+    }
+    return hosts[frameNo];
+}
+
+void RamSpace::ReleaseUnshared()
+{
+    foreach (Frame* frame, unshared)
+        release(frame);
+    unshared.clear();
+}
+
+// This method atomically replaces the word at index with newval if
+// it holds oldval, as processors may run on different host threads
 bool RamSpace::CompareAndSet(Word index, Word oldval, Word newval)
 {
-    if (ram[index] == oldval) {
-        ram[index] = newval;
-        return true;
-    } else {
-        return false;
+    assert(!IsShared(index / FRAMESIZE));
+    Word* word = &hosts[index / FRAMESIZE][index % FRAMESIZE];
+    return __sync_bool_compare_and_swap(word, oldval, newval);
+}
+
+// This method reads core file fName, whose frames follow the file tag,
+// as the initial RAM contents; frames holding zeros only are left
+// shared
+void RamSpace::loadCore(const char* fName)
+{
+    FILE* cFile;
+    if ((cFile = fopen(fName, "r")) == NULL)
+        throw FileError(fName);
+
+    // Check validity
+    struct stat st;
+    Word tag;
+    if (fstat(fileno(cFile), &st) < 0 ||
+        fread((void *) &tag, WORDLEN, 1, cFile) != 1 ||
+        tag != COREFILEID)
+    {
+        fclose(cFile);
+        throw InvalidCoreFileError(fName, "Invalid core file");
     }
+
+    Word dataWords = st.st_size / WORDLEN - 1;
+    if (dataWords >= size) {
+        fclose(cFile);
+        throw CoreFileOverflow();
+    }
+
+    Word frame[FRAMESIZE];
+    for (Word i = 0; i * FRAMESIZE < dataWords; i++) {
+        Word n = std::min(dataWords - i * FRAMESIZE, (Word) FRAMESIZE);
+        if (fread((void *) frame, WORDLEN, n, cFile) != n) {
+            fclose(cFile);
+            throw InvalidCoreFileError(fName, "Invalid core file");
+        }
+        std::fill(frame + n, frame + FRAMESIZE, 0);
+        if (memcmp(frame, zeroFrame, sizeof(frame)) != 0)
+            memcpy(Unshare(i), frame, sizeof(frame));
+    }
+
+    fclose(cFile);
+}
+
+// This method drops a reference to frame, which is freed when it is
+// not used anymore
+void RamSpace::release(Frame* frame)
+{
+    if (__sync_sub_and_fetch(&frame->refs, 1) == 0)
+        delete frame;
 }
 
 
@@ -22,13 +22,29 @@
 #ifndef UMPS_MEMSPACE_H
 #define UMPS_MEMSPACE_H
 
+#include <vector>
+
 #include "base/lang.h"
 #include "umps/types.h"
+#include "umps/const.h"
 
 // This class implements the RAM device. Any object allows reads and
 // writes with random access to word-sized items using appropriate
 // methods. Contents may be loaded from file at creation. SystemBus
-// must do all bounds checking and address conversion for access
+// must do all bounds checking and address conversion for access.
+//
+// Memory is made of frames of FRAMESIZE words, which are shared
+// copy-on-write among RamSpace objects copied from one another, even
+// if used by different host threads; frames never written to all
+// share a single zero-filled frame, and so do the frames of the core
+// file which hold zeros only. Memory is thus allocated only for the
+// frames actually written or loaded, and creating even a large
+// RamSpace costs little. A frame must be made private with Unshare()
+// before it is written to.
+//
+// The core file is read in full at creation rather than mapped: it may
+// be rewritten at any time (e.g. by a kernel rebuild) while a machine
+// or its clones still use its contents
 
 class RamSpace {
 public:
@@ -36,24 +52,72 @@ public:
     // and fills it with file contents if needed
     RamSpace(Word size_, const char* fName);
 
+    // This method creates a RamSpace object with the same contents as
+    // source, sharing all of its frames
+    RamSpace(const RamSpace& source);
+
+    ~RamSpace();
+
     // This method returns the value of Word at index
-    Word MemRead(Word index) const { return ram[index]; }
+    Word MemRead(Word index) const
+    {
+        return hosts[index / FRAMESIZE][index % FRAMESIZE];
+    }
+
+    // This method returns the number of frames
+    Word NumFrames() const { return hosts.size(); }
 
-    // This method allows to write data to a specified address (as word
-    // offset). SystemBus must check address validity and make
-    // byte-to-word address conversion)
-    void MemWrite(Word index, Word data) { ram[index] = data; }
+    // This method returns the host location of the first word of frame
+    // frameNo; it must not be written through if the frame is shared
+    Word* FramePtr(Word frameNo) const { return hosts[frameNo]; }
 
+    bool IsShared(Word frameNo) const;
+
+    // This method returns TRUE if frame frameNo has never been written
+    // to nor loaded with nonzero core file contents, i.e. if it reads
+    // as zero without being held anywhere
+    bool IsBlank(Word frameNo) const { return hosts[frameNo] == zeroFrame; }
+
+    // This method makes frame frameNo private, copying it if it is
+    // shared, and returns its new host location. Other threads using
+    // this object may still be reading the old frame, so it is only
+    // let go of by ReleaseUnshared()
+    Word* Unshare(Word frameNo);
+    void ReleaseUnshared();
+
+    // This method requires the frame holding index to be private
     bool CompareAndSet(Word index, Word oldval, Word newval);
 
     // This method returns RamSpace size in bytes
     Word Size() const { return size << 2; }
 
 private:
-    scoped_array<Word> ram;
+    struct Frame {
+        // number of RamSpace objects using the frame
+        Word refs;
+        Word words[FRAMESIZE];
+    };
+
+    static Word zeroFrame[FRAMESIZE];
+
+    // host location of each frame
+    std::vector<Word*> hosts;
+
+    // the frame holding the contents of each location in hosts, NULL
+    // where the latter is the zero frame, which is never written to
+    std::vector<Frame*> frames;
+
+    // shared frames replaced by Unshare() and not yet let go of
+    std::vector<Frame*> unshared;
 
     // size of structure in words (C style addressing: [0..size - 1])
     Word size;
+
+    void loadCore(const char* fName);
+
+    static void release(Frame* frame);
+
+    RamSpace& operator=(const RamSpace&);
 };
 
 
@@ -72,6 +136,10 @@ public:
     // (SystemBus must assure that ofs is in range)
     Word MemRead(Word ofs);
 
+    // This method returns the host location of Word at ofs; it must
+    // not be written through
+    Word* MemPtr(Word ofs) { return memPtr.get() + ofs; }
+
     // This method returns BiosSpace size in bytes
     Word Size();
 
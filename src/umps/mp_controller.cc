@@ -21,13 +21,12 @@
 
 #include "umps/mp_controller.h"
 
-#include <boost/bind.hpp>
-
 #include "base/lang.h"
 #include "umps/machine_config.h"
 #include "umps/machine.h"
 #include "umps/processor.h"
 #include "umps/systembus.h"
+#include "umps/snapshot.h"
 #include "umps/arch.h"
 
 MPController::MPController(const MachineConfig* config, Machine* machine)
@@ -67,8 +66,7 @@ void MPController::Write(Word addr, Word data, const Processor* cpu)
         cpuId = data & MCTL_RESET_CPU_CPUID_MASK;
         if (cpuId < config->getNumProcessors())
             machine->getBus()->scheduleEvent(kCpuResetDelay * config->getClockRate(),
-                                             boost::bind(&Processor::Reset, machine->getProcessor(cpuId),
-                                                         bootPC, bootSP));
+                                             SystemBus::EVENT_CPU_RESET, cpuId, bootPC, bootSP);
         break;
 
     case MCTL_BOOT_PC:
@@ -83,16 +81,28 @@ void MPController::Write(Word addr, Word data, const Processor* cpu)
         cpuId = data & MCTL_RESET_CPU_CPUID_MASK;
         if (cpuId < config->getNumProcessors())
             machine->getBus()->scheduleEvent(kCpuHaltDelay * config->getClockRate(),
-                                             boost::bind(&Processor::Halt, machine->getProcessor(cpuId)));
+                                             SystemBus::EVENT_CPU_HALT, cpuId);
         break;
 
     case MCTL_POWER:
         if (data == 0x0FF)
             machine->getBus()->scheduleEvent(kPoweroffDelay * config->getClockRate(),
-                                             boost::bind(&Machine::Halt, machine));
+                                             SystemBus::EVENT_POWER_OFF);
         break;
 
     default:
         break;
     }
 }
+
+void MPController::Save(SnapshotWriter* out) const
+{
+    out->PutWord(bootPC);
+    out->PutWord(bootSP);
+}
+
+void MPController::Restore(SnapshotReader* in)
+{
+    bootPC = in->GetWord();
+    bootSP = in->GetWord();
+}
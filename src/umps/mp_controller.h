@@ -9,6 +9,8 @@ class MachineConfig;
 class Machine;
 class SystemBus;
 class Processor;
+class SnapshotWriter;
+class SnapshotReader;
 
 class MPController {
 public:
@@ -17,6 +19,9 @@ public:
     Word Read(Word addr, const Processor* cpu) const;
     void Write(Word addr, Word data, const Processor* cpu);
 
+    void Save(SnapshotWriter* out) const;
+    void Restore(SnapshotReader* in);
+
 private:
     static const unsigned int kCpuResetDelay = 50;
     static const unsigned int kCpuHaltDelay = 50;
@@ -21,12 +21,11 @@
 
 #include "umps/mpic.h"
 
-#include <boost/bind.hpp>
-
 #include "base/debug.h"
 #include "umps/machine_config.h"
 #include "umps/systembus.h"
 #include "umps/processor.h"
+#include "umps/snapshot.h"
 
 InterruptController::InterruptController(const MachineConfig* config, SystemBus* bus)
     : config(config),
@@ -169,7 +168,7 @@ void InterruptController::Write(Word addr, Word data, const Processor* cpu)
 
         case CPUCTL_OUTBOX:
             bus->scheduleEvent(kIpiLatency * config->getClockRate(),
-                               boost::bind(&InterruptController::deliverIPI, this, cpu->Id(), data));
+                               SystemBus::EVENT_IPI, cpu->Id(), data);
             break;
 
         case CPUCTL_TPR:
@@ -190,7 +189,7 @@ void InterruptController::Write(Word addr, Word data, const Processor* cpu)
     }
 }
 
-void InterruptController::deliverIPI(unsigned int origin, Word outbox)
+void InterruptController::DeliverIPI(unsigned int origin, Word outbox)
 {
     Word recipients = CPUCTL_OUTBOX_GET_RECIP(outbox);
 
@@ -214,3 +213,68 @@ void InterruptController::deliverIPI(unsigned int origin, Word outbox)
         }
     }
 }
+
+void InterruptController::Save(SnapshotWriter* out) const
+{
+    out->PutWord(arbiter);
+
+    for (unsigned int il = 0; il < N_EXT_IL + 1; il++) {
+        for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+            const Source& source = sources[il][devNo];
+            out->PutWord(source.lastTarget);
+            out->PutWord(source.route.destination);
+            out->PutWord(source.route.policy);
+        }
+    }
+
+    foreach (const CpuData& cd, cpuData) {
+        out->PutWord(cd.ipMask);
+        out->PutWords(cd.idb, N_EXT_IL);
+        out->PutWord(cd.ipiInbox.size());
+        foreach (const IpiMessage& ipi, cd.ipiInbox) {
+            out->PutWord(ipi.origin);
+            out->PutWord(ipi.msg);
+        }
+        out->PutWord(cd.taskPriority);
+        out->PutWords(cd.biosReserved, 2);
+    }
+}
+
+void InterruptController::Restore(SnapshotReader* in)
+{
+    arbiter = in->GetWord();
+    in->Expect(arbiter < cpuData.size());
+
+    for (unsigned int il = 0; il < N_EXT_IL + 1; il++) {
+        for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+            Source& source = sources[il][devNo];
+            source.lastTarget = in->GetWord();
+            in->Expect(source.lastTarget < cpuData.size() || source.lastTarget == kInvalidCpuId);
+            Word destination = in->GetWord();
+            Word policy = in->GetWord();
+            in->Expect(destination < (1U << MachineConfig::MAX_CPUS) && policy <= 1);
+            source.route.destination = destination;
+            source.route.policy = policy;
+        }
+    }
+
+    foreach (CpuData& cd, cpuData) {
+        cd.ipMask = in->GetWord();
+        in->GetWords(cd.idb, N_EXT_IL);
+        Word inboxSize = in->GetWord();
+        in->Expect(inboxSize <= MachineConfig::MAX_CPUS);
+        cd.ipiInbox.clear();
+        for (Word i = 0; i < inboxSize; i++) {
+            Word origin = in->GetWord();
+            Word msg = in->GetWord();
+            in->Expect(origin < cpuData.size() && msg <= 0xff);
+            IpiMessage ipi;
+            ipi.origin = origin;
+            ipi.msg = msg;
+            cd.ipiInbox.push_back(ipi);
+        }
+        cd.taskPriority = in->GetWord();
+        in->Expect(cd.taskPriority <= CPUCTL_TPR_PRIORITY_MASK);
+        in->GetWords(cd.biosReserved, 2);
+    }
+}
@@ -30,6 +30,8 @@
 
 class SystemBus;
 class Processor;
+class SnapshotWriter;
+class SnapshotReader;
 
 class InterruptController {
 public:
@@ -45,6 +47,15 @@ public:
 
     Word GetIP(Word cpuId) const { return cpuData[cpuId].ipMask << CAUSE_IP_BIT(0); }
 
+    // This method delivers the IPI sent by cpu origin, with outbox
+    // register value outbox
+    void DeliverIPI(unsigned int origin, Word outbox);
+
+    // These methods save and restore the interrupt routing state and
+    // the pending interrupts and IPIs of each cpu
+    void Save(SnapshotWriter* out) const;
+    void Restore(SnapshotReader* in);
+
 private:
     static const unsigned int kBaseIL = 2;
     static const unsigned int kSharedILBase = 1;
@@ -92,8 +103,6 @@ private:
         Word biosReserved[2];
     };
 
-    void deliverIPI(unsigned int origin, Word outbox);
-
     const MachineConfig* const config;
     SystemBus* const bus;
 
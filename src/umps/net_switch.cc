@@ -0,0 +1,175 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * Copyright (C) 2011 Tomislav Jonjic
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "umps/net_switch.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "umps/const.h"
+
+// frames queued at most for each port
+#define NETSWITCHQUEUE 64
+
+typedef std::map<std::string, boost::weak_ptr<NetSwitch> > SwitchMap;
+
+// switches in existence, by name, and number of ports ever created
+HIDDEN boost::mutex registryMutex;
+HIDDEN SwitchMap switches;
+HIDDEN unsigned int portSerial = 0;
+
+HIDDEN uint64_t addressKey(const char* addr)
+{
+    uint64_t key = 0;
+    for (unsigned int i = 0; i < 6; i++)
+        key = (key << 8) | (unsigned char) addr[i];
+    return key;
+}
+
+const char* const NetSwitch::kNamePrefix = "switch:";
+
+bool NetSwitch::IsSwitchName(const char* name)
+{
+    return strncmp(name, kNamePrefix, strlen(kNamePrefix)) == 0;
+}
+
+netinterface* NetSwitch::Connect(const char* name, const char* addr, int intnum)
+{
+    assert(IsSwitchName(name));
+    std::string switchName(name + strlen(kNamePrefix));
+
+    boost::mutex::scoped_lock lock(registryMutex);
+    shared_ptr<NetSwitch> netSwitch = switches[switchName].lock();
+    if (!netSwitch) {
+        netSwitch.reset(new NetSwitch(switchName));
+        switches[switchName] = netSwitch;
+    }
+    return new SwitchPort(netSwitch, addr, intnum, portSerial++);
+}
+
+NetSwitch::NetSwitch(const std::string& name)
+    : name(name)
+{
+}
+
+NetSwitch::~NetSwitch()
+{
+    boost::mutex::scoped_lock lock(registryMutex);
+    SwitchMap::iterator it = switches.find(name);
+    if (it != switches.end() && it->second.expired())
+        switches.erase(it);
+}
+
+void NetSwitch::attach(SwitchPort* port)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    ports.push_back(port);
+}
+
+void NetSwitch::detach(SwitchPort* port)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    ports.erase(std::find(ports.begin(), ports.end(), port));
+
+    std::map<uint64_t, SwitchPort*>::iterator it = addresses.begin();
+    while (it != addresses.end()) {
+        if (it->second == port)
+            addresses.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void NetSwitch::forward(SwitchPort* from, const char* buf, int len)
+{
+    Frame frame(new std::vector<char>(buf, buf + len));
+
+    boost::mutex::scoped_lock lock(mutex);
+
+    // Learn where the sender is, and look up the destination unless
+    // the frame is a broadcast or multicast one
+    SwitchPort* to = NULL;
+    if (len >= 12) {
+        addresses[addressKey(buf + 6)] = from;
+        if (!(buf[0] & 1)) {
+            std::map<uint64_t, SwitchPort*>::const_iterator it = addresses.find(addressKey(buf));
+            if (it != addresses.end())
+                to = it->second;
+        }
+    }
+
+    foreach (SwitchPort* port, ports) {
+        if (port == from || (to != NULL && port != to))
+            continue;
+        if (port->queue.size() < NETSWITCHQUEUE)
+            port->queue.push_back(frame);
+    }
+}
+
+int NetSwitch::receive(SwitchPort* port, char* buf, int len)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    if (port->queue.empty())
+        return 0;
+
+    Frame frame = port->queue.front();
+    port->queue.pop_front();
+    len = std::min(len, (int) frame->size());
+    if (len > 0)
+        memcpy(buf, &(*frame)[0], len);
+    return len;
+}
+
+SwitchPort::SwitchPort(shared_ptr<NetSwitch> netSwitch, const char* addr, int intnum,
+                       unsigned int serial)
+    : netinterface(addr, intnum),
+      netSwitch(netSwitch)
+{
+    // Default addresses are made from the pid, which all machines in
+    // the process share, so they are told apart by the port serial
+    if (addr == NULL) {
+        ethaddr[2] = (serial >> 24) & 0xff;
+        ethaddr[3] = (serial >> 16) & 0xff;
+        ethaddr[4] = (serial >> 8) & 0xff;
+        ethaddr[5] = serial & 0xff;
+    }
+    netSwitch->attach(this);
+}
+
+SwitchPort::~SwitchPort()
+{
+    netSwitch->detach(this);
+}
+
+int SwitchPort::sendframe(const char* buf, int len)
+{
+    // The switch always takes a frame, even if it drops it later
+    netSwitch->forward(this, buf, len);
+    return len;
+}
+
+int SwitchPort::recvframe(char* buf, int len)
+{
+    return netSwitch->receive(this, buf, len);
+}
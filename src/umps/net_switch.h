@@ -0,0 +1,107 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * Copyright (C) 2011 Tomislav Jonjic
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_NET_SWITCH_H
+#define UMPS_NET_SWITCH_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include "base/lang.h"
+#include "base/basic_types.h"
+#include "umps/vde_network.h"
+
+class SwitchPort;
+
+// NetSwitch emulates an Ethernet switch within the simulator process,
+// so that the network interfaces of several machines may talk to each
+// other without an external VDE switch. An interface is attached to
+// the switch NAME by giving "switch:NAME" as its device file; the
+// switch exists as long as some interface is attached to it.
+//
+// Like a real switch, it learns the address behind each port from the
+// frames it forwards: frames for a known address go to that port
+// only, the others to all ports. A frame is stored once however many
+// ports receive it, and is dropped for ports whose queue is full.
+// Machines attached to the same switch may run on different threads
+class NetSwitch {
+public:
+    static const char* const kNamePrefix;
+
+    // This method returns TRUE if name designates an in-process
+    // switch rather than a VDE one
+    static bool IsSwitchName(const char* name);
+
+    // This method returns a new interface attached to the switch
+    // designated by name, creating the switch if needed
+    static netinterface* Connect(const char* name, const char* addr, int intnum);
+
+    ~NetSwitch();
+
+private:
+    typedef shared_ptr<const std::vector<char> > Frame;
+    typedef std::deque<Frame> FrameQueue;
+
+    explicit NetSwitch(const std::string& name);
+
+    void attach(SwitchPort* port);
+    void detach(SwitchPort* port);
+    void forward(SwitchPort* from, const char* buf, int len);
+    int receive(SwitchPort* port, char* buf, int len);
+
+    const std::string name;
+
+    // guards ports, addresses and port queues
+    boost::mutex mutex;
+    std::vector<SwitchPort*> ports;
+    std::map<uint64_t, SwitchPort*> addresses;
+
+    friend class SwitchPort;
+
+    DISABLE_COPY_AND_ASSIGNMENT(NetSwitch);
+};
+
+// SwitchPort is the network interface backend for NetSwitch
+class SwitchPort : public netinterface {
+public:
+    SwitchPort(shared_ptr<NetSwitch> netSwitch, const char* addr, int intnum, unsigned int serial);
+    virtual ~SwitchPort();
+
+protected:
+    virtual int sendframe(const char* buf, int len);
+    virtual int recvframe(char* buf, int len);
+
+private:
+    shared_ptr<NetSwitch> netSwitch;
+
+    // frames forwarded to this port and not yet received
+    NetSwitch::FrameQueue queue;
+
+    friend class NetSwitch;
+
+    DISABLE_COPY_AND_ASSIGNMENT(SwitchPort);
+};
+
+#endif // UMPS_NET_SWITCH_H
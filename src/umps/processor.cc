@@ -34,6 +34,7 @@
 #include "umps/processor.h"
 
 #include <cassert>
+#include <algorithm>
 
 #include "umps/const.h"
 #include "umps/cp0.h"
@@ -43,7 +44,9 @@
 #include "umps/utility.h"
 #include "umps/machine_config.h"
 #include "umps/error.h"
+#include "umps/snapshot.h"
 #include "umps/disassemble.h"
+#include "base/debug.h"
 
 
 // Names of exceptions
@@ -88,6 +91,288 @@ HIDDEN const Word excCode[] = {
     12UL
 };
 
+// Spin loop detection: the longest loop considered, in instructions,
+// and the most passes a loop is let go between checks (see spinCheck())
+HIDDEN const unsigned int kMaxSpinLength = 32;
+HIDDEN const unsigned int kMaxSpinBackoff = 64;
+
+// The instruction set as implemented by Processor: for each
+// instruction, its handler, the format of its immediate operand, and
+// whether the next instruction is in a branch delay slot
+#define PROCESSOR_INSTRUCTIONS(X)                               \
+    X(OP_ADD,           execADD,            IMM_NONE,   false)  \
+    X(OP_ADDU,          execADDU,           IMM_NONE,   false)  \
+    X(OP_AND,           execAND,            IMM_NONE,   false)  \
+    X(OP_BREAK,         execBREAK,          IMM_NONE,   false)  \
+    X(OP_DIV,           execDIV,            IMM_NONE,   false)  \
+    X(OP_DIVU,          execDIVU,           IMM_NONE,   false)  \
+    X(OP_JALR,          execJALR,           IMM_NONE,   true)   \
+    X(OP_JR,            execJR,             IMM_NONE,   true)   \
+    X(OP_MFHI,          execMFHI,           IMM_NONE,   false)  \
+    X(OP_MFLO,          execMFLO,           IMM_NONE,   false)  \
+    X(OP_MTHI,          execMTHI,           IMM_NONE,   false)  \
+    X(OP_MTLO,          execMTLO,           IMM_NONE,   false)  \
+    X(OP_MULT,          execMULT,           IMM_NONE,   false)  \
+    X(OP_MULTU,         execMULTU,          IMM_NONE,   false)  \
+    X(OP_NOR,           execNOR,            IMM_NONE,   false)  \
+    X(OP_OR,            execOR,             IMM_NONE,   false)  \
+    X(OP_SLL,           execSLL,            IMM_NONE,   false)  \
+    X(OP_SLLV,          execSLLV,           IMM_NONE,   false)  \
+    X(OP_SLT,           execSLT,            IMM_NONE,   false)  \
+    X(OP_SLTU,          execSLTU,           IMM_NONE,   false)  \
+    X(OP_SRA,           execSRA,            IMM_NONE,   false)  \
+    X(OP_SRAV,          execSRAV,           IMM_NONE,   false)  \
+    X(OP_SRL,           execSRL,            IMM_NONE,   false)  \
+    X(OP_SRLV,          execSRLV,           IMM_NONE,   false)  \
+    X(OP_SUB,           execSUB,            IMM_NONE,   false)  \
+    X(OP_SUBU,          execSUBU,           IMM_NONE,   false)  \
+    X(OP_SYSCALL,       execSYSCALL,        IMM_NONE,   false)  \
+    X(OP_XOR,           execXOR,            IMM_NONE,   false)  \
+    X(OP_CAS,           execCAS,            IMM_NONE,   false)  \
+    X(OP_ADDI,          execADDI,           IMM_SIGNED, false)  \
+    X(OP_ADDIU,         execADDIU,          IMM_SIGNED, false)  \
+    X(OP_ANDI,          execANDI,           IMM_ZERO,   false)  \
+    X(OP_LUI,           execLUI,            IMM_UPPER,  false)  \
+    X(OP_ORI,           execORI,            IMM_ZERO,   false)  \
+    X(OP_SLTI,          execSLTI,           IMM_SIGNED, false)  \
+    X(OP_SLTIU,         execSLTIU,          IMM_SIGNED, false)  \
+    X(OP_XORI,          execXORI,           IMM_ZERO,   false)  \
+    X(OP_BEQ,           execBEQ,            IMM_OFFSET, true)   \
+    X(OP_BGEZ,          execBGEZ,           IMM_OFFSET, true)   \
+    X(OP_BGEZAL,        execBGEZAL,         IMM_OFFSET, true)   \
+    X(OP_BLTZ,          execBLTZ,           IMM_OFFSET, true)   \
+    X(OP_BLTZAL,        execBLTZAL,         IMM_OFFSET, true)   \
+    X(OP_BGTZ,          execBGTZ,           IMM_OFFSET, true)   \
+    X(OP_BLEZ,          execBLEZ,           IMM_OFFSET, true)   \
+    X(OP_BNE,           execBNE,            IMM_OFFSET, true)   \
+    X(OP_J,             execJ,              IMM_TARGET, true)   \
+    X(OP_JAL,           execJAL,            IMM_TARGET, true)   \
+    X(OP_RFE,           execRFE,            IMM_NONE,   false)  \
+    X(OP_TLBP,          execTLBP,           IMM_NONE,   false)  \
+    X(OP_TLBR,          execTLBR,           IMM_NONE,   false)  \
+    X(OP_TLBWI,         execTLBWI,          IMM_NONE,   false)  \
+    X(OP_TLBWR,         execTLBWR,          IMM_NONE,   false)  \
+    X(OP_WAIT,          execWAIT,           IMM_NONE,   false)  \
+    X(OP_BC0F,          execBC0F,           IMM_OFFSET, true)   \
+    X(OP_BC0T,          execBC0T,           IMM_NONE,   true)   \
+    X(OP_MFC0,          execMFC0,           IMM_NONE,   false)  \
+    X(OP_MTC0,          execMTC0,           IMM_NONE,   false)  \
+    X(OP_CLRTLB,        execCLRTLB,         IMM_NONE,   false)  \
+    X(OP_LB,            execLB,             IMM_SIGNED, false)  \
+    X(OP_LBU,           execLBU,            IMM_SIGNED, false)  \
+    X(OP_LH,            execLH,             IMM_SIGNED, false)  \
+    X(OP_LHU,           execLHU,            IMM_SIGNED, false)  \
+    X(OP_LW,            execLW,             IMM_SIGNED, false)  \
+    X(OP_LWL,           execLWL,            IMM_SIGNED, false)  \
+    X(OP_LWR,           execLWR,            IMM_SIGNED, false)  \
+    X(OP_SB,            execSB,             IMM_SIGNED, false)  \
+    X(OP_SH,            execSH,             IMM_SIGNED, false)  \
+    X(OP_SW,            execSW,             IMM_SIGNED, false)  \
+    X(OP_SWL,           execSWL,            IMM_SIGNED, false)  \
+    X(OP_SWR,           execSWR,            IMM_SIGNED, false)  \
+    X(OP_COPUNUSABLE,   execCopUnusable,    IMM_NONE,   false)  \
+    X(OP_RESERVED,      execReserved,       IMM_NONE,   false)
+
+// Immediate operand formats
+enum ImmFormat {
+    IMM_NONE,
+    IMM_SIGNED,
+    IMM_ZERO,
+    IMM_UPPER,
+    IMM_OFFSET,
+    IMM_TARGET
+};
+
+// Instruction codes, as stored in DecodedInstr::op; the last ones are
+// placeholders for secondary decoding tables, and never reach
+// execution
+enum InstrOp {
+    OP_EMPTY = DecodedInstr::kEmpty,
+#define INSTR_ENUM(op, handler, imm, branch) op,
+    PROCESSOR_INSTRUCTIONS(INSTR_ENUM)
+#undef INSTR_ENUM
+    OP_SPECIAL,
+    OP_REGIMM,
+    OP_COP0
+};
+
+struct InstrInfo {
+    ImmFormat imm;
+    bool isBranch;
+};
+
+HIDDEN const InstrInfo instrInfo[] = {
+    { IMM_NONE, false },
+#define INSTR_INFO(op, handler, imm, branch) { imm, branch },
+    PROCESSOR_INSTRUCTIONS(INSTR_INFO)
+#undef INSTR_INFO
+};
+
+// Decoding tables are built at compile time from the opcode and
+// function code constants: DecodeEntry<table, code>::op is the
+// instruction for a given code in a given table, and every code not
+// explicitly mapped below is a reserved instruction (or a CPU
+// exception, for CP0 operations).
+enum DecodeTable {
+    OPCODE_TABLE,
+    FUNCT_TABLE,
+    REGIMM_TABLE,
+    CO0_TABLE
+};
+
+template<DecodeTable table, unsigned int code>
+struct DecodeEntry {
+    static const uint8_t op = OP_RESERVED;
+};
+
+template<unsigned int code>
+struct DecodeEntry<CO0_TABLE, code> {
+    static const uint8_t op = OP_COPUNUSABLE;
+};
+
+#define DECODE_ENTRY(table, code, instrOp)              \
+    template<> struct DecodeEntry<table, code> {        \
+        static const uint8_t op = instrOp;              \
+    }
+
+// OPCODE field
+DECODE_ENTRY(OPCODE_TABLE, 0, OP_SPECIAL);
+DECODE_ENTRY(OPCODE_TABLE, BGL, OP_REGIMM);
+DECODE_ENTRY(OPCODE_TABLE, J, OP_J);
+DECODE_ENTRY(OPCODE_TABLE, JAL, OP_JAL);
+DECODE_ENTRY(OPCODE_TABLE, BEQ, OP_BEQ);
+DECODE_ENTRY(OPCODE_TABLE, BNE, OP_BNE);
+DECODE_ENTRY(OPCODE_TABLE, BLEZ, OP_BLEZ);
+DECODE_ENTRY(OPCODE_TABLE, BGTZ, OP_BGTZ);
+DECODE_ENTRY(OPCODE_TABLE, ADDI, OP_ADDI);
+DECODE_ENTRY(OPCODE_TABLE, ADDIU, OP_ADDIU);
+DECODE_ENTRY(OPCODE_TABLE, SLTI, OP_SLTI);
+DECODE_ENTRY(OPCODE_TABLE, SLTIU, OP_SLTIU);
+DECODE_ENTRY(OPCODE_TABLE, ANDI, OP_ANDI);
+DECODE_ENTRY(OPCODE_TABLE, ORI, OP_ORI);
+DECODE_ENTRY(OPCODE_TABLE, XORI, OP_XORI);
+DECODE_ENTRY(OPCODE_TABLE, LUI, OP_LUI);
+DECODE_ENTRY(OPCODE_TABLE, COP0SEL, OP_COP0);
+DECODE_ENTRY(OPCODE_TABLE, COPTYPE + 1, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, COPTYPE + 2, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, COPTYPE + 3, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, COPTYPE + 4, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, COPTYPE + 5, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, COPTYPE + 6, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, COPTYPE + 7, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, LB, OP_LB);
+DECODE_ENTRY(OPCODE_TABLE, LH, OP_LH);
+DECODE_ENTRY(OPCODE_TABLE, LWL, OP_LWL);
+DECODE_ENTRY(OPCODE_TABLE, LW, OP_LW);
+DECODE_ENTRY(OPCODE_TABLE, LBU, OP_LBU);
+DECODE_ENTRY(OPCODE_TABLE, LHU, OP_LHU);
+DECODE_ENTRY(OPCODE_TABLE, LWR, OP_LWR);
+DECODE_ENTRY(OPCODE_TABLE, SB, OP_SB);
+DECODE_ENTRY(OPCODE_TABLE, SH, OP_SH);
+DECODE_ENTRY(OPCODE_TABLE, SWL, OP_SWL);
+DECODE_ENTRY(OPCODE_TABLE, SW, OP_SW);
+DECODE_ENTRY(OPCODE_TABLE, SWR, OP_SWR);
+// LWCz, SWCz refer to unusable coprocessors; LDCz, SDCz (DWCOPBITPOS
+// set) are left reserved
+DECODE_ENTRY(OPCODE_TABLE, LWC0, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, LWC0 + 1, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, LWC0 + 2, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, LWC0 + 3, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, SWC0, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, SWC0 + 1, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, SWC0 + 2, OP_COPUNUSABLE);
+DECODE_ENTRY(OPCODE_TABLE, SWC0 + 3, OP_COPUNUSABLE);
+
+// FUNCT field of REGTYPE (Special) instructions
+DECODE_ENTRY(FUNCT_TABLE, SFN_SLL, OP_SLL);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SRL, OP_SRL);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SRA, OP_SRA);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SLLV, OP_SLLV);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SRLV, OP_SRLV);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SRAV, OP_SRAV);
+DECODE_ENTRY(FUNCT_TABLE, SFN_JR, OP_JR);
+DECODE_ENTRY(FUNCT_TABLE, SFN_JALR, OP_JALR);
+DECODE_ENTRY(FUNCT_TABLE, SFN_CAS, OP_CAS);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SYSCALL, OP_SYSCALL);
+DECODE_ENTRY(FUNCT_TABLE, SFN_BREAK, OP_BREAK);
+DECODE_ENTRY(FUNCT_TABLE, SFN_MFHI, OP_MFHI);
+DECODE_ENTRY(FUNCT_TABLE, SFN_MTHI, OP_MTHI);
+DECODE_ENTRY(FUNCT_TABLE, SFN_MFLO, OP_MFLO);
+DECODE_ENTRY(FUNCT_TABLE, SFN_MTLO, OP_MTLO);
+DECODE_ENTRY(FUNCT_TABLE, SFN_MULT, OP_MULT);
+DECODE_ENTRY(FUNCT_TABLE, SFN_MULTU, OP_MULTU);
+DECODE_ENTRY(FUNCT_TABLE, SFN_DIV, OP_DIV);
+DECODE_ENTRY(FUNCT_TABLE, SFN_DIVU, OP_DIVU);
+DECODE_ENTRY(FUNCT_TABLE, SFN_ADD, OP_ADD);
+DECODE_ENTRY(FUNCT_TABLE, SFN_ADDU, OP_ADDU);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SUB, OP_SUB);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SUBU, OP_SUBU);
+DECODE_ENTRY(FUNCT_TABLE, SFN_AND, OP_AND);
+DECODE_ENTRY(FUNCT_TABLE, SFN_OR, OP_OR);
+DECODE_ENTRY(FUNCT_TABLE, SFN_XOR, OP_XOR);
+DECODE_ENTRY(FUNCT_TABLE, SFN_NOR, OP_NOR);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SLT, OP_SLT);
+DECODE_ENTRY(FUNCT_TABLE, SFN_SLTU, OP_SLTU);
+
+// RT field of BGL instructions
+DECODE_ENTRY(REGIMM_TABLE, BLTZ, OP_BLTZ);
+DECODE_ENTRY(REGIMM_TABLE, BGEZ, OP_BGEZ);
+DECODE_ENTRY(REGIMM_TABLE, BLTZAL, OP_BLTZAL);
+DECODE_ENTRY(REGIMM_TABLE, BGEZAL, OP_BGEZAL);
+
+// FUNCT field of CO0 instructions
+DECODE_ENTRY(CO0_TABLE, TLBR, OP_TLBR);
+DECODE_ENTRY(CO0_TABLE, TLBWI, OP_TLBWI);
+DECODE_ENTRY(CO0_TABLE, TLBWR, OP_TLBWR);
+DECODE_ENTRY(CO0_TABLE, TLBP, OP_TLBP);
+DECODE_ENTRY(CO0_TABLE, RFE, OP_RFE);
+DECODE_ENTRY(CO0_TABLE, COFUN_WAIT, OP_WAIT);
+
+#define DECODE_ROW(table, base)                         \
+    DecodeEntry<table, base + 0>::op,                   \
+    DecodeEntry<table, base + 1>::op,                   \
+    DecodeEntry<table, base + 2>::op,                   \
+    DecodeEntry<table, base + 3>::op,                   \
+    DecodeEntry<table, base + 4>::op,                   \
+    DecodeEntry<table, base + 5>::op,                   \
+    DecodeEntry<table, base + 6>::op,                   \
+    DecodeEntry<table, base + 7>::op
+
+HIDDEN const uint8_t opcodeTable[64] = {
+    DECODE_ROW(OPCODE_TABLE, 000), DECODE_ROW(OPCODE_TABLE, 010),
+    DECODE_ROW(OPCODE_TABLE, 020), DECODE_ROW(OPCODE_TABLE, 030),
+    DECODE_ROW(OPCODE_TABLE, 040), DECODE_ROW(OPCODE_TABLE, 050),
+    DECODE_ROW(OPCODE_TABLE, 060), DECODE_ROW(OPCODE_TABLE, 070)
+};
+
+HIDDEN const uint8_t functTable[64] = {
+    DECODE_ROW(FUNCT_TABLE, 000), DECODE_ROW(FUNCT_TABLE, 010),
+    DECODE_ROW(FUNCT_TABLE, 020), DECODE_ROW(FUNCT_TABLE, 030),
+    DECODE_ROW(FUNCT_TABLE, 040), DECODE_ROW(FUNCT_TABLE, 050),
+    DECODE_ROW(FUNCT_TABLE, 060), DECODE_ROW(FUNCT_TABLE, 070)
+};
+
+HIDDEN const uint8_t regimmTable[32] = {
+    DECODE_ROW(REGIMM_TABLE, 000), DECODE_ROW(REGIMM_TABLE, 010),
+    DECODE_ROW(REGIMM_TABLE, 020), DECODE_ROW(REGIMM_TABLE, 030)
+};
+
+HIDDEN const uint8_t co0Table[64] = {
+    DECODE_ROW(CO0_TABLE, 000), DECODE_ROW(CO0_TABLE, 010),
+    DECODE_ROW(CO0_TABLE, 020), DECODE_ROW(CO0_TABLE, 030),
+    DECODE_ROW(CO0_TABLE, 040), DECODE_ROW(CO0_TABLE, 050),
+    DECODE_ROW(CO0_TABLE, 060), DECODE_ROW(CO0_TABLE, 070)
+};
+
+#undef DECODE_ROW
+#undef DECODE_ENTRY
+
+// Computed goto is a GNU extension, supported by clang as well;
+// elsewhere instruction dispatch falls back to a switch statement
+#if defined(__GNUC__)
+# define THREADED_DISPATCH 1
+#endif
+
 
 // Each TLBEntry object represents a single entry in the TLB contained in
 // the CP0 coprocessor part of a real MIPS processor.
@@ -197,10 +482,59 @@ Processor::Processor(const MachineConfig* config, Word cpuId, Machine* machine,
     : id(cpuId),
       machine(machine),
       bus(bus),
+      decodeCache(bus->getDecodeCache()),
       status(PS_HALTED),
+      excCause(NOEXCEPTION),
+      copENum(0),
+      isBranchD(false),
+      loadPending(LOAD_TARGET_NONE),
+      loadReg(0),
+      loadVal(0),
+      currInstr(NOP),
+      currSlot(NULL),
+      mapGeneration(1),
+      fetchGeneration(0),
+      prevPC(MAXWORDVAL),
+      prevPhysPC(MAXWORDVAL),
+      prevInstr(NOP),
+      currPC(0),
+      currPhysPC(0),
+      nextPC(0),
+      succPC(0),
+      timerZero(0),
+      timerDeadline(~UINT64_C(0)),
+      randomStart(0),
+      cycledTick(0),
+      executedInstr(0),
+      lastStore(0),
+      quantumTicks(0),
+      inQuantum(false),
+      intPending(false),
       tlbSize(config->getTLBSize()),
       tlb(new TLBEntry[tlbSize])
-{}
+{
+    // Registers only get meaningful values on reset, but a processor
+    // which was never reset may still be saved in a snapshot
+    for (unsigned int i = 0; i < CPUREGNUM; i++)
+        gpr[i] = 0;
+    for (unsigned int i = 0; i < CP0REGNUM; i++)
+        cpreg[i] = 0;
+
+    flushSoftTLB();
+
+    // At least as many buckets as TLB entries
+    tlbHashBits = 1;
+    while ((1UL << tlbHashBits) < tlbSize)
+        tlbHashBits++;
+    tlbBucket.reset(new unsigned int[1UL << tlbHashBits]);
+    tlbNext.reset(new unsigned int[tlbSize]);
+    tlbPrev.reset(new unsigned int[tlbSize]);
+
+    for (size_t b = 0; b < (1UL << tlbHashBits); b++)
+        tlbBucket[b] = kNoTLBEntry;
+    for (unsigned int i = 0; i < tlbSize; i++)
+        tlbIndexInsert(i);
+}
 
 Processor::~Processor() {}
 
@@ -208,10 +542,16 @@ void Processor::setStatus(ProcessorStatus newStatus)
 {
     if (status != newStatus) {
         status = newStatus;
-        StatusChanged.emit();
+        notify(NOTIFY_STATUS);
     }
 }
 
+// This method returns the current clock tick, as seen by this processor
+inline uint64_t Processor::clock() const
+{
+    return bus->getClock() + quantumTicks;
+}
+
 // This method puts Processor in startup state. This is done following the
 // MIPS conventions on register fields to be set; it also pre-loads the
 // first instruction since Cycle() goes on with execute-load loop
@@ -236,6 +576,9 @@ void Processor::Reset(Word pc, Word sp)
         gpr[i] = 0;
     gpr[29] = sp;
 
+    // no loop is being watched
+    spinReset();
+
     // no previous instruction is available
     prevPC = MAXWORDVAL;
     prevPhysPC = MAXWORDVAL;
@@ -249,6 +592,8 @@ void Processor::Reset(Word pc, Word sp)
     cpreg[RANDOM] =  ((tlbSize - 1UL) << RNDIDXOFFS) - RANDOMSTEP;
     cpreg[STATUS] = STATUSRESET;
     cpreg[PRID] = id;
+    mappingChanged();
+    updateIntPending();
 
     currPC = pc;
 
@@ -256,16 +601,28 @@ void Processor::Reset(Word pc, Word sp)
     // mapVirtual and SystemBus cannot signal TRUE on this call
     if (mapVirtual(currPC, &currPhysPC, EXEC) || bus->InstrRead(currPhysPC, &currInstr, this))
         Panic("Illegal memory access in Processor::Reset");
+    fetchGeneration = mapGeneration;
+    decodeCurrInstr();
 
     // sets values for following PCs
     nextPC = currPC + WORDLEN;
     succPC = nextPC + WORDLEN;
 
     setStatus(PS_RUNNING);
+
+    // Random starts counting from its reset value; Timer is disabled
+    uint64_t tick = lastTick();
+    startTimer(tick);
+    startRandom(tick);
 }
 
 void Processor::Halt()
 {
+    // Timer and Random stop counting
+    uint64_t tick = lastTick();
+    syncTimer(tick);
+    syncRandom(tick);
+    spinReset();
     setStatus(PS_HALTED);
 }
 
@@ -290,36 +647,36 @@ void Processor::Cycle()
     if (isHalted())
         return;
 
-    // Update internal timer
-    if (cpreg[STATUS] & STATUS_TE) {
-        if (cpreg[CP0REG_TIMER] == 0)
-            AssertIRQ(IL_CPUTIMER);
-        cpreg[CP0REG_TIMER]--;
-    } else {
-        DeassertIRQ(IL_CPUTIMER);
-    }
+    // Update internal timer: it is only needed when it underflows
+    // or it has been disabled
+    if (clock() >= timerDeadline)
+        timerEvent();
 
     // In low-power state, only the per-cpu timer keeps running
-    if (isIdle())
+    if (isIdle()) {
+        cycledTick = clock();
         return;
+    }
 
-    // Instruction decode & exec
-    if (execInstr(currInstr))
+    // Instruction exec (decoding took place at fetch time)
+    executedInstr++;
+    if (execInstr(currDecoded))
         handleExc();
+    else if (currDecoded.isBranch && succPC <= currPC)
+        spinCheck();
 
     // Check if we entered sleep mode as a result of the last
     // instruction; if so, we effectively stall the pipeline.
-    if (isIdle())
+    if (isIdle()) {
+        cycledTick = clock();
         return;
+    }
 
     // PC saving for book-keeping purposes
     prevPC = currPC;
     prevPhysPC = currPhysPC;
     prevInstr = currInstr;
 
-    // RANDOM register is decremented
-    randomRegTick();
-
     // currPC is loaded so a new cycle fetch may start: this "PC stack" is
     // used to emulate delayed branch slots
     currPC = nextPC;
@@ -328,36 +685,106 @@ void Processor::Cycle()
 
     // Check for interrupt exception; note that this will _not_
     // trigger another exception if we're already in "exception mode".
-    if (checkForInt())
+    if (intPending && checkForInt())
         handleExc();
 
     // processor cycle fetch part
-    if (mapVirtual(currPC, &currPhysPC, EXEC)) {
-        // TLB or Address exception caused: current instruction is nullified
-        currInstr = NOP;
-        handleExc();
-    } else if (bus->InstrRead(currPhysPC, &currInstr, this)) {
-        // IBE exception caused: current instruction is nullified
-        currInstr = NOP;
-        handleExc();
+    if (!fetchChained())
+        fetch();
+}
+
+void Processor::RunQuantum()
+{
+    inQuantum = true;
+    while (quantumTicks < bus->QuantumLimit()) {
+        quantumTicks++;
+        Cycle();
+    }
+}
+
+void Processor::EndQuantum()
+{
+    quantumTicks = 0;
+    inQuantum = false;
+
+    foreach (const Notification& n, heldNotifications)
+        notify(n.kind, n.arg);
+    heldNotifications.clear();
+}
+
+// This method emits the signal for a notification of the given kind,
+// or holds it back until EndQuantum() if the processor is running a
+// quantum, since signal handlers expect to be called on the thread
+// driving the machine
+void Processor::notify(NotificationKind kind, unsigned int arg)
+{
+    if (inQuantum) {
+        Notification n = { kind, arg };
+        heldNotifications.push_back(n);
+        return;
+    }
+
+    switch (kind) {
+    case NOTIFY_EXCEPTION:
+        SignalException.emit(arg);
+        break;
+    case NOTIFY_STATUS:
+        StatusChanged.emit();
+        break;
+    case NOTIFY_SPIN:
+        SpinDetected.emit();
+        break;
+    case NOTIFY_TLB:
+        SignalTLBChanged.emit(arg);
+        break;
     }
 }
 
+uint32_t Processor::SpinCycles(uint64_t lastChange) const
+{
+    // The loop must not have been left, nor what it reads changed,
+    // since the last iteration found to be idempotent began
+    if (!isRunning() || !spinStuck || spinSince < lastChange ||
+        executedInstr - spinConfirmInstr >= spinLength)
+        return 0;
+
+    // Still, the timer goes on
+    const uint64_t now = clock();
+    if (timerDeadline <= now + 1)
+        return 0;
+    return (uint32_t) std::min(timerDeadline - now - 1, (uint64_t) MAXWORDVAL);
+}
+
 uint32_t Processor::IdleCycles() const
 {
     if (isHalted())
         return (uint32_t) -1;
     else if (isIdle())
-        return (cpreg[STATUS] & STATUS_TE) ? cpreg[CP0REG_TIMER] : (uint32_t) -1;
+        return timerRunning() ? (Word) (timerZero - clock() - 1) : (uint32_t) -1;
     else
         return 0;
 }
 
+// This method lets Processor know that the machine was fast-forwarded
+// by cycles ticks. Timer is derived from the bus clock, so there is
+// nothing to update on an idle processor. A spinning one (see
+// SpinCycles()) is credited with the whole loop iterations it would
+// have executed, which leave its state as it is, and executes the
+// remaining instructions
 void Processor::Skip(uint32_t cycles)
 {
-    assert(isIdle() && cycles <= IdleCycles());
-    if (cpreg[STATUS] & STATUS_TE)
-        cpreg[CP0REG_TIMER] -= cycles;
+    if (isIdle()) {
+        assert(cycles <= IdleCycles());
+        return;
+    }
+
+    assert(isRunning() && spinStuck);
+    const uint32_t rest = cycles % spinLength;
+    executedInstr += cycles - rest;
+    spinPassInstr += cycles - rest;
+    spinConfirmInstr += cycles - rest;
+    for (uint32_t i = 0; i < rest; i++)
+        Cycle();
 }
 
 // This method allows SystemBus and Processor itself to signal Processor
@@ -372,7 +799,7 @@ void Processor::Skip(uint32_t cycles)
 void Processor::SignalExc(unsigned int exc, Word cpuNum)
 {
     excCause = exc;
-    SignalException.emit(excCause);
+    notify(NOTIFY_EXCEPTION, excCause);
     // used only for CPUEXCEPTION handling
     copENum = cpuNum;
 }
@@ -380,15 +807,19 @@ void Processor::SignalExc(unsigned int exc, Word cpuNum)
 void Processor::AssertIRQ(unsigned int il)
 {
     cpreg[CAUSE] |= CAUSE_IP(il);
+    updateIntPending();
 
     // If in standby mode, go back to being a power hog.
-    if (isIdle())
+    if (isIdle()) {
         setStatus(PS_RUNNING);
+        startRandom(lastTick());
+    }
 }
 
 void Processor::DeassertIRQ(unsigned int il)
 {
     cpreg[CAUSE] &= ~CAUSE_IP(il);
+    updateIntPending();
 }
 
 // This method allows to get critical information on Processor current
@@ -483,7 +914,12 @@ SWord Processor::getGPR(unsigned int num)
 // by num. num coding itself is internal (see h/processor.h for mapping)
 Word Processor::getCP0Reg(unsigned int num)
 {
-    return(cpreg[num]);
+    if (num == CP0REG_TIMER && timerRunning())
+        return (Word) (timerZero - clock() - 1);
+    else if (num == RANDOM && isRunning())
+        return randomAfter(cpreg[RANDOM], clock() + 1 - randomStart);
+    else
+        return cpreg[num];
 }
 
 void Processor::getTLB(unsigned int index, Word* hi, Word* lo) const
@@ -515,8 +951,16 @@ void Processor::setGPR(unsigned int num, SWord val)
 // register. num coding itself is internal (see h/processor.h for mapping)
 void Processor::setCP0Reg(unsigned int num, Word val)
 {
-    if (num < CP0REGNUM)
+    if (num < CP0REGNUM) {
+        uint64_t tick = clock();
+        syncTimer(tick);
+        syncRandom(tick);
         cpreg[num] = val;
+        startTimer(tick);
+        startRandom(tick);
+        mappingChanged();
+        updateIntPending();
+    }
 }
 
 // This method allows to modify the current value of nextPC to force sudden
@@ -538,9 +982,9 @@ void Processor::setSuccPC(Word spc)
 void Processor::setTLB(unsigned int index, Word hi, Word lo)
 {
     if (index < tlbSize) {
-        tlb[index].setHI(hi);
-        tlb[index].setLO(lo);
-        SignalTLBChanged(index);
+        setTLBEntry(index, hi, lo);
+        mappingChanged();
+        notify(NOTIFY_TLB, index);
     } else {
         Panic("Unknown TLB entry in Processor::setTLB()");
     }
@@ -549,15 +993,109 @@ void Processor::setTLB(unsigned int index, Word hi, Word lo)
 void Processor::setTLBHi(unsigned int index, Word value)
 {
     assert(index < tlbSize);
-    tlb[index].setHI(value);
-    SignalTLBChanged(index);
+    setTLBEntry(index, value, tlb[index].getLO());
+    mappingChanged();
+    notify(NOTIFY_TLB, index);
 }
 
 void Processor::setTLBLo(unsigned int index, Word value)
 {
     assert(index < tlbSize);
-    tlb[index].setLO(value);
-    SignalTLBChanged(index);
+    setTLBEntry(index, tlb[index].getHI(), value);
+    mappingChanged();
+    notify(NOTIFY_TLB, index);
+}
+
+void Processor::Save(SnapshotWriter* out) const
+{
+    out->PutWord(status);
+    out->PutWord(excCause);
+    out->PutWord(copENum);
+    out->PutBool(isBranchD);
+
+    out->PutWord(loadPending);
+    out->PutWord(loadReg);
+    out->PutWord(loadVal);
+
+    out->PutWords((const Word*) gpr, kNumCPURegisters);
+
+    out->PutWord(currInstr);
+    out->PutWord(prevPC);
+    out->PutWord(prevPhysPC);
+    out->PutWord(prevInstr);
+    out->PutWord(currPC);
+    out->PutWord(currPhysPC);
+    out->PutWord(nextPC);
+    out->PutWord(succPC);
+
+    out->PutWords(cpreg, CP0REGNUM);
+
+    out->PutU64(timerZero);
+    out->PutU64(timerDeadline);
+    out->PutU64(randomStart);
+    out->PutU64(cycledTick);
+    out->PutU64(executedInstr);
+    out->PutU64(lastStore);
+
+    for (unsigned int i = 0; i < tlbSize; i++) {
+        out->PutWord(tlb[i].getHI());
+        out->PutWord(tlb[i].getLO());
+    }
+}
+
+void Processor::Restore(SnapshotReader* in)
+{
+    Word value = in->GetWord();
+    in->Expect(value <= PS_IDLE);
+    ProcessorStatus newStatus = (ProcessorStatus) value;
+    excCause = in->GetWord();
+    in->Expect(excCause < sizeof(excCode) / sizeof(excCode[0]));
+    copENum = in->GetWord();
+    isBranchD = in->GetBool();
+
+    value = in->GetWord();
+    in->Expect(value <= LOAD_TARGET_NONE);
+    loadPending = (LoadTargetType) value;
+    loadReg = in->GetWord();
+    in->Expect(loadReg < (loadPending == LOAD_TARGET_CPREG ? CP0REGNUM : CPUREGNUM));
+    loadVal = in->GetWord();
+
+    in->GetWords((Word*) gpr, kNumCPURegisters);
+
+    currInstr = in->GetWord();
+    prevPC = in->GetWord();
+    prevPhysPC = in->GetWord();
+    prevInstr = in->GetWord();
+    currPC = in->GetWord();
+    currPhysPC = in->GetWord();
+    nextPC = in->GetWord();
+    succPC = in->GetWord();
+
+    in->GetWords(cpreg, CP0REGNUM);
+
+    timerZero = in->GetU64();
+    timerDeadline = in->GetU64();
+    randomStart = in->GetU64();
+    cycledTick = in->GetU64();
+    executedInstr = in->GetU64();
+    lastStore = in->GetU64();
+
+    for (unsigned int i = 0; i < tlbSize; i++) {
+        Word hi = in->GetWord();
+        Word lo = in->GetWord();
+        setTLBEntry(i, hi, lo);
+    }
+
+    quantumTicks = 0;
+    spinReset();
+    mappingChanged();
+    updateIntPending();
+    fetchGeneration = 0;
+    decodeCurrInstr();
+    setStatus(newStatus);
+
+    for (unsigned int i = 0; i < tlbSize; i++)
+        notify(NOTIFY_TLB, i);
 }
 
 
@@ -566,13 +1104,105 @@ void Processor::setTLBLo(unsigned int index, Word value)
 //
 
 
-// This method advances CP0 RANDOM register, following MIPS conventions; it
-// cycles from RANDOMTOP to RANDOMBASE, one STEP less for each clock tick
-void Processor::randomRegTick()
+// This method returns the last clock tick this processor has been
+// cycled on, as seen from outside of its own Cycle(): the current one
+// if Cycle() has already been called on this tick, the previous one
+// otherwise. Only needed by (and valid for) processors which are not
+// running, or which are acted upon by bus events
+uint64_t Processor::lastTick() const
+{
+    const uint64_t now = clock();
+    return (cycledTick == now) ? now : now - 1;
+}
+
+// This method returns TRUE if CP0 Timer is counting down
+bool Processor::timerRunning() const
+{
+    return (cpreg[STATUS] & STATUS_TE) && !isHalted();
+}
+
+// This method does the CP0 Timer work due on the current clock tick:
+// if enabled, the timer underflows and raises its interrupt; if not,
+// its interrupt line is cleared
+void Processor::timerEvent()
+{
+    if (cpreg[STATUS] & STATUS_TE) {
+        AssertIRQ(IL_CPUTIMER);
+        // it then keeps counting down from FFFFFFFF
+        timerZero += UINT64_C(1) << 32;
+        timerDeadline = timerZero;
+    } else {
+        DeassertIRQ(IL_CPUTIMER);
+        timerDeadline = ~UINT64_C(0);
+    }
+}
+
+// These methods save the current values of Timer and Random into
+// cpreg[], as of the end of clock tick tick
+void Processor::syncTimer(uint64_t tick)
+{
+    if (timerRunning())
+        cpreg[CP0REG_TIMER] = (Word) (timerZero - tick - 1);
+}
+
+void Processor::syncRandom(uint64_t tick)
+{
+    if (isRunning()) {
+        cpreg[RANDOM] = randomAfter(cpreg[RANDOM], tick + 1 - randomStart);
+        randomStart = tick + 1;
+    }
+}
+
+// These methods (re)start Timer and Random from their values in
+// cpreg[], counting from the clock tick after tick
+void Processor::startTimer(uint64_t tick)
+{
+    if (timerRunning()) {
+        timerZero = tick + 1 + cpreg[CP0REG_TIMER];
+        timerDeadline = timerZero;
+    } else {
+        // a disabled timer clears its interrupt line on next cycle
+        timerDeadline = tick + 1;
+    }
+}
+
+void Processor::startRandom(uint64_t tick)
 {
-    cpreg[RANDOM] = (cpreg[RANDOM] - RANDOMSTEP) & (((tlbSize - 1UL) << RNDIDXOFFS));
-    if (cpreg[RANDOM] < RANDOMBASE)
-        cpreg[RANDOM] =  ((tlbSize - 1UL) << RNDIDXOFFS);
+    randomStart = tick + 1;
+}
+
+// This method returns the value of CP0 RANDOM register after ticks
+// instructions have been executed starting from value. Following MIPS
+// conventions, on each one it cycles from the top TLB index down to 1, one
+// STEP less each time
+Word Processor::randomAfter(Word value, uint64_t ticks) const
+{
+    const Word top = (tlbSize - 1UL) << RNDIDXOFFS;
+
+    if (ticks == 0)
+        return value;
+
+    // The first step brings an arbitrary value within range...
+    value = (value - RANDOMSTEP) & top;
+    if (value < RANDOMBASE)
+        value = top;
+    ticks--;
+
+    if ((tlbSize & (tlbSize - 1)) == 0) {
+        // ...from where the index cycles through tlbSize - 1 .. 1
+        const Word period = tlbSize - 1;
+        Word i = (value >> RNDIDXOFFS) - 1;
+        i = (i + period - (Word) (ticks % period)) % period;
+        return (i + 1) << RNDIDXOFFS;
+    }
+
+    // No such simple pattern for odd TLB sizes
+    for (; ticks > 0; ticks--) {
+        value = (value - RANDOMSTEP) & top;
+        if (value < RANDOMBASE)
+            value = top;
+    }
+    return value;
 }
 
 // This method pushes the KU/IE and VM bit stacks in CP0 STATUS register to start
@@ -580,6 +1210,7 @@ void Processor::randomRegTick()
 void Processor::pushKUIEVMStack()
 {
     unsigned int bitp;
+    Word oldStatus = cpreg[STATUS];
 	
     // push the KUIE stack
     for (bitp = KUOBITPOS; bitp > KUCBITPOS; bitp--)
@@ -599,6 +1230,10 @@ void Processor::pushKUIEVMStack()
     cpreg[STATUS] = ResetBit(cpreg[STATUS], KUCBITPOS);
     cpreg[STATUS] = ResetBit(cpreg[STATUS], IECBITPOS);
     cpreg[STATUS] = ResetBit(cpreg[STATUS], VMCBITPOS);
+    updateIntPending();
+
+    if ((oldStatus ^ cpreg[STATUS]) & (STATUS_VMc | STATUS_KUc))
+        mappingChanged();
 }
 
 
@@ -607,6 +1242,7 @@ void Processor::pushKUIEVMStack()
 void Processor::popKUIEVMStack()
 {
     unsigned int bitp;
+    Word oldStatus = cpreg[STATUS];
 	
     for (bitp = IECBITPOS; bitp < IEOBITPOS; bitp++) {
         if (BitVal(cpreg[STATUS], bitp + 2))
@@ -621,6 +1257,10 @@ void Processor::popKUIEVMStack()
         else
             cpreg[STATUS] = ResetBit(cpreg[STATUS], bitp);
     }
+
+    if ((oldStatus ^ cpreg[STATUS]) & (STATUS_VMc | STATUS_KUc))
+        mappingChanged();
+    updateIntPending();
 }
 
 
@@ -643,13 +1283,25 @@ bool Processor::checkForInt()
     }
 }
 
+// This method recomputes intPending; it must be called whenever CAUSE
+// IP field or STATUS IEc bit and IM mask may have changed
+void Processor::updateIntPending()
+{
+    intPending = (cpreg[STATUS] & STATUS_IEc) &&
+        (cpreg[CAUSE] & cpreg[STATUS] & CAUSE_IP_MASK);
+}
+
 /**
  * Try to enter standby mode
  */
 void Processor::suspend()
 {
-    if (!(cpreg[CAUSE] & CAUSE_IP_MASK))
+    if (!(cpreg[CAUSE] & CAUSE_IP_MASK)) {
+        // Random stops counting (the current instruction is not
+        // counted in)
+        syncRandom(clock() - 1);
         setStatus(PS_IDLE);
+    }
 }
 
 // This method sets the appropriate CP0 registers at exception
@@ -661,6 +1313,9 @@ void Processor::handleExc()
     // prepares for exception handling (a small bubble...).
     completeLoad();
 
+    // Whatever loop was running, it has been left
+    spinReset();
+
     // set the excCode into CAUSE reg
     cpreg[CAUSE] = IM(cpreg[CAUSE]) | (excCode[excCause] << CAUSE_EXCCODE_BIT);
 
@@ -711,15 +1366,85 @@ void Processor::handleExc()
     }
 }
 
+// This method is called when the backward branch at currPC has just
+// been taken, closing a loop. The register state is compared with the
+// one of the last time the branch was taken: if nothing changed and
+// the loop did nothing but read memory, the processor is stuck until
+// something else changes memory or device registers
+void Processor::spinCheck()
+{
+    if (currPC - succPC >= kMaxSpinLength * WORDLEN)
+        return;
+
+    if (currPC != spinBranch) {
+        // A new loop: start watching it
+        spinReset();
+        spinBranch = currPC;
+        spinSnapshot();
+        return;
+    }
+
+    if (spinWait > 0) {
+        if (--spinWait == 0)
+            spinSnapshot();
+        return;
+    }
+
+    const uint64_t length = executedInstr - spinPassInstr;
+    if (!spinImpure && lastStore < spinPassTick && length <= kMaxSpinLength &&
+        loadPending == spinLoadPending && loadReg == spinLoadReg && loadVal == spinLoadVal &&
+        std::equal(gpr, gpr + kNumCPURegisters, spinGPR))
+    {
+        const bool detected = !spinStuck;
+        spinStuck = true;
+        spinLength = (uint32_t) length;
+        spinSince = spinPassTick;
+        spinConfirmInstr = executedInstr;
+        spinPassTick = clock();
+        spinPassInstr = executedInstr;
+        if (detected)
+            notify(NOTIFY_SPIN);
+    } else {
+        // Most loops do terminate: check this one less often
+        spinStuck = false;
+        spinBackoff = std::min(2 * spinBackoff + 1, kMaxSpinBackoff);
+        spinWait = spinBackoff;
+    }
+}
+
+// This method saves the state of the processor as it goes round the
+// watched loop
+void Processor::spinSnapshot()
+{
+    std::copy(gpr, gpr + kNumCPURegisters, spinGPR);
+    spinLoadPending = loadPending;
+    spinLoadReg = loadReg;
+    spinLoadVal = loadVal;
+    spinPassTick = clock();
+    spinPassInstr = executedInstr;
+    spinImpure = false;
+}
+
+// This method stops watching loops
+void Processor::spinReset()
+{
+    spinBranch = MAXWORDVAL;
+    spinImpure = true;
+    spinBackoff = 0;
+    spinWait = 0;
+    spinStuck = false;
+    spinLength = 0;
+}
+
 // This method zeroes out the TLB
 void Processor::zapTLB()
 {
     // Leave out the first entry ([0])
     for (size_t i = 1; i < tlbSize; ++i) {
-        tlb[i].setHI(0);
-        tlb[i].setLO(0);
-        SignalTLBChanged(i);
+        setTLBEntry(i, 0, 0);
+        notify(NOTIFY_TLB, i);
     }
+    mappingChanged();
 }
 
 // This method allows to handle the delayed load slot: it provides to load 
@@ -754,17 +1479,27 @@ void Processor::completeLoad()
         case CP0REG_TIMER:
             cpreg[CP0REG_TIMER] = (Word) loadVal;
             DeassertIRQ(IL_CPUTIMER);
+            startTimer(clock());
             break;
 
         case ENTRYHI:
-            // loadable parts are VPN and ASID fields
+            // loadable parts are VPN and ASID fields; only the latter
+            // affects address mapping
+            if ((cpreg[ENTRYHI] ^ (Word) loadVal) & ASIDMASK)
+                mappingChanged();
             cpreg[ENTRYHI] = ((Word) loadVal) & (VPNMASK | ASIDMASK);
             break;
 
         case STATUS:
             // loadable parts are CU0 bit, TE bit, BEV bit in DS, IM mask and
             // KUIE bit stack
+            if ((cpreg[STATUS] ^ (Word) loadVal) & (STATUS_VMc | STATUS_KUc))
+                mappingChanged();
+            // TE bit may start or stop the timer
+            syncTimer(clock());
             cpreg[STATUS] = ((Word) loadVal) & STATUSMASK;
+            startTimer(clock());
+            updateIntPending();
             break;
 
         case EPC:
@@ -788,16 +1523,45 @@ void Processor::completeLoad()
 // complex mapping algorithm and TLB used by MIPS (see external doc). 
 // It returns TRUE if conversion was not possible (this implies an exception
 // have been raised) and FALSE if conversion has taken place: physical value
-// for address conversion is returned thru paddr pointer.
+// for address conversion is returned thru paddr pointer, and if host is
+// not NULL the word location in RAM (or NULL) is returned thru it.
 // AccType details memory access type (READ/WRITE/EXECUTE)
-bool Processor::mapVirtual(Word vaddr, Word * paddr, Word accType)
+bool Processor::mapVirtual(Word vaddr, Word * paddr, Word accType, Word** host)
+{
+    // SignalProcVAccess() is always done so it is possible 
+    // to track accesses which produce exceptions
+    if (BitVal(cpreg[STATUS], VMCBITPOS))
+        machine->HandleVMAccess(ENTRYHI_GET_ASID(cpreg[ENTRYHI]), vaddr, accType, this);
+    else
+        machine->HandleVMAccess(MAXASID, vaddr, accType, this);
+
+    // Page translations only depend on mapGeneration, while address
+    // alignment has to be checked anyway
+    SoftTLBEntry* e = &softTLB[accType >> 1][(vaddr >> 12) & (kSoftTLBSize - 1)];
+    if (e->generation != mapGeneration || e->vpn != VPN(vaddr) || BADADDR(vaddr)) {
+        if (mapSlow(vaddr, paddr, accType))
+            return true;
+
+        // Any successful translation can be cached: writes to pages
+        // with D bit set to 0 never succeed
+        e->generation = mapGeneration;
+        e->vpn = VPN(vaddr);
+        e->pfn = VPN(*paddr);
+        e->host = bus->getRamPointer(e->pfn);
+    }
+
+    *paddr = e->pfn | (vaddr & OFFSETMASK);
+    if (host != NULL)
+        *host = (e->host != NULL) ? e->host + ((vaddr & OFFSETMASK) >> WORDSHIFT) : NULL;
+    return false;
+}
+
+// This method does the actual address translation for mapVirtual(),
+// bypassing the software TLB
+bool Processor::mapSlow(Word vaddr, Word * paddr, Word accType)
 {
     if (BitVal(cpreg[STATUS], VMCBITPOS)) {
         // VM is on
-	
-        // SignalProcVAccess() is always done so it is possible 
-        // to track accesses which produce exceptions
-        machine->HandleVMAccess(ENTRYHI_GET_ASID(cpreg[ENTRYHI]), vaddr, accType, this);
 
         // address validity and bounds check
         if (BADADDR(vaddr) || (InUserMode() && (vaddr < KUSEG2BASE))) {
@@ -862,10 +1626,6 @@ bool Processor::mapVirtual(Word vaddr, Word * paddr, Word accType)
         }	
     } else {
         // VM is off	
-		
-        // SignalProcVAccess() is always done so it is possible 
-        // to track accesses which produce exceptions
-        machine->HandleVMAccess(MAXASID, vaddr, accType, this);
 
         // address validity and bounds check
         if (BADADDR(vaddr) || (InUserMode() && (vaddr < KSEG0TOP))) {
@@ -888,6 +1648,56 @@ bool Processor::mapVirtual(Word vaddr, Word * paddr, Word accType)
     }
 }
 
+// This method must be called whenever the address mapping may have
+// changed; it invalidates the whole software TLB
+void Processor::mappingChanged()
+{
+    if (++mapGeneration == 0) {
+        // Generation counter wrapped around: stale entries would look
+        // valid again
+        flushSoftTLB();
+        mapGeneration = 1;
+        fetchGeneration = 0;
+    }
+}
+
+void Processor::flushSoftTLB()
+{
+    for (unsigned int t = 0; t < 3; t++)
+        for (unsigned int i = 0; i < kSoftTLBSize; i++)
+            softTLB[t][i].generation = 0;
+}
+
+// These methods read/write a data word at physical address paddr. If
+// host is not NULL it points to the word in RAM, which is accessed
+// directly instead of going through SystemBus. They return TRUE if an
+// exception was caused, FALSE otherwise
+bool Processor::memRead(Word paddr, const Word* host, Word* datap)
+{
+    if (host == NULL) {
+        // Bus registers include the clock and the interval timer
+        if (paddr >= MMIO_BASE && paddr < DEV_REG_START)
+            spinImpure = true;
+        return bus->DataRead(paddr, datap, this);
+    }
+
+    machine->HandleBusAccess(paddr, READ, this);
+    *datap = *host;
+    return false;
+}
+
+bool Processor::memWrite(Word paddr, Word* host, Word data)
+{
+    lastStore = clock();
+    if (host == NULL)
+        return bus->DataWrite(paddr, data, this);
+
+    machine->HandleBusAccess(paddr, WRITE, this);
+    *host = data;
+    decodeCache->Invalidate(paddr);
+    return false;
+}
+
 // This method sets the CP0 special registers on exceptions forced by TLB
 // handling (see mapVirtual() for invocation/specific cases).
 void Processor::setTLBRegs(Word vaddr)
@@ -897,244 +1707,264 @@ void Processor::setTLBRegs(Word vaddr)
     cpreg[ENTRYHI] = VPN(vaddr) | ASID(cpreg[ENTRYHI]);
 }
 
-// This method make Processor execute a single MIPS instruction, emulating
-// pipeline constraints and load delay slots (see external doc).
-bool Processor::execInstr(Word instr)
-{
-    Word temp;
-    unsigned int i, cp0Num;
-    bool error = false;
-    bool isValidBranch = false;
-
-    switch (OpType(instr)) {
-    case REGTYPE:
-        // MIPS register-type instruction execution
-        error = execRegInstr(&temp, instr, &isValidBranch);
-
-        // delayed load is completed _after_ istruction execution, but
-        // _before_ instruction result is moved to target register
-        completeLoad();
-
-        if (!error && RD(instr))
-            // no errors & target register != r0: put instruction result 
-            // into target register
-            gpr[RD(instr)] = (SWord) temp;
-        break;
+// This method fetches the instruction at currPC, mapping it to a
+// physical address and reading it from the bus; on failure, the
+// current instruction is nullified and the exception is handled
+void Processor::fetch()
+{
+    fetchGeneration = mapGeneration;
+
+    if (mapVirtual(currPC, &currPhysPC, EXEC)) {
+        // TLB or Address exception caused: current instruction is nullified
+        currInstr = NOP;
+        handleExc();
+    } else if (bus->InstrRead(currPhysPC, &currInstr, this)) {
+        // IBE exception caused: current instruction is nullified
+        currInstr = NOP;
+        handleExc();
+    }
+    decodeCurrInstr();
+}
+
+// This method tries to fetch the instruction at currPC by following the
+// straight-line code of the previous one through the decode cache. This
+// is possible when currPC is the next word in the same frame, nothing
+// changed the address mapping since the last full fetch and no
+// breakpoint could be hit. Mapping and bus access would then give
+// the same result with no side effects, so they are skipped. Returns
+// TRUE on success, FALSE if a full fetch is needed
+bool Processor::fetchChained()
+{
+    if (currSlot == NULL ||
+        currPC != prevPC + WORDLEN ||
+        (currPC & (FRAMESIZE * WORDLEN - 1)) == 0 ||
+        fetchGeneration != mapGeneration ||
+        machine->DebugHooksEnabled())
+    {
+        return false;
+    }
 
-    case IMMTYPE:
-        // MIPS immediate-type instruction
-        error = execImmInstr(&temp, instr);
+    // The slot may have been emptied by a memory write, or it may lie
+    // past the end of a ROM area
+    DecodedInstr* next = currSlot + 1;
+    if (!DecodeCache::Read(next, &currDecoded))
+        return false;
 
-        // delayed load is completed _after_ istruction execution, but
-        // _before_ instruction result is moved to target register
-        completeLoad();
+    currSlot = next;
+    currPhysPC = prevPhysPC + WORDLEN;
+    currInstr = currDecoded.instr;
+    return true;
+}
 
-        if (!error && RT(instr))
-            // no errors & target register != r0: put instruction result
-            // into target register
-            gpr[RT(instr)] = (SWord) temp;
-        break;
+// This method sets currDecoded to the decoded form of currInstr. Words
+// fetched from RAM or ROM are decoded once and then served from the
+// decode cache; anything else is decoded on the spot
+void Processor::decodeCurrInstr()
+{
+    DecodedInstr* di = decodeCache->Lookup(currPhysPC);
+
+    // The slot may be out of date if another processor running in
+    // parallel has rewritten the word meanwhile
+    currSlot = di;
+    if (di != NULL && DecodeCache::Read(di, &currDecoded) && currDecoded.instr == currInstr)
+        return;
 
-    case BRANCHTYPE:
-        // MIPS branch-type instruction
-        error = execBranchInstr(instr, &isValidBranch);
+    decode(currInstr, &currDecoded);
+    if (di == NULL)
+        return;
+    DecodeCache::Fill(di, currDecoded);
+
+    // A processor running in parallel may also rewrite the word after
+    // it was fetched here, and empty the slot before it is filled. The
+    // word is then read again once the slot is filled: either the new
+    // contents show, or the emptying comes after the filling
+    if (bus->InQuantum()) {
+        __sync_synchronize();
+        const Word* word = bus->getRamPointer(currPhysPC);
+        if (word != NULL && *word != currInstr)
+            decodeCache->Invalidate(currPhysPC);
+    }
+}
 
-        // delayed load is completed just after instruction execution
-        completeLoad();
+// This method decodes a MIPS instruction, selecting the handler that
+// executes it and extracting its operands. Ill-formed instructions are
+// decoded to handlers which raise the appropriate exception, so the
+// decoder itself never fails
+void Processor::decode(Word instr, DecodedInstr* di)
+{
+    unsigned int op = opcodeTable[OPCODE(instr)];
+    unsigned int cp0Num;
+
+    di->instr = instr;
+    di->rs = RS(instr);
+    di->rt = RT(instr);
+    di->rd = RD(instr);
+    di->shamt = SHAMT(instr);
+
+    // Secondary tables lookup, and checks on fields which are required
+    // to be zero
+    switch (op) {
+    case OP_SPECIAL:
+        op = InvalidRegInstr(instr) ? (uint8_t) OP_RESERVED : functTable[FUNCT(instr)];
         break;
 
-    case COPTYPE:
-        // MIPS coprocessor-type instruction
-
-        // Some simulation issues:
-        // CP0 is built-in and its Cp0Cond condition line is always
-        // FALSE; other coprocessors are hard-wired to
-        // non-availability 
-
-        // detects coprocessor referred
-        if (OPCODE(instr) == COP0SEL && cp0Usable()) {
-            // COPOPTYPE corresponds to RS field
-            switch(COPOPTYPE(instr)) {
-            case CO0:
-                // coprocessor 0 operations
-                if (RT(instr) || RD(instr) || SHAMT(instr)) {
-                    // instruction is ill-formed: exception signaled
-                    // is CPU to help detection cause
-                    SignalExc(CPUEXCEPTION, 0);
-                    error = true;
-                } else {
-                    // all instructions follow MIPS guidelines
-                    switch(FUNCT(instr)) {
-                    case RFE:
-                        popKUIEVMStack();
-                        break;
-
-                    case TLBP: 
-                        // solution "by the book"
-                        cpreg[INDEX] = SIGNMASK;
-                        if (probeTLB(&i, cpreg[ENTRYHI], cpreg[ENTRYHI]))
-                            cpreg[INDEX] = (i << RNDIDXOFFS);
-                        break;
-
-                    case TLBR:
-                        cpreg[ENTRYHI] = tlb[RNDIDX(cpreg[INDEX])].getHI();
-                        cpreg[ENTRYLO] = tlb[RNDIDX(cpreg[INDEX])].getLO();
-                        break;	
-
-                    case TLBWI:
-                        tlb[RNDIDX(cpreg[INDEX])].setHI(cpreg[ENTRYHI]);
-                        tlb[RNDIDX(cpreg[INDEX])].setLO(cpreg[ENTRYLO]);
-                        SignalTLBChanged(RNDIDX(cpreg[INDEX]));
-                        break;
-
-                    case TLBWR:
-                        tlb[RNDIDX(cpreg[RANDOM])].setHI(cpreg[ENTRYHI]);
-                        tlb[RNDIDX(cpreg[RANDOM])].setLO(cpreg[ENTRYLO]);
-                        SignalTLBChanged(RNDIDX(cpreg[INDEX]));
-                        break;
-
-                    case COFUN_WAIT:
-                        suspend();
-                        break;
-
-                    default:
-                        // unknown coprocessor 0 operation requested
-                        SignalExc(CPUEXCEPTION, 0);
-                        error = true;
-                        break;
-                    }
-                }
-                // delayed load is completed after instruction execution
-                completeLoad();
-                break;
+    case OP_REGIMM:
+        // uses RT field to choose which branch type is requested
+        op = regimmTable[RT(instr)];
+        break;
 
-            case BC0:
-                switch(COPOPCODE(instr))
-                {
-                case BC0F:	
-                    // condition line for CP0 is always FALSE
-                    succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-                    isValidBranch = true;
-                    break;
-
-                case BC0T:
-                    // condition line for CP0 is always FALSE
-                    // so this is a nop instruction
-                    isValidBranch = true;
-                    break;
-
-                default:
-                    // traps BC0FL R4000 instructions
-                    // and the like...
-                    SignalExc(CPUEXCEPTION, 0);
-                    error = true;
-                    break;
-                }
-                completeLoad();
-                break;
+    case OP_BGTZ:
+    case OP_BLEZ:
+        if (RT(instr))
+            op = OP_RESERVED;
+        break;
 
-            case MFC0:
-                // delayed load is completed _before_ istruction
-                // execution since instruction itself produces a
-                // delayed load
-                completeLoad();
-	
-                // valid instruction has SHAMT and FUNCT fields
-                // set to 0, and refers to a valid CP0 register
-                if (ValidCP0Reg(RD(instr), &cp0Num) && !SHAMT(instr) && !FUNCT(instr)) {
-                    setLoad(LOAD_TARGET_GPREG, RT(instr), (SWord) cpreg[cp0Num]);
-                } else {
-                    // invalid instruction format or CP0 reg 
-                    SignalExc(CPUEXCEPTION, 0);
-                    error = true;
-                }
-                break;
+    case OP_LUI:
+        if (RS(instr))
+            op = OP_RESERVED;
+        break;
 
-            case MTC0:
-                // delayed load is completed _before_ istruction
-                // execution since instruction itself produces a
-                // delayed load
-                completeLoad();
-	
-                // valid instruction has SHAMT and FUNCT fields
-                // set to 0, and refers to a valid CP0 register
-                if (ValidCP0Reg(RD(instr), &cp0Num) && !SHAMT(instr) && !FUNCT(instr))
-                    setLoad(LOAD_TARGET_CPREG, cp0Num, gpr[RT(instr)]);
-                else 
-                {
-                    // check if it is TLBCLR backpatch
-                    if (RD(instr) == CONTEXTREG && !SHAMT(instr) && !FUNCT(instr))
-                        zapTLB();
-                    else 
-                    {
-                        // invalid instruction
-                        SignalExc(CPUEXCEPTION, 0);
-                        error = true;
-                    }
-                }
-                break;
+    case OP_COP0:
+        // Ill-formed CP0 instructions raise a CPU exception, to help
+        // detection cause; COPOPTYPE corresponds to RS field
+        op = OP_COPUNUSABLE;
+        switch (COPOPTYPE(instr)) {
+        case CO0:
+            if (!RT(instr) && !RD(instr) && !SHAMT(instr))
+                op = co0Table[FUNCT(instr)];
+            break;
 
-            default:
-                // unknown and CFC0, CTC0, COP0, LWC0 generic instructions
-                SignalExc(CPUEXCEPTION, 0);
-                error = true;
+        case BC0:
+            // BC0FL R4000 instructions and the like are trapped
+            if (COPOPCODE(instr) == BC0F)
+                op = OP_BC0F;
+            else if (COPOPCODE(instr) == BC0T)
+                op = OP_BC0T;
+            break;
+
+        case MFC0:
+        case MTC0:
+            // valid instruction has SHAMT and FUNCT fields set to 0,
+            // and refers to a valid CP0 register
+            if (SHAMT(instr) || FUNCT(instr))
                 break;
+            if (ValidCP0Reg(RD(instr), &cp0Num)) {
+                op = (COPOPTYPE(instr) == MFC0) ? OP_MFC0 : OP_MTC0;
+                di->rd = cp0Num;
+            } else if (COPOPTYPE(instr) == MTC0 && RD(instr) == CONTEXTREG) {
+                // TLBCLR backpatch
+                op = OP_CLRTLB;
             }
-        } else {
-            // coprocessor 0 (or other) unusable
-            SignalExc(CPUEXCEPTION, COPNUM(instr));
-            error = true;
+            break;
+
+        default:
+            // unknown and CFC0, CTC0, COP0, LWC0 generic instructions
+            break;
         }
         break;
 
-    case LOADTYPE:
-        // MIPS load instruction
-
-        // delayed load is completed _before_ istruction execution since
-        // instruction itself produces a delayed load
-        completeLoad();
-
-        error = execLoadInstr(instr);
+    default:
         break;
+    }
 
-    case STORETYPE:
-        // MIPS store instruction
-
-        // delayed load is completed _before_ istruction execution
-        // since it happens "logically" so in the pipeline
-        completeLoad();
+    di->op = op;
+    di->isBranch = instrInfo[op].isBranch;
 
-        error = execStoreInstr(instr);
+    switch (instrInfo[op].imm) {
+    case IMM_SIGNED:
+        di->imm = SignExtImm(instr);
+        break;
+    case IMM_ZERO:
+        di->imm = ZEXTIMM(instr);
+        break;
+    case IMM_UPPER:
+        di->imm = ZEXTIMM(instr) << HWORDLEN;
+        break;
+    case IMM_OFFSET:
+        // branch offsets are kept in bytes
+        di->imm = SignExtImm(instr) << WORDSHIFT;
+        break;
+    case IMM_TARGET:
+        di->imm = (instr & ~(OPCODEMASK)) << WORDSHIFT;
         break;
+    case IMM_NONE:
+    default:
+        di->imm = 0;
+        break;
+    }
+}
 
-    case LOADCOPTYPE:
-    case STORECOPTYPE:
-        if (BitVal(instr, DWCOPBITPOS))
-            // LDC, SDC reserved instructions handling
-            SignalExc(RIEXCEPTION);
-        else
-            SignalExc(CPUEXCEPTION, COPNUM(instr));
-        error = true;
+// This method make Processor execute a single MIPS instruction, emulating
+// pipeline constraints and load delay slots (see external doc).
+bool Processor::execInstr(const DecodedInstr& di)
+{
+    bool error;
+
+#ifdef THREADED_DISPATCH
+    static const void* const dispatchTable[] = {
+        &&L_OP_EMPTY,
+#define INSTR_LABEL(op, handler, imm, branch) &&L_##op,
+        PROCESSOR_INSTRUCTIONS(INSTR_LABEL)
+#undef INSTR_LABEL
+    };
+
+    goto *dispatchTable[di.op];
+
+#define INSTR_CASE(op, handler, imm, branch)    \
+    L_##op:                                     \
+        error = handler(di);                    \
+        goto dispatched;
+    PROCESSOR_INSTRUCTIONS(INSTR_CASE)
+#undef INSTR_CASE
+
+L_OP_EMPTY:
+    AssertNotReached();
+    error = execReserved(di);
+
+dispatched:
+#else
+    switch (di.op) {
+#define INSTR_CASE(op, handler, imm, branch)    \
+    case op:                                    \
+        error = handler(di);                    \
         break;
+    PROCESSOR_INSTRUCTIONS(INSTR_CASE)
+#undef INSTR_CASE
 
     default:
-        // unknown instruction (generic)
-        SignalExc(RIEXCEPTION);
-        error = true;
+        AssertNotReached();
+        error = execReserved(di);
         break;
     }
+#endif
 
     // Branch delay slot handling: if the instruction generated an
     // exception, isBranchD is _not_ modified, since the exception
     // handler needs it; otherwise, the next instruction is a BD slot
     // if the current instruction is a valid branch.
     if (!error)
-        isBranchD = isValidBranch;
+        isBranchD = di.isBranch;
 
     return error;
 }
 
-// This method tests for CP0 availability (as set in STATUS register and in
+// This method completes the instruction writing its result into the
+// target register: delayed load is completed _after_ istruction
+// execution, but _before_ instruction result is moved to target
+// register. It always returns FALSE, so handlers may just return its
+// result
+bool Processor::writeBack(unsigned int reg, Word value)
+{
+    completeLoad();
+
+    // register $0 is read-only
+    if (reg)
+        gpr[reg] = (SWord) value;
+
+    return false;
+}
+
+// This method tests for CP0 availability (as set in STATUS register and in
 // MIPS conventions)
 bool Processor::cp0Usable()
 {
@@ -1142,21 +1972,67 @@ bool Processor::cp0Usable()
     return BitVal(cpreg[STATUS], STATUS_CU0_BIT) || !BitVal(cpreg[STATUS], STATUS_KUc_BIT);
 }
 
-// This method scans the TLB looking for a entry that matches ASID/VPN pair;
+// This method searches the TLB for an entry that matches ASID/VPN pair;
 // scan algorithm follows MIPS specifications, and returns the _highest_
 // entry that matches
 bool Processor::probeTLB(unsigned int* index, Word asid, Word vpn)
 {
     bool found = false;
 
-    for (unsigned int i = 0; i < tlbSize; i++) {
-        if (tlb[i].VPNMatch(vpn) && (tlb[i].IsG() || tlb[i].ASIDMatch(asid))) {
+    // Only entries in the bucket for vpn may match; as with a full
+    // scan, the highest matching index wins
+    for (unsigned int i = tlbBucket[tlbHash(vpn)]; i != kNoTLBEntry; i = tlbNext[i]) {
+        if (tlb[i].VPNMatch(vpn) && (tlb[i].IsG() || tlb[i].ASIDMatch(asid)) &&
+            (!found || i > *index))
+        {
             found = true;
             *index = i;
         }
     }
 
     return found;
+}
+
+// This method sets the contents of TLB entry at index, keeping the TLB
+// hash index up to date
+void Processor::setTLBEntry(unsigned int index, Word hi, Word lo)
+{
+    if (VPN(tlb[index].getHI()) != VPN(hi)) {
+        tlbIndexRemove(index);
+        tlb[index].setHI(hi);
+        tlbIndexInsert(index);
+    } else {
+        tlb[index].setHI(hi);
+    }
+    tlb[index].setLO(lo);
+}
+
+// This method returns the TLB hash index bucket for the VPN part of
+// vpn (Fibonacci hashing of the page number)
+unsigned int Processor::tlbHash(Word vpn) const
+{
+    return ((Word) ((VPN(vpn) >> 12) * 0x9E3779B1UL)) >> (32 - tlbHashBits);
+}
+
+void Processor::tlbIndexInsert(unsigned int index)
+{
+    unsigned int b = tlbHash(tlb[index].getHI());
+
+    tlbPrev[index] = kNoTLBEntry;
+    tlbNext[index] = tlbBucket[b];
+    if (tlbBucket[b] != kNoTLBEntry)
+        tlbPrev[tlbBucket[b]] = index;
+    tlbBucket[b] = index;
+}
+
+void Processor::tlbIndexRemove(unsigned int index)
+{
+    if (tlbPrev[index] != kNoTLBEntry)
+        tlbNext[tlbPrev[index]] = tlbNext[index];
+    else
+        tlbBucket[tlbHash(tlb[index].getHI())] = tlbNext[index];
+    if (tlbNext[index] != kNoTLBEntry)
+        tlbPrev[tlbNext[index]] = tlbPrev[index];
 }		
 
 // This method sets delayed load handling variables when needed by
@@ -1294,572 +2170,745 @@ Word Processor::merge(Word dest, Word src, unsigned int bytep, bool loadBig, boo
 }
 		
 
-// This method executes a MIPS register-type instruction, following MIPS
-// guidelines; returns instruction result thru res pointer, and branch delay
-// slot indication if needed (due to JR/JALR presence). It also returns TRUE
-// if an exception occurred, FALSE otherwise
-bool Processor::execRegInstr(Word * res, Word instr, bool * isBD)
+//
+// Instruction handlers: register-type instructions
+//
+
+bool Processor::execADD(const DecodedInstr& di)
 {
-    bool error = false;
-    Word paddr;
-    bool atomic;
+    Word res;
 
-    *isBD = false;
-
-    error = InvalidRegInstr(instr);
-    if (!error) {
-        // instruction format is correct		
-        switch (FUNCT(instr)) {
-        case SFN_ADD:
-            if (SignAdd(res, gpr[RS(instr)], gpr[RT(instr)]))
-            {
-                SignalExc(OVEXCEPTION);
-                error = true;
-            }
-            break;
+    if (SignAdd(&res, gpr[di.rs], gpr[di.rt])) {
+        SignalExc(OVEXCEPTION);
+        return true;
+    }
+    return writeBack(di.rd, res);
+}
 
-        case SFN_ADDU:
-            *res = gpr[RS(instr)] + gpr[RT(instr)];
-            break;
-		
-        case SFN_AND:
-            *res = gpr[RS(instr)] & gpr[RT(instr)];
-            break;
-			
-        case SFN_BREAK:
-            SignalExc(BPEXCEPTION);
-            error = true;
-            break;
-			
-        case SFN_DIV:
-            if (gpr[RT(instr)] != 0)
-            {
-                gpr[LO] = gpr[RS(instr)] / gpr[RT(instr)];
-                gpr[HI] = gpr[RS(instr)] % gpr[RT(instr)];
-            }
-            else
-            {
-                // divisor is zero
-                gpr[LO] = MAXWORDVAL;
-                gpr[HI] = 0;
-            }
-            break;
-					
-        case SFN_DIVU:
-            if (gpr[RT(instr)] != 0)
-            {
-                gpr[LO] = ((Word) gpr[RS(instr)]) / ((Word) gpr[RT(instr)]);
-                gpr[HI] = ((Word) gpr[RS(instr)]) % ((Word) gpr[RT(instr)]);
-            }
-            else
-            {
-                // divisor is zero
-                gpr[LO] = MAXWORDVAL;
-                gpr[HI] = 0;
-            }
-            break;
-				
-        case SFN_JALR:
-            // solution "by the book"
-            succPC = gpr[RS(instr)];
-            *res = currPC + (2 * WORDLEN);
-            *isBD = true;
-            // alternative: *res = succPC; succPC = gpr[RS(instr)]
-            break;
+bool Processor::execADDU(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[di.rs] + gpr[di.rt]);
+}
 
-        case SFN_JR:
-            succPC = gpr[RS(instr)];
-            *isBD = true;
-            break;
-				
-        case SFN_MFHI:
-            *res = gpr[HI];
-            break;
-				
-        case SFN_MFLO:
-            *res = gpr[LO];
-            break;
-					
-        case SFN_MTHI:
-            gpr[HI] = gpr[RS(instr)];
-            break;
-				
-        case SFN_MTLO:
-            gpr[LO] = gpr[RS(instr)];
-            break;	
-				
-        case SFN_MULT:
-            SignMult(gpr[RS(instr)], gpr[RT(instr)], &(gpr[HI]), &(gpr[LO]));
-            break;				
-				
-        case SFN_MULTU:
-            UnsMult((Word) gpr[RS(instr)], (Word) gpr[RT(instr)], (Word *)&(gpr[HI]), (Word *)&(gpr[LO]));
-            break;
-				
-        case SFN_NOR:
-            *res = ~(gpr[RS(instr)] | gpr[RT(instr)]);
-            break;
-				
-        case SFN_OR:
-            *res = gpr[RS(instr)] | gpr[RT(instr)];
-            break;
-				
-        case SFN_SLL:
-            *res = gpr[RT(instr)] << SHAMT(instr);
-            break;
-				
-        case SFN_SLLV:
-            *res = gpr[RT(instr)] << REGSHAMT(gpr[RS(instr)]);	
-            break;
-					
-        case SFN_SLT:
-            if (gpr[RS(instr)] < gpr[RT(instr)])
-                *res = 1UL;
-            else
-                *res = 0UL;
-            break;
+bool Processor::execAND(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[di.rs] & gpr[di.rt]);
+}
 
-        case SFN_SLTU:
-            if (((Word) gpr[RS(instr)]) < ((Word) gpr[RT(instr)]))
-                *res = 1UL;
-            else
-                *res = 0UL;
-            break;
-				
-        case SFN_SRA:
-            *res = (gpr[RT(instr)] >> SHAMT(instr));
-            break;
-				
-        case SFN_SRAV:
-            *res = (gpr[RT(instr)] >> REGSHAMT(gpr[RS(instr)]));
-            break;
-				
-        case SFN_SRL:
-            *res = (((Word) gpr[RT(instr)]) >> SHAMT(instr));	
-            break;
-					
-        case SFN_SRLV:
-            *res = (((Word) gpr[RT(instr)]) >> REGSHAMT(gpr[RS(instr)]));
-            break;
+bool Processor::execBREAK(const DecodedInstr& di)
+{
+    UNUSED_ARG(di);
+    SignalExc(BPEXCEPTION);
+    return true;
+}
 
-        case SFN_SUB:
-            if (SignSub(res, gpr[RS(instr)], gpr[RT(instr)]))
-            {
-                SignalExc(OVEXCEPTION);
-                error = true;
-            }
-            break;
+bool Processor::execDIV(const DecodedInstr& di)
+{
+    if (gpr[di.rt] != 0) {
+        gpr[LO] = gpr[di.rs] / gpr[di.rt];
+        gpr[HI] = gpr[di.rs] % gpr[di.rt];
+    } else {
+        // divisor is zero
+        gpr[LO] = MAXWORDVAL;
+        gpr[HI] = 0;
+    }
+    completeLoad();
+    return false;
+}
 
-        case SFN_SUBU:
-            *res = gpr[RS(instr)] - gpr[RT(instr)];
-            break;
+bool Processor::execDIVU(const DecodedInstr& di)
+{
+    if (gpr[di.rt] != 0) {
+        gpr[LO] = ((Word) gpr[di.rs]) / ((Word) gpr[di.rt]);
+        gpr[HI] = ((Word) gpr[di.rs]) % ((Word) gpr[di.rt]);
+    } else {
+        // divisor is zero
+        gpr[LO] = MAXWORDVAL;
+        gpr[HI] = 0;
+    }
+    completeLoad();
+    return false;
+}
 
-        case SFN_SYSCALL:
-            SignalExc(SYSEXCEPTION);
-            error = true;
-            break;
+bool Processor::execJALR(const DecodedInstr& di)
+{
+    // solution "by the book"
+    // alternative: *res = succPC; succPC = gpr[RS(instr)]
+    succPC = gpr[di.rs];
+    return writeBack(di.rd, currPC + (2 * WORDLEN));
+}
 
-        case SFN_XOR:
-            *res = gpr[RS(instr)] ^ gpr[RT(instr)];
-            break;
+bool Processor::execJR(const DecodedInstr& di)
+{
+    succPC = gpr[di.rs];
+    completeLoad();
+    return false;
+}
 
-        case SFN_CAS:
-            if (mapVirtual(gpr[RS(instr)], &paddr, WRITE) ||
-                bus->CompareAndSet(paddr, gpr[RT(instr)], gpr[RD(instr)], &atomic, this))
-                error = true;
-            else
-                *res = atomic;
-            break;
+bool Processor::execMFHI(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[HI]);
+}
 
-        default:
-            // unknown instruction
-            SignalExc(RIEXCEPTION);			
-            error = true;
-        }
-    } else {
-        // istruction is ill-formed
-        SignalExc(RIEXCEPTION);
-    }
+bool Processor::execMFLO(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[LO]);
+}
 
-    return error;
+bool Processor::execMTHI(const DecodedInstr& di)
+{
+    gpr[HI] = gpr[di.rs];
+    completeLoad();
+    return false;
 }
 
-// This method executes a MIPS immediate-type instruction, following MIPS
-// guidelines; returns instruction result thru res pointer. It also returns
-// TRUE if an exception occurred, FALSE otherwise
-bool Processor::execImmInstr(Word * res, Word instr)
+bool Processor::execMTLO(const DecodedInstr& di)
 {
-    bool error = false;
-	
-    switch(OPCODE(instr))
-    {
-    case ADDI:
-        if (SignAdd(res, gpr[RS(instr)], SignExtImm(instr)))
-        {
-            SignalExc(OVEXCEPTION);
-            error = true;
-        }
-        break;
-		
-    case ADDIU:
-        *res = gpr[RS(instr)] + SignExtImm(instr);
-        break;
-		
-    case ANDI:
-        *res = gpr[RS(instr)] & ZEXTIMM(instr);
-        break;
-		
-    case LUI:
-        if (!RS(instr))
-            *res = (ZEXTIMM(instr) << HWORDLEN);
-        else
-        {
-            // instruction is ill-formed
-            SignalExc(RIEXCEPTION);
-            error = true;
-        }
-        break;
-			
-    case ORI:
-        *res = gpr[RS(instr)] | ZEXTIMM(instr);
-        break;
-			
-    case SLTI:
-        if (gpr[RS(instr)] < SignExtImm(instr))
-            *res = 1UL;
-        else
-            *res = 0UL;
-        break;
-		
-    case SLTIU:
-        if (((Word) gpr[RS(instr)]) < ((Word) SignExtImm(instr)))
-            *res = 1UL;
-        else
-            *res = 0UL;
-        break;
+    gpr[LO] = gpr[di.rs];
+    completeLoad();
+    return false;
+}
 
-    case XORI:
-        *res = gpr[RS(instr)] ^ ZEXTIMM(instr);
-        break;
-			
-    default:
-        SignalExc(RIEXCEPTION);
-        error = true;
-        break;	
-    }
-    return(error);
+bool Processor::execMULT(const DecodedInstr& di)
+{
+    SignMult(gpr[di.rs], gpr[di.rt], &(gpr[HI]), &(gpr[LO]));
+    completeLoad();
+    return false;
 }
 
+bool Processor::execMULTU(const DecodedInstr& di)
+{
+    UnsMult((Word) gpr[di.rs], (Word) gpr[di.rt], (Word *)&(gpr[HI]), (Word *)&(gpr[LO]));
+    completeLoad();
+    return false;
+}
 
-// This method executes a MIPS branch-type instruction, following MIPS
-// guidelines; returns instruction result thru res pointer, and branch delay
-// slot indication if needed. It also returns TRUE if an exception occurred,
-// FALSE otherwise
-bool Processor::execBranchInstr(Word instr, bool* isBD)
+bool Processor::execNOR(const DecodedInstr& di)
 {
-    bool error = false;
-	
-    switch (OPCODE(instr))
-    {
-    case BEQ:
-        if (gpr[RS(instr)] == gpr[RT(instr)])
-            succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-        break;
+    return writeBack(di.rd, ~(gpr[di.rs] | gpr[di.rt]));
+}
 
-    case BGL:
-        // uses RT field to choose which branch type is requested
-        switch (RT(instr))
-        {
-        case BGEZ:
-            if (!SIGNBIT(gpr[RS(instr)]))
-                succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-            break;
-				
-        case BGEZAL:
-            // solution "by the book"; alternative: gpr[..] = succPC 
-            gpr[LINKREG] = currPC + (2 * WORDLEN);
-            if (!SIGNBIT(gpr[RS(instr)]))
-                succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-            break;						
-				
-        case BLTZ:
-            if (SIGNBIT(gpr[RS(instr)]))
-                succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-            break;		
-				
-        case BLTZAL:
-            gpr[LINKREG] = currPC + (2 * WORDLEN);
-            if (SIGNBIT(gpr[RS(instr)]))
-                succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-            break;							
-					
-        default:
-            // unknown instruction
-            SignalExc(RIEXCEPTION);
-            error = true;
-            break;
-        }
-        break;
-						
-    case BGTZ:
-        if (!RT(instr))
-        {
-            // instruction is well formed
-            if (gpr[RS(instr)] > 0)
-                succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-        }
-        else
-        {
-            // istruction is ill-formed
-            SignalExc(RIEXCEPTION);
-            error = true;
-        }
-        break;
-			
-    case BLEZ:
-        if (!RT(instr))
-        {
-            // instruction is well formed
-            if (gpr[RS(instr)] <= 0)
-                succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-        }
-        else 
-        {
-            // istruction is ill-formed
-            SignalExc(RIEXCEPTION);
-            error = true;
-        }
-        break;
-		
-    case BNE:
-        if (gpr[RS(instr)] != gpr[RT(instr)])
-            succPC = nextPC + (SignExtImm(instr) << WORDSHIFT);
-        break;
-			
-    case J:
-        succPC = JUMPTO(nextPC, instr);	
-        break;
-			
-    case JAL:
-        // solution "by the book": alt. gpr[..] = succPC
-        gpr[LINKREG] = currPC + (2 * WORDLEN);
-        succPC = JUMPTO(nextPC, instr);
-        break;
-					
-    default:
-        SignalExc(RIEXCEPTION);
-        error = true;
-        break;
-    }
+bool Processor::execOR(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[di.rs] | gpr[di.rt]);
+}
+
+bool Processor::execSLL(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[di.rt] << di.shamt);
+}
 
-    // Next instruction is BD slot, unless an exception occurred
-    *isBD = !error;
+bool Processor::execSLLV(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[di.rt] << REGSHAMT(gpr[di.rs]));
+}
 
-    return error;
+bool Processor::execSLT(const DecodedInstr& di)
+{
+    return writeBack(di.rd, (gpr[di.rs] < gpr[di.rt]) ? 1UL : 0UL);
 }
 
+bool Processor::execSLTU(const DecodedInstr& di)
+{
+    return writeBack(di.rd, (((Word) gpr[di.rs]) < ((Word) gpr[di.rt])) ? 1UL : 0UL);
+}
 
-// This method executes a MIPS load-type instruction, following MIPS
-// guidelines. It returns TRUE if an exception occurred, FALSE
-// otherwise.
-bool Processor::execLoadInstr(Word instr)
+bool Processor::execSRA(const DecodedInstr& di)
 {
-    Word paddr, vaddr, temp;
-    bool error = false;
-	
-    switch (OPCODE(instr)) {
-    case LB:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-
-        // reads the full word from bus and then extracts the byte
-        if (!mapVirtual(ALIGN(vaddr), &paddr, READ) && !bus->DataRead(paddr, &temp, this))
-            setLoad(LOAD_TARGET_GPREG, RT(instr), signExtByte(temp, BYTEPOS(vaddr)));
-        else 
-            // exception signaled: rt not loadable
-            error = true;
-        break;
+    return writeBack(di.rd, gpr[di.rt] >> di.shamt);
+}
 
-    case LBU: 
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-			
-        // reads the full word from bus and then extracts the byte
-        if (!mapVirtual(ALIGN(vaddr), &paddr, READ) && !bus->DataRead(paddr, &temp, this))
-            setLoad(LOAD_TARGET_GPREG, RT(instr), (SWord) zExtByte(temp, BYTEPOS(vaddr)));
-        else
-            // exception signaled: rt not loadable
-            error = true;
-        break;
-			
-    case LH:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (BitVal(vaddr, 0))
-        {
-            // unaligned halfword
-            SignalExc(ADELEXCEPTION);
-            error = true;
-        }
-        else
-            // reads the full word from bus and then extracts the halfword
-            if (!mapVirtual(ALIGN(vaddr), &paddr, READ) && !bus->DataRead(paddr, &temp, this))
-                setLoad(LOAD_TARGET_GPREG, RT(instr), signExtHWord(temp, HWORDPOS(vaddr)));
-            else
-                // exception signaled: rt not loadable
-                error = true;
-        break;
-					
-    case LHU:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (BitVal(vaddr, 0))
-        {
-            // unaligned halfword
-            SignalExc(ADELEXCEPTION);
-            error = true;
-        }
-        else
-            // reads the full word from bus and then extracts the halfword
-            if (!mapVirtual(ALIGN(vaddr), &paddr, READ) && !bus->DataRead(paddr, &temp, this))
-                setLoad(LOAD_TARGET_GPREG, RT(instr), (SWord) zExtHWord(temp, HWORDPOS(vaddr)));
-            else
-                // exception signaled: rt not loadable
-                error = true;
-        break;
-		
-    case LW:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (!mapVirtual(vaddr, &paddr, READ) && !bus->DataRead(paddr, &temp, this))
-            setLoad(LOAD_TARGET_GPREG, RT(instr), (SWord) temp);
-        else
-            // exception signaled: rt not loadable
-            error = true;
-        break;
+bool Processor::execSRAV(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[di.rt] >> REGSHAMT(gpr[di.rs]));
+}
+
+bool Processor::execSRL(const DecodedInstr& di)
+{
+    return writeBack(di.rd, ((Word) gpr[di.rt]) >> di.shamt);
+}
 
-    case LWL:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
+bool Processor::execSRLV(const DecodedInstr& di)
+{
+    return writeBack(di.rd, ((Word) gpr[di.rt]) >> REGSHAMT(gpr[di.rs]));
+}
 
-        // reads the full word from bus and then extracts the desired part
-        if (!mapVirtual(ALIGN(vaddr), &paddr, READ) && !bus->DataRead(paddr, &temp, this))
-        {
-            temp = merge((Word) gpr[RT(instr)], temp,  BYTEPOS(vaddr), BIGENDIANCPU, true);
-            setLoad(LOAD_TARGET_GPREG, RT(instr), temp);
-        }
-        else
-            // exception signaled: rt not loadable
-            error = true;
-        break;
-			
-    case LWR:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
+bool Processor::execSUB(const DecodedInstr& di)
+{
+    Word res;
 
-        // reads the full word from bus and then extracts the desired part
-        if (!mapVirtual(ALIGN(vaddr), &paddr, READ) && !bus->DataRead(paddr, &temp, this))
-        {
-            temp = merge((Word) gpr[RT(instr)], temp, BYTEPOS(vaddr), BIGENDIANCPU, false);
-            setLoad(LOAD_TARGET_GPREG, RT(instr), temp);
-        }
-        else
-            // exception signaled: rt not loadable
-            error = true;
-        break;	
-	
-    default:
-        SignalExc(RIEXCEPTION);
-        error = true;
-        break;
+    if (SignSub(&res, gpr[di.rs], gpr[di.rt])) {
+        SignalExc(OVEXCEPTION);
+        return true;
     }
-    return(error);
+    return writeBack(di.rd, res);
 }
 
-// This method executes a MIPS store-type instruction, following MIPS
-// guidelines; It returns TRUE if an exception occurred, FALSE
-// otherwise.
-bool Processor::execStoreInstr(Word instr)
+bool Processor::execSUBU(const DecodedInstr& di)
 {
-    Word paddr, vaddr, temp;
-    bool error = false;
+    return writeBack(di.rd, gpr[di.rs] - gpr[di.rt]);
+}
 
-    switch(OPCODE(instr))
-    {
-    case SB:
-        // here things are a little dirty: instead of writing
-        // the byte directly into memory, it reads the full word,
-        // modifies the byte as needed, and writes the word back.
-        // This works because there could be read-only memory but 
-        // not write-only...
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (!mapVirtual(ALIGN(vaddr), &paddr, WRITE) && !bus->DataRead(paddr, &temp, this))
-        {
-            temp = mergeByte(temp, (Word) gpr[RT(instr)], BYTEPOS(vaddr));
-            if (bus->DataWrite(paddr, temp, this))
-                // bus exception signaled
-                error = true;
-        }
-        else 
-            // address or bus exception signaled
-            error = true;
-        break;
+bool Processor::execSYSCALL(const DecodedInstr& di)
+{
+    UNUSED_ARG(di);
+    SignalExc(SYSEXCEPTION);
+    return true;
+}
 
-    case SH:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (BitVal(vaddr, 0))
-        {
-            // unaligned halfword
-            SignalExc(ADESEXCEPTION);
-            error = true;
-        }
-        else
-            // the same "dirty" thing here...
-            if (!mapVirtual(ALIGN(vaddr), &paddr, WRITE) && !bus->DataRead(paddr, &temp, this))
-            {
-                temp = mergeHWord(temp, (Word) gpr[RT(instr)], HWORDPOS(vaddr));
-                if (bus->DataWrite(paddr, temp, this))
-                    // bus exception signaled
-                    error = true;							
-            }
-            else
-                // address or bus exception signaled
-                error = true;
-        break;
-			
-    case SW:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (mapVirtual(vaddr, &paddr, WRITE) || bus->DataWrite(paddr, (Word) gpr[RT(instr)], this))
-            // address or bus exception signaled
-            error = true;
-        break;	
-	
-    case SWL:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (!mapVirtual(ALIGN(vaddr), &paddr, WRITE) && !bus->DataRead(paddr, &temp, this))
-        {
-            temp = merge(temp, (Word) gpr[RT(instr)], BYTEPOS(vaddr), !(BIGENDIANCPU), false);
-			
-            if(bus->DataWrite(paddr, temp, this))
-                // bus exception
-                error = true;	
-        }
-        else
-            // address or bus exception signaled
-            error = true;
-        break;
-			
-    case SWR:
-        vaddr = gpr[RS(instr)] + SignExtImm(instr);
-        if (!mapVirtual(ALIGN(vaddr), &paddr, WRITE) && !bus->DataRead(paddr, &temp, this))
-        {
-            temp = merge(temp, (Word) gpr[RT(instr)], BYTEPOS(vaddr), !(BIGENDIANCPU), true);
-            if (bus->DataWrite(paddr, temp, this))
-                // bus exception signaled
-                error = true;	
-        }
-        else
-            // addresss or bus exception signaled
-            error = true;
-        break;	
-	
-    default:
-        SignalExc(RIEXCEPTION);
-        error = true;
-        break;
+bool Processor::execXOR(const DecodedInstr& di)
+{
+    return writeBack(di.rd, gpr[di.rs] ^ gpr[di.rt]);
+}
+
+bool Processor::execCAS(const DecodedInstr& di)
+{
+    Word paddr;
+    bool atomic;
+
+    if (mapVirtual(gpr[di.rs], &paddr, WRITE) ||
+        bus->CompareAndSet(paddr, gpr[di.rt], gpr[di.rd], &atomic, this))
+        return true;
+    if (atomic)
+        lastStore = clock();
+
+    return writeBack(di.rd, atomic);
+}
+
+
+//
+// Instruction handlers: immediate-type instructions
+//
+
+bool Processor::execADDI(const DecodedInstr& di)
+{
+    Word res;
+
+    if (SignAdd(&res, gpr[di.rs], (SWord) di.imm)) {
+        SignalExc(OVEXCEPTION);
+        return true;
+    }
+    return writeBack(di.rt, res);
+}
+
+bool Processor::execADDIU(const DecodedInstr& di)
+{
+    return writeBack(di.rt, gpr[di.rs] + di.imm);
+}
+
+bool Processor::execANDI(const DecodedInstr& di)
+{
+    return writeBack(di.rt, gpr[di.rs] & di.imm);
+}
+
+bool Processor::execLUI(const DecodedInstr& di)
+{
+    return writeBack(di.rt, di.imm);
+}
+
+bool Processor::execORI(const DecodedInstr& di)
+{
+    return writeBack(di.rt, gpr[di.rs] | di.imm);
+}
+
+bool Processor::execSLTI(const DecodedInstr& di)
+{
+    return writeBack(di.rt, (gpr[di.rs] < (SWord) di.imm) ? 1UL : 0UL);
+}
+
+bool Processor::execSLTIU(const DecodedInstr& di)
+{
+    return writeBack(di.rt, (((Word) gpr[di.rs]) < di.imm) ? 1UL : 0UL);
+}
+
+bool Processor::execXORI(const DecodedInstr& di)
+{
+    return writeBack(di.rt, gpr[di.rs] ^ di.imm);
+}
+
+
+//
+// Instruction handlers: branch-type instructions. Delayed load is
+// completed just after instruction execution
+//
+
+bool Processor::execBEQ(const DecodedInstr& di)
+{
+    if (gpr[di.rs] == gpr[di.rt])
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBGEZ(const DecodedInstr& di)
+{
+    if (!SIGNBIT(gpr[di.rs]))
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBGEZAL(const DecodedInstr& di)
+{
+    // solution "by the book"; alternative: gpr[..] = succPC
+    gpr[LINKREG] = currPC + (2 * WORDLEN);
+    if (!SIGNBIT(gpr[di.rs]))
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBLTZ(const DecodedInstr& di)
+{
+    if (SIGNBIT(gpr[di.rs]))
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBLTZAL(const DecodedInstr& di)
+{
+    gpr[LINKREG] = currPC + (2 * WORDLEN);
+    if (SIGNBIT(gpr[di.rs]))
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBGTZ(const DecodedInstr& di)
+{
+    if (gpr[di.rs] > 0)
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBLEZ(const DecodedInstr& di)
+{
+    if (gpr[di.rs] <= 0)
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBNE(const DecodedInstr& di)
+{
+    if (gpr[di.rs] != gpr[di.rt])
+        succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execJ(const DecodedInstr& di)
+{
+    succPC = (nextPC & PCUPMASK) | di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execJAL(const DecodedInstr& di)
+{
+    // solution "by the book": alt. gpr[..] = succPC
+    gpr[LINKREG] = currPC + (2 * WORDLEN);
+    succPC = (nextPC & PCUPMASK) | di.imm;
+    completeLoad();
+    return false;
+}
+
+
+//
+// Instruction handlers: coprocessor 0 instructions. CP0 usability is
+// checked at execution time, since it depends on STATUS register
+//
+
+bool Processor::execRFE(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+    popKUIEVMStack();
+    completeLoad();
+    return false;
+}
+
+bool Processor::execTLBP(const DecodedInstr& di)
+{
+    unsigned int i;
+
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+
+    // solution "by the book"
+    cpreg[INDEX] = SIGNMASK;
+    if (probeTLB(&i, cpreg[ENTRYHI], cpreg[ENTRYHI]))
+        cpreg[INDEX] = (i << RNDIDXOFFS);
+    completeLoad();
+    return false;
+}
+
+bool Processor::execTLBR(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+    Word oldEntryHi = cpreg[ENTRYHI];
+    cpreg[ENTRYHI] = tlb[RNDIDX(cpreg[INDEX])].getHI();
+    cpreg[ENTRYLO] = tlb[RNDIDX(cpreg[INDEX])].getLO();
+    if ((oldEntryHi ^ cpreg[ENTRYHI]) & ASIDMASK)
+        mappingChanged();
+    completeLoad();
+    return false;
+}
+
+bool Processor::execTLBWI(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+    setTLBEntry(RNDIDX(cpreg[INDEX]), cpreg[ENTRYHI], cpreg[ENTRYLO]);
+    notify(NOTIFY_TLB, RNDIDX(cpreg[INDEX]));
+    mappingChanged();
+    completeLoad();
+    return false;
+}
+
+bool Processor::execTLBWR(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+    syncRandom(clock() - 1);
+    setTLBEntry(RNDIDX(cpreg[RANDOM]), cpreg[ENTRYHI], cpreg[ENTRYLO]);
+    notify(NOTIFY_TLB, RNDIDX(cpreg[INDEX]));
+    mappingChanged();
+    completeLoad();
+    return false;
+}
+
+bool Processor::execWAIT(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+    suspend();
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBC0F(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    // condition line for CP0 is always FALSE
+    succPC = nextPC + di.imm;
+    completeLoad();
+    return false;
+}
+
+bool Processor::execBC0T(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    // condition line for CP0 is always FALSE so this is a nop
+    // instruction
+    completeLoad();
+    return false;
+}
+
+bool Processor::execMFC0(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    // delayed load is completed _before_ istruction execution since
+    // instruction itself produces a delayed load
+    completeLoad();
+
+    // Timer and Random values are derived on demand; Random does not
+    // count the current instruction yet
+    if (di.rd == CP0REG_TIMER) {
+        syncTimer(clock());
+        spinImpure = true;
+    } else if (di.rd == RANDOM) {
+        syncRandom(clock() - 1);
+        spinImpure = true;
+    }
+    setLoad(LOAD_TARGET_GPREG, di.rt, (SWord) cpreg[di.rd]);
+    return false;
+}
+
+bool Processor::execMTC0(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+    // delayed load is completed _before_ istruction execution since
+    // instruction itself produces a delayed load
+    completeLoad();
+    setLoad(LOAD_TARGET_CPREG, di.rd, gpr[di.rt]);
+    return false;
+}
+
+bool Processor::execCLRTLB(const DecodedInstr& di)
+{
+    if (!cp0Usable())
+        return execCopUnusable(di);
+
+    spinImpure = true;
+    completeLoad();
+    zapTLB();
+    return false;
+}
+
+
+//
+// Instruction handlers: load-type instructions. Delayed load is
+// completed _before_ istruction execution since instruction itself
+// produces a delayed load
+//
+
+bool Processor::execLB(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    // reads the full word from bus and then extracts the byte
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(ALIGN(vaddr), &paddr, READ, &host) || memRead(paddr, host, &temp))
+        // exception signaled: rt not loadable
+        return true;
+
+    setLoad(LOAD_TARGET_GPREG, di.rt, signExtByte(temp, BYTEPOS(vaddr)));
+    return false;
+}
+
+bool Processor::execLBU(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    // reads the full word from bus and then extracts the byte
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(ALIGN(vaddr), &paddr, READ, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    setLoad(LOAD_TARGET_GPREG, di.rt, (SWord) zExtByte(temp, BYTEPOS(vaddr)));
+    return false;
+}
+
+bool Processor::execLH(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (BitVal(vaddr, 0)) {
+        // unaligned halfword
+        SignalExc(ADELEXCEPTION);
+        return true;
+    }
+
+    // reads the full word from bus and then extracts the halfword
+    if (mapVirtual(ALIGN(vaddr), &paddr, READ, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    setLoad(LOAD_TARGET_GPREG, di.rt, signExtHWord(temp, HWORDPOS(vaddr)));
+    return false;
+}
+
+bool Processor::execLHU(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (BitVal(vaddr, 0)) {
+        // unaligned halfword
+        SignalExc(ADELEXCEPTION);
+        return true;
+    }
+
+    // reads the full word from bus and then extracts the halfword
+    if (mapVirtual(ALIGN(vaddr), &paddr, READ, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    setLoad(LOAD_TARGET_GPREG, di.rt, (SWord) zExtHWord(temp, HWORDPOS(vaddr)));
+    return false;
+}
+
+bool Processor::execLW(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(vaddr, &paddr, READ, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    setLoad(LOAD_TARGET_GPREG, di.rt, (SWord) temp);
+    return false;
+}
+
+bool Processor::execLWL(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    // reads the full word from bus and then extracts the desired part
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(ALIGN(vaddr), &paddr, READ, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    temp = merge((Word) gpr[di.rt], temp, BYTEPOS(vaddr), BIGENDIANCPU, true);
+    setLoad(LOAD_TARGET_GPREG, di.rt, temp);
+    return false;
+}
+
+bool Processor::execLWR(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    // reads the full word from bus and then extracts the desired part
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(ALIGN(vaddr), &paddr, READ, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    temp = merge((Word) gpr[di.rt], temp, BYTEPOS(vaddr), BIGENDIANCPU, false);
+    setLoad(LOAD_TARGET_GPREG, di.rt, temp);
+    return false;
+}
+
+
+//
+// Instruction handlers: store-type instructions. Delayed load is
+// completed _before_ istruction execution since it happens
+// "logically" so in the pipeline
+//
+
+bool Processor::execSB(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    // here things are a little dirty: instead of writing the byte
+    // directly into memory, it reads the full word, modifies the byte
+    // as needed, and writes the word back. This works because there
+    // could be read-only memory but not write-only...
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(ALIGN(vaddr), &paddr, WRITE, &host) || memRead(paddr, host, &temp))
+        // address or bus exception signaled
+        return true;
+
+    temp = mergeByte(temp, (Word) gpr[di.rt], BYTEPOS(vaddr));
+    return memWrite(paddr, host, temp);
+}
+
+bool Processor::execSH(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (BitVal(vaddr, 0)) {
+        // unaligned halfword
+        SignalExc(ADESEXCEPTION);
+        return true;
     }
-    return(error);
+
+    // the same "dirty" thing here...
+    if (mapVirtual(ALIGN(vaddr), &paddr, WRITE, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    temp = mergeHWord(temp, (Word) gpr[di.rt], HWORDPOS(vaddr));
+    return memWrite(paddr, host, temp);
+}
+
+bool Processor::execSW(const DecodedInstr& di)
+{
+    Word paddr;
+    Word* host;
+
+    completeLoad();
+
+    Word vaddr = gpr[di.rs] + di.imm;
+    return mapVirtual(vaddr, &paddr, WRITE, &host) || memWrite(paddr, host, (Word) gpr[di.rt]);
+}
+
+bool Processor::execSWL(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(ALIGN(vaddr), &paddr, WRITE, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    temp = merge(temp, (Word) gpr[di.rt], BYTEPOS(vaddr), !(BIGENDIANCPU), false);
+    return memWrite(paddr, host, temp);
+}
+
+bool Processor::execSWR(const DecodedInstr& di)
+{
+    Word paddr, temp;
+    Word* host;
+
+    completeLoad();
+
+    Word vaddr = gpr[di.rs] + di.imm;
+    if (mapVirtual(ALIGN(vaddr), &paddr, WRITE, &host) || memRead(paddr, host, &temp))
+        return true;
+
+    temp = merge(temp, (Word) gpr[di.rt], BYTEPOS(vaddr), !(BIGENDIANCPU), true);
+    return memWrite(paddr, host, temp);
+}
+
+
+//
+// Instruction handlers: instructions raising an exception
+//
+
+// Coprocessor 0 (or other) unusable, or ill-formed CP0 instruction
+bool Processor::execCopUnusable(const DecodedInstr& di)
+{
+    SignalExc(CPUEXCEPTION, COPNUM(di.instr));
+    return true;
+}
+
+// Unknown or ill-formed instruction
+bool Processor::execReserved(const DecodedInstr& di)
+{
+    UNUSED_ARG(di);
+    SignalExc(RIEXCEPTION);
+    return true;
 }
@@ -22,16 +22,21 @@
 #ifndef UMPS_PROCESSOR_H
 #define UMPS_PROCESSOR_H
 
+#include <vector>
+
 #include <sigc++/sigc++.h>
 
 #include "base/lang.h"
 #include "umps/types.h"
 #include "umps/const.h"
+#include "umps/decode_cache.h"
 
 class MachineConfig;
 class Machine;
 class SystemBus;
 class TLBEntry;
+class SnapshotWriter;
+class SnapshotReader;
 
 enum ProcessorStatus {
     PS_HALTED,
@@ -70,8 +75,33 @@ public:
 
     uint32_t IdleCycles() const;
 
+    // This method returns the number of cycles Processor may be
+    // fast-forwarded by while it busy-waits, i.e. while it is stuck
+    // in a short loop which has been found to leave its state
+    // unchanged on each iteration, and which does nothing but read
+    // memory and device registers. This holds as long as nothing
+    // else changes them: lastChange is the last clock tick on which
+    // a store or device event happened in the machine. Returns 0 if
+    // the processor is not known to be stuck
+    uint32_t SpinCycles(uint64_t lastChange) const;
+
+    // This method returns the clock tick of the last store done by
+    // Processor
+    uint64_t LastStoreTick() const { return lastStore; }
+
     void Skip(uint32_t cycles);
 
+    // This method makes Processor execute instructions on its own,
+    // while the bus clock stands still (see Machine), until it has
+    // run SystemBus::QuantumLimit() clock ticks ahead; the processor
+    // keeps count of these ticks until EndQuantum() is called once
+    // the bus clock has caught up. As RunQuantum() runs on a host
+    // thread of its own, the signals below are held back meanwhile,
+    // and EndQuantum() emits them
+    void RunQuantum();
+    void EndQuantum();
+    uint64_t QuantumTicks() const { return quantumTicks; }
+
     // This method allows SystemBus and Processor itself to signal
     // Processor when an exception happens. SystemBus signal IBE/DBE
     // exceptions; Processor itself signal all other kinds of exception.
@@ -90,6 +120,10 @@ public:
 
     Word getASID() const;
     Word getPC() const { return currPC; }
+
+    // This method returns the number of instructions executed since
+    // power on, including those which raised an exception
+    uint64_t getExecutedInstructions() const { return executedInstr; }
     Word getInstruction() const { return currInstr; }
     bool getVM() const;
 
@@ -123,8 +157,21 @@ public:
     void setTLBHi(unsigned int index, Word value);
     void setTLBLo(unsigned int index, Word value);
 
+    // These methods save and restore the processor state as part of a
+    // machine snapshot (see Machine::SaveSnapshot()); Restore() must
+    // follow SystemBus::Restore(), as the current instruction is
+    // decoded again from the restored memory
+    void Save(SnapshotWriter* out) const;
+    void Restore(SnapshotReader* in);
+
+    // This method must be called when the host location of RAM pages
+    // may have changed, or when they may have become shared (see
+    // SystemBus::ShareRam()): it drops the RAM locations held
+    void HostMappingChanged() { mappingChanged(); }
+
     // Signals
     sigc::signal<void> StatusChanged;
+    sigc::signal<void> SpinDetected;
     sigc::signal<void, unsigned int> SignalException;
     sigc::signal<void, unsigned int> SignalTLBChanged;
 
@@ -149,6 +196,9 @@ private:
     Machine* machine;
     SystemBus* bus;
 
+    // decoded instructions, shared with the other processors
+    DecodeCache* decodeCache;
+
     ProcessorStatus status;
 
     // last exception cause: an internal format is used (see excName[]
@@ -173,8 +223,33 @@ private:
     // general purpose registers, together with HI and LO registers
     SWord gpr[kNumCPURegisters];
 
-    // instruction to be executed
+    // instruction to be executed, its decoded form and its slot in
+    // the decode cache (NULL if it was not fetched from RAM or ROM)
     Word currInstr;
+    DecodedInstr currDecoded;
+    DecodedInstr* currSlot;
+
+    // mapGeneration is advanced whenever the way virtual addresses
+    // are mapped may have changed (VM or KU mode, ASID or TLB
+    // changes); fetchGeneration is its value at the last fully mapped
+    // fetch
+    uint32_t mapGeneration;
+    uint32_t fetchGeneration;
+
+    // Software TLB: a direct-mapped cache of the virtual page
+    // translations done by mapVirtual(), one table for each access
+    // type. Entries are valid only for the mapGeneration they were
+    // filled in, which makes them implicitly keyed by ASID and mode
+    // too. host points to the page in RAM, or is NULL for any other
+    // physical location
+    struct SoftTLBEntry {
+        uint32_t generation;
+        Word vpn;
+        Word pfn;
+        Word* host;
+    };
+    static const unsigned int kSoftTLBSize = 256;
+    SoftTLBEntry softTLB[3][kSoftTLBSize];
 
     // previous virtual and physical addresses for PC, and previous
     // instruction executed; for book-keeping purposes and for handling
@@ -197,35 +272,216 @@ private:
     // CP0 components: special registers and the TLB
     Word cpreg[CP0REGNUM];
 
+    // CP0 Timer and Random registers are not updated on every cycle:
+    // while they run, their values are derived from the bus clock,
+    // and cpreg[] holds the values they had when they were last
+    // (re)started. Timer reaches zero on clock tick timerZero, and
+    // timerDeadline is the next tick at which Cycle() has timer work
+    // to do; Random counts ticks from randomStart on. cycledTick is
+    // the last tick Cycle() was called on while not running
+    uint64_t timerZero;
+    uint64_t timerDeadline;
+    uint64_t randomStart;
+    uint64_t cycledTick;
+
+    // instructions executed (see getExecutedInstructions())
+    uint64_t executedInstr;
+
+    // clock tick of the last store (see LastStoreTick())
+    uint64_t lastStore;
+
+    // Spin loop detection (see SpinCycles()). spinBranch is the
+    // backward branch closing the loop being watched; the register
+    // state right after it was last taken, on clock tick spinPassTick
+    // and with spinPassInstr instructions executed, is kept in spinGPR
+    // and spinLoad*. spinImpure is set by any instruction which does
+    // more than reading memory, or reads a value which changes on its
+    // own. A loop which keeps failing the check is watched less and
+    // less often: spinWait passes are let go before the next one.
+    // spinStuck is TRUE once an iteration of spinLength instructions,
+    // starting on tick spinSince, has been found to leave the state
+    // unchanged, and the last one ended with spinConfirmInstr
+    // instructions executed
+    Word spinBranch;
+    SWord spinGPR[kNumCPURegisters];
+    LoadTargetType spinLoadPending;
+    unsigned int spinLoadReg;
+    SWord spinLoadVal;
+    uint64_t spinPassTick;
+    uint64_t spinPassInstr;
+    bool spinImpure;
+    unsigned int spinBackoff;
+    unsigned int spinWait;
+    bool spinStuck;
+    uint32_t spinLength;
+    uint64_t spinSince;
+    uint64_t spinConfirmInstr;
+
+    // clock ticks run ahead of the bus clock (see RunQuantum())
+    uint64_t quantumTicks;
+
+    // signals held back during a quantum, in the order they were due
+    enum NotificationKind {
+        NOTIFY_EXCEPTION,
+        NOTIFY_STATUS,
+        NOTIFY_SPIN,
+        NOTIFY_TLB
+    };
+
+    struct Notification {
+        NotificationKind kind;
+        unsigned int arg;
+    };
+
+    bool inQuantum;
+    std::vector<Notification> heldNotifications;
+
+    // TRUE if an interrupt may be pending: it is recomputed whenever
+    // CAUSE IP field or STATUS IEc bit and IM mask change, so that
+    // Cycle() can skip interrupt checking altogether when it is FALSE
+    bool intPending;
+
     size_t tlbSize;
     scoped_array<TLBEntry> tlb;
 
+    // Hash index over the TLB: entries whose VPN hashes to the same
+    // bucket are chained through tlbNext/tlbPrev (in no particular
+    // order), starting from tlbBucket
+    static const unsigned int kNoTLBEntry = ~0U;
+    unsigned int tlbHashBits;
+    scoped_array<unsigned int> tlbBucket;
+    scoped_array<unsigned int> tlbNext;
+    scoped_array<unsigned int> tlbPrev;
+
     // private methods
     void setStatus(ProcessorStatus newStatus);
 
     void handleExc();
     void zapTLB(void);
 
-    bool execInstr(Word instr);
-    bool execRegInstr(Word * res, Word instr, bool * isBD);
-    bool execImmInstr(Word * res, Word instr);
-    bool execBranchInstr(Word instr, bool * isBD);
-    bool execLoadInstr(Word instr);
-    bool execStoreInstr(Word instr);
-    bool execLoadCopInstr(Word instr);
-    bool execStoreCopInstr(Word instr);
-
-    bool mapVirtual(Word vaddr, Word * paddr, Word accType);
+    void spinCheck();
+    void spinSnapshot();
+    void spinReset();
+
+    void fetch();
+    bool fetchChained();
+    void decodeCurrInstr();
+    static void decode(Word instr, DecodedInstr* di);
+    bool execInstr(const DecodedInstr& di);
+    bool writeBack(unsigned int reg, Word value);
+
+    // Instruction handlers: each one executes a single MIPS
+    // instruction in decoded form, and returns TRUE if an exception
+    // occurred, FALSE otherwise
+    bool execADD(const DecodedInstr& di);
+    bool execADDU(const DecodedInstr& di);
+    bool execAND(const DecodedInstr& di);
+    bool execBREAK(const DecodedInstr& di);
+    bool execDIV(const DecodedInstr& di);
+    bool execDIVU(const DecodedInstr& di);
+    bool execJALR(const DecodedInstr& di);
+    bool execJR(const DecodedInstr& di);
+    bool execMFHI(const DecodedInstr& di);
+    bool execMFLO(const DecodedInstr& di);
+    bool execMTHI(const DecodedInstr& di);
+    bool execMTLO(const DecodedInstr& di);
+    bool execMULT(const DecodedInstr& di);
+    bool execMULTU(const DecodedInstr& di);
+    bool execNOR(const DecodedInstr& di);
+    bool execOR(const DecodedInstr& di);
+    bool execSLL(const DecodedInstr& di);
+    bool execSLLV(const DecodedInstr& di);
+    bool execSLT(const DecodedInstr& di);
+    bool execSLTU(const DecodedInstr& di);
+    bool execSRA(const DecodedInstr& di);
+    bool execSRAV(const DecodedInstr& di);
+    bool execSRL(const DecodedInstr& di);
+    bool execSRLV(const DecodedInstr& di);
+    bool execSUB(const DecodedInstr& di);
+    bool execSUBU(const DecodedInstr& di);
+    bool execSYSCALL(const DecodedInstr& di);
+    bool execXOR(const DecodedInstr& di);
+    bool execCAS(const DecodedInstr& di);
+
+    bool execADDI(const DecodedInstr& di);
+    bool execADDIU(const DecodedInstr& di);
+    bool execANDI(const DecodedInstr& di);
+    bool execLUI(const DecodedInstr& di);
+    bool execORI(const DecodedInstr& di);
+    bool execSLTI(const DecodedInstr& di);
+    bool execSLTIU(const DecodedInstr& di);
+    bool execXORI(const DecodedInstr& di);
+
+    bool execBEQ(const DecodedInstr& di);
+    bool execBGEZ(const DecodedInstr& di);
+    bool execBGEZAL(const DecodedInstr& di);
+    bool execBLTZ(const DecodedInstr& di);
+    bool execBLTZAL(const DecodedInstr& di);
+    bool execBGTZ(const DecodedInstr& di);
+    bool execBLEZ(const DecodedInstr& di);
+    bool execBNE(const DecodedInstr& di);
+    bool execJ(const DecodedInstr& di);
+    bool execJAL(const DecodedInstr& di);
+
+    bool execRFE(const DecodedInstr& di);
+    bool execTLBP(const DecodedInstr& di);
+    bool execTLBR(const DecodedInstr& di);
+    bool execTLBWI(const DecodedInstr& di);
+    bool execTLBWR(const DecodedInstr& di);
+    bool execWAIT(const DecodedInstr& di);
+    bool execBC0F(const DecodedInstr& di);
+    bool execBC0T(const DecodedInstr& di);
+    bool execMFC0(const DecodedInstr& di);
+    bool execMTC0(const DecodedInstr& di);
+    bool execCLRTLB(const DecodedInstr& di);
+
+    bool execLB(const DecodedInstr& di);
+    bool execLBU(const DecodedInstr& di);
+    bool execLH(const DecodedInstr& di);
+    bool execLHU(const DecodedInstr& di);
+    bool execLW(const DecodedInstr& di);
+    bool execLWL(const DecodedInstr& di);
+    bool execLWR(const DecodedInstr& di);
+
+    bool execSB(const DecodedInstr& di);
+    bool execSH(const DecodedInstr& di);
+    bool execSW(const DecodedInstr& di);
+    bool execSWL(const DecodedInstr& di);
+    bool execSWR(const DecodedInstr& di);
+
+    bool execCopUnusable(const DecodedInstr& di);
+    bool execReserved(const DecodedInstr& di);
+
+    bool mapVirtual(Word vaddr, Word * paddr, Word accType, Word** host = NULL);
+    bool mapSlow(Word vaddr, Word * paddr, Word accType);
+    void mappingChanged();
+    void flushSoftTLB();
+    void notify(NotificationKind kind, unsigned int arg = 0);
+    bool memRead(Word paddr, const Word* host, Word* datap);
+    bool memWrite(Word paddr, Word* host, Word data);
     bool probeTLB(unsigned int * index, Word asid, Word vpn);
+    void setTLBEntry(unsigned int index, Word hi, Word lo);
+    unsigned int tlbHash(Word vpn) const;
+    void tlbIndexInsert(unsigned int index);
+    void tlbIndexRemove(unsigned int index);
     void completeLoad(void);
 
-    void randomRegTick(void);
+    uint64_t lastTick() const;
+    bool timerRunning() const;
+    void timerEvent();
+    void syncTimer(uint64_t tick);
+    void startTimer(uint64_t tick);
+    void syncRandom(uint64_t tick);
+    void startRandom(uint64_t tick);
+    Word randomAfter(Word value, uint64_t ticks) const;
 
     void pushKUIEVMStack(void);
     void popKUIEVMStack(void);
 
     void setTLBRegs(Word vaddr);
+    uint64_t clock() const;
     bool checkForInt();
+    void updateIntPending();
     void suspend();
     bool cp0Usable(void);
     void setLoad(LoadTargetType loadCode, unsigned int regNum, SWord regVal);
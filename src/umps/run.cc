@@ -0,0 +1,255 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * Copyright (C) 2011 Tomislav Jonjic
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/****************************************************************************
+ *
+ * This is a stand-alone program which runs a machine with no user
+ * interface, at full speed, until it halts or a cycle or time limit
+ * is reached. Device output goes to the files set in the machine
+ * configuration, and terminal and printer output may also be copied
+ * to the standard output. A summary of the run is printed on the
+ * standard error on exit. The machine state may be restored from a
+ * snapshot before running, and saved to one on exit.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <list>
+
+#include <sigc++/sigc++.h>
+
+#include "base/lang.h"
+#include "umps/const.h"
+#include "umps/types.h"
+#include "umps/arch.h"
+#include "umps/error.h"
+#include "umps/machine_config.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/stoppoint.h"
+#include "umps/device.h"
+
+// exit code for runs cut short by a cycle or time limit
+#define EXIT_LIMIT	2
+
+// cycles run between checks of the time limit
+static const unsigned int kIterCycles = 100000;
+
+HIDDEN void showHelp(const char* prgName);
+HIDDEN bool parseCount(const char* str, uint64_t* value);
+HIDDEN void echoChar(char c);
+
+// This function runs the machine described by the configuration file
+// given as the last argument (see showHelp() for options).
+// Returns an EXIT_SUCCESS/FAILURE/LIMIT code
+int main(int argc, char* argv[])
+{
+    uint64_t maxCycles = 0;
+    uint64_t timeout = 0;
+    bool echo = false;
+    const char* restoreFile = NULL;
+    const char* saveFile = NULL;
+
+    int i;
+    for (i = 1; i < argc - 1; i++) {
+        if (SAMESTRING("-c", argv[i]) && i + 1 < argc - 1) {
+            if (!parseCount(argv[++i], &maxCycles)) {
+                fprintf(stderr, "%s : invalid cycle limit `%s'\n", argv[0], argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (SAMESTRING("-t", argv[i]) && i + 1 < argc - 1) {
+            if (!parseCount(argv[++i], &timeout)) {
+                fprintf(stderr, "%s : invalid time limit `%s'\n", argv[0], argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (SAMESTRING("-e", argv[i])) {
+            echo = true;
+        } else if (SAMESTRING("-r", argv[i]) && i + 1 < argc - 1) {
+            restoreFile = argv[++i];
+        } else if (SAMESTRING("-s", argv[i]) && i + 1 < argc - 1) {
+            saveFile = argv[++i];
+        } else {
+            break;
+        }
+    }
+    if (i != argc - 1 || argv[i][0] == '-') {
+        showHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::string error;
+    scoped_ptr<MachineConfig> config(MachineConfig::LoadFromFile(argv[i], error));
+    if (!config) {
+        fprintf(stderr, "%s : %s\n", argv[0], error.c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::list<std::string> errors;
+    if (!config->Validate(&errors)) {
+        foreach (const std::string& s, errors)
+            fprintf(stderr, "%s : %s\n", argv[0], s.c_str());
+        return EXIT_FAILURE;
+    }
+
+    StoppointSet breakpoints, suspects, tracepoints;
+    scoped_ptr<Machine> machine;
+    try {
+        machine.reset(new Machine(config.get(), &breakpoints, &suspects, &tracepoints));
+    } catch (const FileError& e) {
+        fprintf(stderr, "%s : file `%s' is nonexistent or inaccessible\n", argv[0], e.fileName.c_str());
+        return EXIT_FAILURE;
+    } catch (const InvalidFileFormatError& e) {
+        fprintf(stderr, "%s : file `%s' has wrong format\n", argv[0], e.fileName.c_str());
+        return EXIT_FAILURE;
+    } catch (const EthError& e) {
+        fprintf(stderr, "%s : error initializing network device %u\n", argv[0], e.devNo);
+        return EXIT_FAILURE;
+    } catch (const Error& e) {
+        fprintf(stderr, "%s : %s\n", argv[0], e.what());
+        return EXIT_FAILURE;
+    }
+
+    if (restoreFile != NULL) {
+        try {
+            machine->LoadSnapshot(restoreFile);
+        } catch (const FileError& e) {
+            fprintf(stderr, "%s : file `%s' is nonexistent or inaccessible\n", argv[0], e.fileName.c_str());
+            return EXIT_FAILURE;
+        } catch (const InvalidFileFormatError& e) {
+            fprintf(stderr, "%s : snapshot `%s' cannot be restored : %s\n", argv[0], e.fileName.c_str(), e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Pseudo-terminals are only known once created, and the user has
+    // to be told where to connect to
+    for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+        Device* dev = machine->getDevice(EXT_IL_INDEX(IL_TERMINAL), devNo);
+        if (dev->Type() == TERMDEV && config->getTerminalInput(devNo) == "pty")
+            fprintf(stderr, "terminal%u input : %s\n", devNo,
+                    static_cast<TerminalDevice*>(dev)->getInputName().c_str());
+    }
+
+    if (echo) {
+        for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+            Device* dev = machine->getDevice(EXT_IL_INDEX(IL_TERMINAL), devNo);
+            if (dev->Type() == TERMDEV)
+                static_cast<TerminalDevice*>(dev)->SignalTransmitted.connect(sigc::ptr_fun(echoChar));
+            dev = machine->getDevice(EXT_IL_INDEX(IL_PRINTER), devNo);
+            if (dev->Type() == PRNTDEV)
+                static_cast<PrinterDevice*>(dev)->SignalPrinted.connect(sigc::ptr_fun(echoChar));
+        }
+    }
+
+    // Idle periods are skipped over, so the machine runs as fast as
+    // the host allows
+    machine->setFastForward(true);
+
+    const time_t startTime = time(NULL);
+    uint64_t cycles = 0;
+    bool limitHit = false;
+
+    while (!machine->IsHalted()) {
+        if ((maxCycles && cycles >= maxCycles) ||
+            (timeout && (uint64_t) (time(NULL) - startTime) >= timeout))
+        {
+            limitHit = true;
+            break;
+        }
+
+        uint64_t left = maxCycles ? maxCycles - cycles : kIterCycles;
+        unsigned int stepped;
+        machine->step((unsigned int) std::min((uint64_t) kIterCycles, left), &stepped);
+        cycles += stepped;
+    }
+
+    fflush(stdout);
+
+    if (saveFile != NULL) {
+        try {
+            machine->SaveSnapshot(saveFile);
+        } catch (const FileError& e) {
+            fprintf(stderr, "%s : cannot write snapshot `%s'\n", argv[0], e.fileName.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t instructions = 0;
+    for (unsigned int cpuId = 0; cpuId < config->getNumProcessors(); cpuId++)
+        instructions += machine->getProcessor(cpuId)->getExecutedInstructions();
+
+    fprintf(stderr, "%s : %s after %llu cycles, %llu instructions executed\n",
+            argv[0], limitHit ? "stopped" : "halted",
+            (unsigned long long) cycles, (unsigned long long) instructions);
+
+    return limitHit ? EXIT_LIMIT : EXIT_SUCCESS;
+}
+
+// Machine-level errors are fatal
+void Panic(const char* message)
+{
+    fprintf(stderr, "PANIC : %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+/****************************************************************************/
+/* Definitions strictly local to the module.                                */
+/****************************************************************************/
+
+// This function prints a help message on standard error
+HIDDEN void showHelp(const char* prgName)
+{
+    fprintf(stderr, "%s syntax : %s [-c cycles] [-t seconds] [-e] [-r snapshot] [-s snapshot] <config file>\n\n",
+            prgName, prgName);
+    fprintf(stderr, "where:\n\n");
+    fprintf(stderr, "-c cycles\tstop after the given number of cycles\n");
+    fprintf(stderr, "-t seconds\tstop after the given (wall clock) time\n");
+    fprintf(stderr, "-e\t\tcopy terminal and printer output to standard output\n");
+    fprintf(stderr, "-r snapshot\trestore the machine state from the given snapshot file\n");
+    fprintf(stderr, "-s snapshot\tsave the machine state to the given snapshot file on exit\n\n");
+    fprintf(stderr, "Exit code is %d if the machine halted, %d if a limit was hit first.\n",
+            EXIT_SUCCESS, EXIT_LIMIT);
+}
+
+// This function converts a decimal string into a positive count,
+// returning FALSE if it is malformed
+HIDDEN bool parseCount(const char* str, uint64_t* value)
+{
+    char* end;
+    unsigned long long v = strtoull(str, &end, 10);
+
+    if (*str == EOS || *end != EOS || v == 0)
+        return false;
+
+    *value = v;
+    return true;
+}
+
+HIDDEN void echoChar(char c)
+{
+    putchar(c);
+}
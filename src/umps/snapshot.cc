@@ -0,0 +1,183 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * Copyright (C) 2011 Tomislav Jonjic
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "umps/snapshot.h"
+
+#include <string.h>
+
+#include "umps/const.h"
+#include "umps/error.h"
+
+// Strings are saved with their length first; longer ones than this
+// are taken as a sign of a corrupted file
+HIDDEN const Word kMaxStringLength = 1UL << 20;
+
+SnapshotWriter::SnapshotWriter(const std::string& fileName)
+    : fileName(fileName),
+      buffer(NULL)
+{
+    if ((file = fopen(fileName.c_str(), "wb")) == NULL)
+        throw FileError(fileName);
+}
+
+SnapshotWriter::SnapshotWriter(SnapshotBuffer* buffer)
+    : file(NULL),
+      buffer(buffer)
+{}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    if (file != NULL)
+        fclose(file);
+}
+
+void SnapshotWriter::PutWord(Word value)
+{
+    put(&value, sizeof(value));
+}
+
+void SnapshotWriter::PutU64(uint64_t value)
+{
+    put(&value, sizeof(value));
+}
+
+void SnapshotWriter::PutBool(bool value)
+{
+    PutWord(value ? 1 : 0);
+}
+
+void SnapshotWriter::PutWords(const Word* words, size_t count)
+{
+    put(words, count * WORDLEN);
+}
+
+void SnapshotWriter::PutString(const std::string& s)
+{
+    PutWord(s.size());
+    put(s.data(), s.size());
+}
+
+void SnapshotWriter::Close()
+{
+    if (file == NULL)
+        return;
+
+    // Write errors are sticky, so they are checked once and for all
+    bool failed = ferror(file) != 0;
+    failed = (fclose(file) == EOF) || failed;
+    file = NULL;
+    if (failed)
+        throw FileError(fileName);
+}
+
+void SnapshotWriter::put(const void* data, size_t size)
+{
+    if (file != NULL) {
+        fwrite(data, 1, size, file);
+    } else {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        buffer->insert(buffer->end(), bytes, bytes + size);
+    }
+}
+
+SnapshotReader::SnapshotReader(const std::string& fileName)
+    : fileName(fileName),
+      buffer(NULL),
+      bufferPos(0)
+{
+    if ((file = fopen(fileName.c_str(), "rb")) == NULL)
+        throw FileError(fileName);
+}
+
+SnapshotReader::SnapshotReader(const SnapshotBuffer* buffer)
+    : file(NULL),
+      buffer(buffer),
+      bufferPos(0)
+{}
+
+SnapshotReader::~SnapshotReader()
+{
+    if (file != NULL)
+        fclose(file);
+}
+
+Word SnapshotReader::GetWord()
+{
+    Word value;
+    get(&value, sizeof(value));
+    return value;
+}
+
+uint64_t SnapshotReader::GetU64()
+{
+    uint64_t value;
+    get(&value, sizeof(value));
+    return value;
+}
+
+bool SnapshotReader::GetBool()
+{
+    Word value = GetWord();
+    Expect(value <= 1);
+    return value != 0;
+}
+
+void SnapshotReader::GetWords(Word* words, size_t count)
+{
+    get(words, count * WORDLEN);
+}
+
+std::string SnapshotReader::GetString()
+{
+    Word size = GetWord();
+    Expect(size <= kMaxStringLength);
+
+    std::vector<char> buf(size);
+    if (size > 0)
+        get(&buf[0], size);
+    return std::string(buf.begin(), buf.end());
+}
+
+void SnapshotReader::Expect(bool condition)
+{
+    if (!condition)
+        throw InvalidFileFormatError(fileName, "Invalid or corrupted snapshot file");
+}
+
+void SnapshotReader::ExpectEnd()
+{
+    if (file != NULL)
+        Expect(fgetc(file) == EOF);
+    else
+        Expect(bufferPos == buffer->size());
+}
+
+void SnapshotReader::get(void* data, size_t size)
+{
+    if (file != NULL) {
+        Expect(fread(data, 1, size, file) == size);
+    } else {
+        Expect(size <= buffer->size() - bufferPos);
+        if (size > 0)
+            memcpy(data, &(*buffer)[bufferPos], size);
+        bufferPos += size;
+    }
+}
@@ -0,0 +1,111 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * Copyright (C) 2011 Tomislav Jonjic
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_SNAPSHOT_H
+#define UMPS_SNAPSHOT_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "base/lang.h"
+#include "base/basic_types.h"
+#include "umps/types.h"
+
+// These classes write and read the binary files machine snapshots are
+// saved to (see Machine::SaveSnapshot()). A snapshot is just the
+// sequence of values each part of the machine chooses to save, in
+// host byte order; snapshots can only be restored on hosts of the same
+// endianness, which is checked by Machine. Snapshots may also be kept
+// in memory, in a SnapshotBuffer.
+
+typedef std::vector<unsigned char> SnapshotBuffer;
+
+class SnapshotWriter {
+public:
+    // This constructor creates file fileName, or truncates it if it
+    // exists already; it throws FileError on failure
+    explicit SnapshotWriter(const std::string& fileName);
+
+    // This constructor appends to buffer instead
+    explicit SnapshotWriter(SnapshotBuffer* buffer);
+
+    ~SnapshotWriter();
+
+    void PutWord(Word value);
+    void PutU64(uint64_t value);
+    void PutBool(bool value);
+    void PutWords(const Word* words, size_t count);
+    void PutString(const std::string& s);
+
+    // This method completes the file, throwing FileError if it could
+    // not be entirely written
+    void Close();
+
+private:
+    const std::string fileName;
+    FILE* file;
+    SnapshotBuffer* buffer;
+
+    void put(const void* data, size_t size);
+
+    DISABLE_COPY_AND_ASSIGNMENT(SnapshotWriter);
+};
+
+class SnapshotReader {
+public:
+    // This constructor opens file fileName; it throws FileError on
+    // failure
+    explicit SnapshotReader(const std::string& fileName);
+
+    // This constructor reads from buffer instead
+    explicit SnapshotReader(const SnapshotBuffer* buffer);
+
+    ~SnapshotReader();
+
+    // These methods throw InvalidFileFormatError if the file ends
+    // before the value
+    Word GetWord();
+    uint64_t GetU64();
+    bool GetBool();
+    void GetWords(Word* words, size_t count);
+    std::string GetString();
+
+    // This method throws InvalidFileFormatError unless condition
+    // holds; it is used to validate the values read
+    void Expect(bool condition);
+
+    // This method throws InvalidFileFormatError unless the end of
+    // the file has been reached
+    void ExpectEnd();
+
+private:
+    const std::string fileName;
+    FILE* file;
+    const SnapshotBuffer* buffer;
+    size_t bufferPos;
+
+    void get(void* data, size_t size);
+
+    DISABLE_COPY_AND_ASSIGNMENT(SnapshotReader);
+};
+
+#endif // UMPS_SNAPSHOT_H
@@ -118,18 +118,42 @@ Stoppoint* StoppointSet::Probe(Word asid, Word addr, AccessMode mode, const Proc
     Stoppoint* p = it->second;
 
     if (p->Matches(asid, addr, mode)) {
-        size_t index = 0;
-        for (index = 0; index < points.size(); ++index)
-            if (points[index].get() == p)
-                break;
-        assert(index < points.size());
-        SignalHit.emit(index, p, addr, cpu);
+        SignalHit.emit(indexOf(p), p, addr, cpu);
         return p;
     } else {
         return NULL;
     }
 }
 
+Stoppoint* StoppointSet::ProbeRange(Word asid, Word start, Word end, AccessMode mode,
+                                    const Processor* cpu) const
+{
+    if (IsEmpty())
+        return NULL;
+
+    // Stoppoints do not overlap, so only the one starting before the
+    // range may extend into it
+    AddressRange range(asid, start, end);
+    StoppointMap::const_iterator it = addressMap.lower_bound(range);
+    if (it != addressMap.begin())
+        --it;
+
+    Stoppoint* first = NULL;
+    for (; it != addressMap.end(); ++it) {
+        const AddressRange& r = it->first;
+        if (r.getASID() > asid || (r.getASID() == asid && r.getStart() > end))
+            break;
+        Stoppoint* p = it->second;
+        if (p->IsEnabled() && (p->getAccessMode() & mode) && r.Overlaps(range)) {
+            SignalHit.emit(indexOf(p), p, std::max(start, r.getStart()), cpu);
+            if (first == NULL)
+                first = p;
+        }
+    }
+
+    return first;
+}
+
 std::string StoppointSet::ToString(bool sorted) const
 {
     std::string result = "[";
@@ -162,3 +186,13 @@ unsigned int StoppointSet::nextId() const
         id = std::max(id, p->getId() + 1);
     return id;
 }
+
+size_t StoppointSet::indexOf(const Stoppoint* p) const
+{
+    size_t index;
+    for (index = 0; index < points.size(); ++index)
+        if (points[index].get() == p)
+            break;
+    assert(index < points.size());
+    return index;
+}
@@ -140,6 +140,12 @@ public:
 
     Stoppoint* Probe(Word asid, Word addr, AccessMode mode, const Processor* cpu) const;
 
+    // This method is like Probe(), but for accesses to the whole
+    // [start, end] range at once: every matching stoppoint which
+    // overlaps the range is hit, and the first of them is returned
+    Stoppoint* ProbeRange(Word asid, Word start, Word end, AccessMode mode,
+                          const Processor* cpu) const;
+
     template<typename OutputIterator>
     void GetStoppointsInRange(Word asid, Word start, Word end, OutputIterator out);
 
@@ -152,6 +158,7 @@ public:
 
 private:
     unsigned int nextId() const;
+    size_t indexOf(const Stoppoint* p) const;
 
     typedef std::vector<Stoppoint::Ptr> StoppointVector;
     StoppointVector points;
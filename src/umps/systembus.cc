@@ -45,7 +45,14 @@
 #include "umps/systembus.h"
 
 #include <assert.h>
+#include <string.h>
 
+#include <algorithm>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include "base/debug.h"
 #include "umps/const.h"
 #include "umps/blockdev_params.h"
 #include "umps/utility.h"
@@ -60,8 +67,10 @@
 #include "umps/time_stamp.h"
 #include "umps/error.h"
 #include "umps/memspace.h"
+#include "umps/decode_cache.h"
 #include "umps/event.h"
 #include "umps/mpic.h"
+#include "umps/snapshot.h"
 
 // This macro converts a byte address into a word address (minus offset)
 #define CONVERT(ad, bs)	((ad - bs) >> WORDSHIFT)	
@@ -101,8 +110,17 @@ SystemBus::SystemBus(const MachineConfig* conf, Machine* machine)
       mpController(new MPController(conf, machine))
 {
     tod = UINT64_C(0);
-    timer = MAXWORDVAL;
+    todOffset = UINT64_C(0);
+    timerUnderflow = tod + MAXWORDVAL + 1;
     eventQ = new EventQueue();
+    scheduleChanged = false;
+    lastEvent = tod;
+
+    inQuantum = false;
+    quantumCpus = 0;
+    quantumLimit = quantumMinCycles = 0;
+    mmioRequest = NULL;
+    mmioCpu = NULL;
 
     const char *coreFile = NULL;
     if (config->isLoadCoreEnabled())
@@ -112,6 +130,30 @@ SystemBus::SystemBus(const MachineConfig* conf, Machine* machine)
     bios = new BiosSpace(config->getROM(ROM_TYPE_BIOS).c_str());
     boot = new BiosSpace(config->getROM(ROM_TYPE_BOOT).c_str());
 
+    decodeCache.reset(new DecodeCache(ram->Size(), bios->Size(), boot->Size()));
+
+    // Build the address decoding tables; areas are mapped in reverse
+    // order of precedence
+    nPages = (RAMBASE >> kPageShift) + (ram->Size() >> kPageShift);
+    pageTable.reset(new PageEntry[nPages]);
+    for (Word i = 0; i < nPages; i++) {
+        pageTable[i].type = PAGE_UNMAPPED;
+        pageTable[i].size = 0;
+        pageTable[i].host = NULL;
+    }
+    mapPages(MMIO_BASE, MMIO_END - MMIO_BASE, PAGE_MMIO, NULL);
+    mapPages(BOOTBASE, boot->Size(), PAGE_ROM, boot->MemPtr(0));
+    mapPages(BIOSBASE, bios->Size(), PAGE_ROM, bios->MemPtr(0));
+    mapRam();
+
+    mapMMIO(MMIO_BASE, MMIO_END, MMIO_REGION_BUS_REGS);
+    mapMMIO(IDEV_BITMAP_BASE, IDEV_BITMAP_END, MMIO_REGION_IDEV_BITMAP);
+    mapMMIO(CDEV_BITMAP_BASE, CDEV_BITMAP_END, MMIO_REGION_CDEV_BITMAP);
+    mapMMIO(DEV_REG_START, DEV_REG_END, MMIO_REGION_DEV_REGS);
+    mapMMIO(IRT_BASE, IRT_END, MMIO_REGION_PIC);
+    mapMMIO(CPUCTL_BASE, CPUCTL_END, MMIO_REGION_PIC);
+    mapMMIO(MCTL_BASE, MCTL_END, MMIO_REGION_MPCTL);
+
     // Create devices and initialize registers used for interrupt
     // handling.
     intPendMask = 0UL;
@@ -139,9 +181,9 @@ SystemBus::~SystemBus()
             delete devTable[intl][dnum];
 }
 
-// This method increments system clock and decrements interval timer;
-// on timer underflow (0 -> FFFFFFFF transition) a interrupt is
-// generated.  Event queue is checked against the current clock value
+// This method increments system clock, and with it the interval timer
+// is decremented; on timer underflow (0 -> FFFFFFFF transition) a
+// interrupt is generated.  Event queue is checked against the current clock value
 // and device operations are completed if needed; all memory changes
 // are notified to Watch control object
 void SystemBus::ClockTick()
@@ -152,20 +194,30 @@ void SystemBus::ClockTick()
     machine->HandleBusAccess(BUS_REG_TOD_HI, WRITE, NULL);
     machine->HandleBusAccess(BUS_REG_TOD_LO, WRITE, NULL);
 
-    // Update interval timer
-    if (UnsSub(&timer, timer, 1))
+    // Interval timer underflow; the timer then restarts from
+    // FFFFFFFF, so next underflow comes 2^32 ticks later. It may be
+    // overdue if the timer was written during a parallel quantum
+    if (tod >= timerUnderflow) {
         pic->StartIRQ(IL_TIMER);
+        timerUnderflow += UINT64_C(1) << 32;
+        lastEvent = tod;
+    }
     machine->HandleBusAccess(BUS_REG_TIMER, WRITE, NULL);
 
     // Scan the event queue
     while (!eventQ->IsEmpty() && eventQ->nextDeadline() <= tod) {
-        (eventQ->nextCallback())();
-        eventQ->RemoveHead();
+        eventQ->RunHead();
+        lastEvent = tod;
     }
 }
 
 uint32_t SystemBus::IdleCycles() const
 {
+    if (tod >= timerUnderflow)
+        return 0;
+
+    const Word timer = getTimer();
+
     if (eventQ->IsEmpty())
         return timer;
 
@@ -181,24 +233,27 @@ void SystemBus::Skip(uint32_t cycles)
     tod += cycles;
     machine->HandleBusAccess(BUS_REG_TOD_HI, WRITE, NULL);
     machine->HandleBusAccess(BUS_REG_TOD_LO, WRITE, NULL);
-
-    timer -= cycles;
     machine->HandleBusAccess(BUS_REG_TIMER, WRITE, NULL);
 }
 
 void SystemBus::setToDHI(Word hi)
 {
-    TimeStamp::setHi(tod, hi);
+    uint64_t t = tod + todOffset;
+    TimeStamp::setHi(t, hi);
+    todOffset = t - tod;
 }
 
 void SystemBus::setToDLO(Word lo)
 {
-    TimeStamp::setLo(tod, lo);
+    uint64_t t = tod + todOffset;
+    TimeStamp::setLo(t, lo);
+    todOffset = t - tod;
 }
 
 void SystemBus::setTimer(Word time)
 {
-    timer = time;
+    timerUnderflow = tod + time + 1;
+    scheduleChanged = true;
 }
 
 // This method reads a data word from memory at address addr, returning it
@@ -218,6 +273,16 @@ bool SystemBus::DataRead(Word addr, Word* datap, Processor* cpu)
     return false;
 }
 
+Word* SystemBus::getRamPointer(Word addr)
+{
+    const Word page = addr >> kPageShift;
+
+    if (page < nPages && pageType(page) == PAGE_RAM)
+        return pageHost(page) + ((addr & kPageMask) >> WORDSHIFT);
+    else
+        return NULL;
+}
+
 
 //
 // These methods allow Watch to inspect or modify single memory locations;
@@ -232,6 +297,7 @@ bool SystemBus::WatchRead(Word addr, Word* datap)
 
 bool SystemBus::WatchWrite(Word addr, Word data)
 {	
+    lastEvent = tod;
     return busWrite(addr, data, machine->getProcessor(0));
 }
 
@@ -253,18 +319,30 @@ bool SystemBus::DataWrite(Word addr, Word data, Processor* proc)
 
 bool SystemBus::CompareAndSet(Word addr, Word oldval, Word newval, bool* result, Processor* cpu)
 {
+    const Word page = addr >> kPageShift;
+
     // The CAS read-modify-write operation, as specified by the uMPS
     // ISA, is required to fail for I/O locations.
-    if (RAMBASE <= addr && addr < RAMBASE + ram->Size()) {
-        *result = ram->CompareAndSet((addr - RAMBASE) >> 2, oldval, newval);
-        return false;
-    } else if (MMIO_BASE <= addr && addr < MMIO_END) {
-        *result = false;
-        return false;
-    } else {
-        cpu->SignalExc(DBEXCEPTION);
-        return true;
+    if (page < nPages && (addr & kPageMask) < pageTable[page].size) {
+        switch (pageType(page)) {
+        case PAGE_RAM_SHARED:
+            unsharePage(page);
+            // fall through
+        case PAGE_RAM:
+            *result = ram->CompareAndSet(CONVERT(addr, RAMBASE), oldval, newval);
+            if (*result)
+                decodeCache->Invalidate(addr);
+            return false;
+        case PAGE_MMIO:
+            *result = false;
+            return false;
+        default:
+            break;
+        }
     }
+
+    cpu->SignalExc(DBEXCEPTION);
+    return true;
 }
 
 // This method transfers a block from or to memory, starting with address
@@ -276,23 +354,7 @@ bool SystemBus::DMATransfer(Block * blk, Word startAddr, bool toMemory)
     if (BADADDR(startAddr))
         return true;
 
-    bool error = false;
-
-    if (toMemory) {
-        for (Word ofs = 0; ofs < BLOCKSIZE && !error; ofs++) {
-            error = busWrite(startAddr + (ofs * WORDLEN), blk->getWord(ofs));  
-            machine->HandleBusAccess(startAddr + (ofs * WORDLEN), WRITE, NULL);
-        }
-    } else {
-        Word val;
-        for (Word ofs = 0; ofs < BLOCKSIZE && !error; ofs++) {
-            error = busRead(startAddr + (ofs * WORDLEN), &val);
-            machine->HandleBusAccess(startAddr + (ofs * WORDLEN), READ, NULL);
-            blk->setWord(ofs, val);
-        }
-    }
-
-    return error;
+    return dmaTransfer(blk->getBuffer(), startAddr, BLOCKSIZE, toMemory);
 }
 
 
@@ -312,25 +374,70 @@ bool SystemBus::DMAVarTransfer(Block* blk, Word startAddr, Word byteLength, bool
     if (BADADDR(startAddr) || length > BLOCKSIZE)
         return true;
 
+    return dmaTransfer(blk->getBuffer(), startAddr, length, toMemory);
+}
+
+// This method transfers words up to the first invalid address, if
+// any, and notifies the range accessed as a whole
+bool SystemBus::dmaTransfer(Word* buf, Word startAddr, Word nWords, bool toMemory)
+{
     bool error = false;
+    Word count;
 
-    if (toMemory) {
-        for (Word ofs = 0; ofs < length && !error; ofs++) {
-            error = busWrite(startAddr + (ofs * WORDLEN), blk->getWord(ofs));
-            machine->HandleBusAccess(startAddr + (ofs * WORDLEN), WRITE, NULL);
-        }
+    if (dmaRam(buf, startAddr, nWords, toMemory)) {
+        count = nWords;
     } else {
-        Word val;
-        for (Word ofs = 0; ofs < length && !error; ofs++) {
-            error = busRead(startAddr + (ofs * WORDLEN), &val);
-            machine->HandleBusAccess(startAddr + (ofs * WORDLEN), READ, NULL);
-            blk->setWord(ofs, val);
+        for (count = 0; count < nWords && !error; count++) {
+            if (toMemory)
+                error = busWrite(startAddr + count * WORDLEN, buf[count]);
+            else
+                error = busRead(startAddr + count * WORDLEN, &buf[count]);
         }
     }
 
+    if (count > 0)
+        machine->HandleDMAAccess(startAddr, startAddr + (count - 1) * WORDLEN,
+                                 toMemory ? WRITE : READ);
     return error;
 }
 
+bool SystemBus::dmaRam(Word* buf, Word startAddr, Word nWords, bool toMemory)
+{
+    const Word endAddr = startAddr + nWords * WORDLEN;
+    if (endAddr < startAddr)
+        return false;
+
+    for (Word addr = startAddr; addr < endAddr; addr = (addr | kPageMask) + 1) {
+        if ((addr >> kPageShift) >= nPages)
+            return false;
+        const Word page = addr >> kPageShift;
+        if ((pageType(page) != PAGE_RAM && pageType(page) != PAGE_RAM_SHARED) ||
+            std::min(endAddr - 1, addr | kPageMask) - (addr & ~kPageMask) >= pageTable[page].size)
+        {
+            return false;
+        }
+    }
+
+    Word addr = startAddr;
+    while (addr < endAddr) {
+        const Word page = addr >> kPageShift;
+        const Word n = (std::min(endAddr - 1, addr | kPageMask) - addr) / WORDLEN + 1;
+        const Word ofs = (addr & kPageMask) >> WORDSHIFT;
+        if (toMemory) {
+            Word* host = (pageType(page) == PAGE_RAM_SHARED) ? unsharePage(page) : pageHost(page);
+            memcpy(host + ofs, buf, n * WORDLEN);
+        } else {
+            memcpy(buf, pageHost(page) + ofs, n * WORDLEN);
+        }
+        buf += n;
+        addr += n * WORDLEN;
+    }
+
+    if (toMemory)
+        decodeCache->Invalidate(startAddr, nWords);
+    return true;
+}
+
 				
 // This method reads a istruction from memory at address addr, returning
 // it thru istrp pointer. It also returns TRUE if the address was invalid and
@@ -351,9 +458,176 @@ bool SystemBus::InstrRead(Word addr, Word* instrp, Processor* proc)
 
 // This method inserts in the eventQ a event that must happen
 // at (current system time) + delay
-uint64_t SystemBus::scheduleEvent(uint64_t delay, Event::Callback callback)
+Event::Handle SystemBus::scheduleEvent(uint64_t delay, EventKind kind,
+                                       Word arg0, Word arg1, Word arg2)
+{
+    Event::Tag tag;
+    tag.kind = kind;
+    tag.args[0] = arg0;
+    tag.args[1] = arg1;
+    tag.args[2] = arg2;
+
+    scheduleChanged = true;
+    const uint64_t now = getEventClock();
+    limitQuantum(now + delay);
+    return eventQ->InsertQ(now, delay, eventCallback(tag), tag);
+}
+
+bool SystemBus::cancelEvent(Event::Handle event)
+{
+    return eventQ->Cancel(event);
+}
+
+// This method returns the handler for the event described by tag
+Event::Callback SystemBus::eventCallback(const Event::Tag& tag)
+{
+    switch (tag.kind) {
+    case EVENT_DEVICE_OP:
+        return boost::bind(&Device::CompleteDevOp, devTable[tag.args[0]][tag.args[1]]);
+    case EVENT_CPU_RESET:
+        return boost::bind(&Processor::Reset, machine->getProcessor(tag.args[0]),
+                           tag.args[1], tag.args[2]);
+    case EVENT_CPU_HALT:
+        return boost::bind(&Processor::Halt, machine->getProcessor(tag.args[0]));
+    case EVENT_POWER_OFF:
+        return boost::bind(&Machine::Halt, machine);
+    case EVENT_IPI:
+        return boost::bind(&InterruptController::DeliverIPI, pic.get(), tag.args[0], tag.args[1]);
+    default:
+        AssertNotReached();
+        return Event::Callback();
+    }
+}
+
+void SystemBus::Save(SnapshotWriter* out) const
+{
+    out->PutU64(tod);
+    out->PutU64(todOffset);
+    out->PutU64(timerUnderflow);
+    out->PutU64(lastEvent);
+    out->PutWord(intPendMask);
+
+    // Events are saved in the order they are due, and so will be
+    // inserted back
+    std::vector<Event::Info> events;
+    eventQ->GetEvents(&events);
+    out->PutWord(events.size());
+    foreach (const Event::Info& e, events) {
+        out->PutU64(e.deadline);
+        out->PutWord(e.tag.kind);
+        out->PutWords(e.tag.args, 3);
+    }
+
+    pic->Save(out);
+    mpController->Save(out);
+
+    for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+        for (unsigned int dnum = 0; dnum < DEVPERINT; dnum++)
+            devTable[intl][dnum]->Save(out);
+}
+
+void SystemBus::Restore(SnapshotReader* in)
+{
+    tod = in->GetU64();
+    todOffset = in->GetU64();
+    timerUnderflow = in->GetU64();
+    lastEvent = in->GetU64();
+    intPendMask = in->GetWord();
+
+    eventQ->Clear();
+    Word nEvents = in->GetWord();
+    for (Word i = 0; i < nEvents; i++) {
+        uint64_t deadline = in->GetU64();
+        Event::Tag tag;
+        tag.kind = in->GetWord();
+        in->GetWords(tag.args, 3);
+
+        // Reject events not referring to an existing device or cpu,
+        // as their callbacks could not be built
+        switch (tag.kind) {
+        case EVENT_DEVICE_OP:
+            in->Expect(tag.args[0] < DEVINTUSED && tag.args[1] < DEVPERINT);
+            break;
+        case EVENT_CPU_RESET:
+        case EVENT_CPU_HALT:
+        case EVENT_IPI:
+            in->Expect(tag.args[0] < config->getNumProcessors());
+            break;
+        case EVENT_POWER_OFF:
+            break;
+        default:
+            in->Expect(false);
+        }
+        eventQ->InsertQ(0, deadline, eventCallback(tag), tag);
+    }
+    scheduleChanged = true;
+
+    pic->Restore(in);
+    mpController->Restore(in);
+
+    for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+        for (unsigned int dnum = 0; dnum < DEVPERINT; dnum++)
+            devTable[intl][dnum]->Restore(in);
+}
+
+// This function returns TRUE if all the words of frame are zero
+HIDDEN bool isZeroFrame(const Word* frame)
+{
+    for (unsigned int i = 0; i < FRAMESIZE; i++)
+        if (frame[i] != 0)
+            return false;
+    return true;
+}
+
+// RAM is saved as a bitmap of its non-zero frames followed by their
+// contents, as most of a large RAM is usually never written to
+void SystemBus::SaveRam(SnapshotWriter* out) const
 {
-    return eventQ->InsertQ(tod, delay, callback);
+    const Word nFrames = ram->NumFrames();
+    std::vector<Word> saved((nFrames + 31) / 32, 0);
+    for (Word i = 0; i < nFrames; i++)
+        if (!ram->IsBlank(i) && !isZeroFrame(ram->FramePtr(i)))
+            saved[i / 32] |= 1U << (i % 32);
+
+    out->PutWords(&saved[0], saved.size());
+    for (Word i = 0; i < nFrames; i++)
+        if (saved[i / 32] & (1U << (i % 32)))
+            out->PutWords(ram->FramePtr(i), FRAMESIZE);
+}
+
+void SystemBus::RestoreRam(SnapshotReader* in)
+{
+    const Word nFrames = ram->NumFrames();
+    std::vector<Word> saved((nFrames + 31) / 32);
+    in->GetWords(&saved[0], saved.size());
+
+    // Frames left as they are stay shared, so that untouched memory
+    // is not allocated
+    const Word firstPage = RAMBASE >> kPageShift;
+    Word frame[FRAMESIZE];
+    for (Word i = 0; i < nFrames; i++) {
+        if (saved[i / 32] & (1U << (i % 32))) {
+            in->GetWords(frame, FRAMESIZE);
+            if (memcmp(frame, ram->FramePtr(i), sizeof(frame)) != 0)
+                memcpy(unsharePage(firstPage + i), frame, sizeof(frame));
+        } else if (!ram->IsBlank(i) && !isZeroFrame(ram->FramePtr(i))) {
+            memset(unsharePage(firstPage + i), 0, sizeof(frame));
+        }
+    }
+    decodeCache->InvalidateRam();
+}
+
+void SystemBus::ShareRam(SystemBus* source)
+{
+    assert(ram->Size() == source->ram->Size());
+
+    delete ram;
+    ram = new RamSpace(*source->ram);
+    mapRam();
+    decodeCache->InvalidateRam();
+
+    // The source frames are now shared too
+    source->mapRam();
 }
 
 void SystemBus::IntReq(unsigned int intl, unsigned int devNum)
@@ -374,12 +648,137 @@ Word SystemBus::getPendingInt(const Processor* cpu)
 
 void SystemBus::AssertIRQ(unsigned int il, unsigned int target)
 {
-    machine->getProcessor(target)->AssertIRQ(il);
+    if (holdIRQ(target)) {
+        HeldIRQ irq = { il, target, true };
+        heldIRQs.push_back(irq);
+    } else {
+        machine->getProcessor(target)->AssertIRQ(il);
+    }
 }
 
 void SystemBus::DeassertIRQ(unsigned int il, unsigned int target)
 {
-    machine->getProcessor(target)->DeassertIRQ(il);
+    if (holdIRQ(target)) {
+        HeldIRQ irq = { il, target, false };
+        heldIRQs.push_back(irq);
+    } else {
+        machine->getProcessor(target)->DeassertIRQ(il);
+    }
+}
+
+void SystemBus::BeginQuantum(unsigned int nCpus, uint32_t cycles, uint32_t minCycles)
+{
+    inQuantum = true;
+    quantumCpus = nCpus;
+    quantumLimit = cycles;
+    quantumMinCycles = minCycles;
+}
+
+void SystemBus::ServeQuantum()
+{
+    boost::mutex::scoped_lock lock(quantumMutex);
+
+    while (quantumCpus > 0) {
+        if (mmioRequest != NULL) {
+            MMIORequest* r = mmioRequest;
+            mmioCpu = r->cpu;
+            if (r->write)
+                busRegWrite(r->addr, r->data, r->cpu);
+            else
+                r->data = busRegRead(r->addr, r->cpu);
+            mmioCpu = NULL;
+            r->done = true;
+            mmioRequest = NULL;
+            quantumCond.notify_all();
+        } else {
+            quantumCond.wait(lock);
+        }
+    }
+}
+
+void SystemBus::QuantumDone()
+{
+    boost::mutex::scoped_lock lock(quantumMutex);
+    quantumCpus--;
+    quantumCond.notify_all();
+}
+
+void SystemBus::EndQuantum(uint32_t cycles)
+{
+    inQuantum = false;
+    tod += cycles;
+
+    // No processor can be using the frames replaced during the quantum
+    ram->ReleaseUnshared();
+
+    foreach (const HeldIRQ& irq, heldIRQs) {
+        if (irq.asserted)
+            machine->getProcessor(irq.target)->AssertIRQ(irq.il);
+        else
+            machine->getProcessor(irq.target)->DeassertIRQ(irq.il);
+    }
+    heldIRQs.clear();
+}
+
+Word SystemBus::forwardMMIO(Processor* cpu, Word addr, Word data, bool write)
+{
+    MMIORequest r = { cpu, addr, data, write, false };
+
+    boost::mutex::scoped_lock lock(quantumMutex);
+    while (mmioRequest != NULL)
+        quantumCond.wait(lock);
+    mmioRequest = &r;
+    quantumCond.notify_all();
+    while (!r.done)
+        quantumCond.wait(lock);
+
+    return r.data;
+}
+
+// This method returns TRUE if a read from MMIO address addr must be
+// forwarded during a quantum: bus registers and the installed devices
+// bitmap have no read side effects, so they are served on the spot,
+// but for the interval timer, which a quantum may see written
+bool SystemBus::forwardRead(Word addr) const
+{
+    switch (mmioTable[CONVERT(addr, MMIO_BASE)]) {
+    case MMIO_REGION_BUS_REGS:
+        return addr == BUS_REG_TIMER;
+    case MMIO_REGION_IDEV_BITMAP:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// This method returns the current clock tick as seen by cpu, which
+// runs ahead of the bus clock during a quantum; a NULL cpu stands for
+// the bus itself
+uint64_t SystemBus::clockOf(const Processor* cpu) const
+{
+    return (inQuantum && cpu != NULL) ? tod + cpu->QuantumTicks() : tod;
+}
+
+// This method lowers the quantum limit, if a quantum is being run, so
+// that the quantum ends in time for something due at clock tick
+// deadline (see ClockTick()). The cpu being served has already run
+// its current tick, and the limit never gets below that
+void SystemBus::limitQuantum(uint64_t deadline)
+{
+    if (!inQuantum)
+        return;
+
+    uint64_t limit = (deadline > tod) ? deadline - tod - 1 : 0;
+    limit = std::max(limit, (uint64_t) quantumMinCycles);
+    if (mmioCpu != NULL)
+        limit = std::max(limit, mmioCpu->QuantumTicks());
+    if (limit < quantumLimit)
+        __atomic_store_n(&quantumLimit, (uint32_t) limit, __ATOMIC_RELAXED);
+}
+
+bool SystemBus::holdIRQ(unsigned int target) const
+{
+    return inQuantum && (mmioCpu == NULL || mmioCpu->Id() != target);
 }
 
 // This method returns the Device object with given "coordinates"
@@ -394,6 +793,20 @@ Device * SystemBus::getDev(unsigned int intL, unsigned int dNum)
     }
 }
 
+void SystemBus::FlushDevices()
+{
+    for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+        for (unsigned int dnum = 0; dnum < DEVPERINT; dnum++)
+            devTable[intl][dnum]->Flush();
+}
+
+void SystemBus::FlushExpiredDevices()
+{
+    for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+        for (unsigned int dnum = 0; dnum < DEVPERINT; dnum++)
+            devTable[intl][dnum]->FlushExpired();
+}
+
 
 /****************************************************************************/
 /* Definitions strictly local to the module.                                */
@@ -404,21 +817,23 @@ Device * SystemBus::getDev(unsigned int intL, unsigned int dNum)
 // otherwise
 bool SystemBus::busRead(Word addr, Word* datap, Processor* cpu)
 {
-    if (INBOUNDS(addr, RAMBASE, RAMBASE + ram->Size()))
-        *datap = ram->MemRead(CONVERT(addr, RAMBASE));
-    else if (INBOUNDS(addr, BIOSBASE, BIOSBASE + bios->Size()))
-        *datap = bios->MemRead(CONVERT(addr,BIOSBASE));
-    else if (INBOUNDS(addr, BOOTBASE, BOOTBASE + boot->Size()))
-        *datap = boot->MemRead(CONVERT(addr, BOOTBASE));
-    else if (INBOUNDS(addr, MMIO_BASE, MMIO_END))
-        *datap = busRegRead(addr, cpu);
-    else {
-        // address invalid: data read is out of bounds
-        *datap = MAXWORDVAL;
-        return true;
+    const Word page = addr >> kPageShift;
+    const Word ofs = addr & kPageMask;
+
+    if (page < nPages && ofs < pageTable[page].size) {
+        if (pageType(page) != PAGE_MMIO)
+            *datap = pageHost(page)[ofs >> WORDSHIFT];
+        else if (inQuantum && forwardRead(addr))
+            *datap = forwardMMIO(cpu, addr, 0, false);
+        else
+            *datap = busRegRead(addr, cpu);
+        // address was valid
+        return false;
     }
-    // address was valid 
-    return false;
+
+    // address invalid: data read is out of bounds
+    *datap = MAXWORDVAL;
+    return true;
 }
 
 
@@ -428,23 +843,26 @@ Word SystemBus::busRegRead(Word addr, Processor* cpu)
 {
     Word data;
 
-    if (DEV_REG_START <= addr && addr < DEV_REG_END) {
+    switch (mmioTable[CONVERT(addr, MMIO_BASE)]) {
+    case MMIO_REGION_DEV_REGS: {
         // We're in the device register space
         DeviceAreaAddress da(addr);
         Device* device = devTable[da.line()][da.device()];
         data = device->ReadDevReg(da.field());
-    } else if (INBOUNDS(addr, IDEV_BITMAP_BASE, IDEV_BITMAP_END)) {
+        break;
+    }
+    case MMIO_REGION_IDEV_BITMAP:
         // We're in the "installed-devices bitmap" structure space
-        unsigned int wordIndex = CONVERT(addr, IDEV_BITMAP_BASE);
-        data = instDevTable[wordIndex];
-    } else if (INBOUNDS(addr, CDEV_BITMAP_BASE, CDEV_BITMAP_END) ||
-               INBOUNDS(addr, IRT_BASE, IRT_END) ||
-               INBOUNDS(addr, CPUCTL_BASE, CPUCTL_END))
-    {
+        data = instDevTable[CONVERT(addr, IDEV_BITMAP_BASE)];
+        break;
+    case MMIO_REGION_CDEV_BITMAP:
+    case MMIO_REGION_PIC:
         data = pic->Read(addr, cpu);
-    } else if (MCTL_BASE <= addr && addr < MCTL_END) {
+        break;
+    case MMIO_REGION_MPCTL:
         data = mpController->Read(addr, cpu);
-    } else {
+        break;
+    default:
         // We're in the low "bus register area" space
         switch (addr) {
         case BUS_REG_TIME_SCALE:
@@ -452,13 +870,13 @@ Word SystemBus::busRegRead(Word addr, Processor* cpu)
             data = config->getClockRate();
             break;
         case BUS_REG_TOD_HI:
-            data = getToDHI();
+            data = TimeStamp::getHi(clockOf(cpu) + todOffset);
             break;
         case BUS_REG_TOD_LO:
-            data = getToDLO();
+            data = TimeStamp::getLo(clockOf(cpu) + todOffset);
             break;
         case BUS_REG_TIMER:
-            data = timer;
+            data = (Word) (timerUnderflow - clockOf(cpu) - 1);
             break;
         case BUS_REG_RAM_BASE:
             data = RAMBASE;
@@ -484,10 +902,79 @@ Word SystemBus::busRegRead(Word addr, Processor* cpu)
             data = 0UL;
             break;
         }
+        break;
     }
     return data;
 }
 
+// This method writes data to the device field addressed in the "bus
+// register area"
+void SystemBus::busRegWrite(Word addr, Word data, Processor* cpu)
+{
+    switch (mmioTable[CONVERT(addr, MMIO_BASE)]) {
+    case MMIO_REGION_DEV_REGS: {
+        DeviceAreaAddress dva(addr);
+        Device* device = devTable[dva.line()][dva.device()];
+        device->WriteDevReg(dva.field(), data);
+        break;
+    }
+    case MMIO_REGION_PIC:
+        pic->Write(addr, data, cpu);
+        break;
+    case MMIO_REGION_MPCTL:
+        mpController->Write(addr, data, NULL);
+        break;
+    default:
+        // data write is in bus registers area
+        if (addr == BUS_REG_TIMER) {
+            // update the interval timer and reset its interrupt line
+            timerUnderflow = clockOf(cpu) + data + 1;
+            limitQuantum(timerUnderflow);
+            scheduleChanged = true;
+            pic->EndIRQ(IL_TIMER);
+        }
+        // else data write is on a read only bus register, and
+        // has no harmful effects
+        break;
+    }
+}
+
+// This method maps the physical memory area [base, base + size[ into
+// the page table, with host as the location of its first word; base
+// must be page aligned
+void SystemBus::mapPages(Word base, Word size, PageType type, Word* host)
+{
+    assert((base & kPageMask) == 0);
+
+    for (Word ofs = 0; ofs < size; ofs += kPageMask + 1) {
+        Word page = (base + ofs) >> kPageShift;
+        if (page >= nPages)
+            break;
+        pageTable[page].type = type;
+        pageTable[page].size = std::min(size - ofs, kPageMask + 1);
+        pageTable[page].host = (host != NULL) ? host + (ofs >> WORDSHIFT) : NULL;
+    }
+}
+
+// This method maps each RAM frame to its own page, as shared or
+// private
+void SystemBus::mapRam()
+{
+    assert(FRAMESIZE * WORDLEN == kPageMask + 1);
+
+    for (Word i = 0; i < ram->NumFrames(); i++) {
+        mapPages(RAMBASE + i * FRAMESIZE * WORDLEN, FRAMESIZE * WORDLEN,
+                 ram->IsShared(i) ? PAGE_RAM_SHARED : PAGE_RAM, ram->FramePtr(i));
+    }
+}
+
+// This method assigns the MMIO words in [start, end[ to region
+void SystemBus::mapMMIO(Word start, Word end, MMIORegion region)
+{
+    for (Word addr = start; addr < end; addr += WS)
+        mmioTable[CONVERT(addr, MMIO_BASE)] = region;
+}
+
 // This method accesses the system configuration and constructs
 // the devices needed, linking them to SystemBus object
 Device* SystemBus::makeDev(unsigned int intl, unsigned int dnum)
@@ -531,33 +1018,48 @@ Device* SystemBus::makeDev(unsigned int intl, unsigned int dnum)
 // and writable, and TRUE otherwise
 bool SystemBus::busWrite(Word addr, Word data, Processor* cpu)
 {
-    if (INBOUNDS(addr, RAMBASE, RAMBASE + ram->Size())) {
-        ram->MemWrite(CONVERT(addr, RAMBASE), data);
-    } else if (INBOUNDS(addr, MMIO_BASE, MMIO_END)) {
-        if (DEV_REG_START <= addr && addr < DEV_REG_END) {
-            DeviceAreaAddress dva(addr);
-            Device* device = devTable[dva.line()][dva.device()];
-            device->WriteDevReg(dva.field(), data);
-        } else if (INBOUNDS(addr, IRT_BASE, IRT_END) ||
-                   INBOUNDS(addr, CPUCTL_BASE, CPUCTL_END))
-        {
-            pic->Write(addr, data, cpu);
-        } else if (MCTL_BASE <= addr && addr < MCTL_END) {
-            mpController->Write(addr, data, NULL);
-        } else {
-            // data write is in bus registers area
-            if (addr == BUS_REG_TIMER) {
-                // update the interval timer and reset its interrupt line
-                timer = data;
-                pic->EndIRQ(IL_TIMER);
-            }
-            // else data write is on a read only bus register, and
-            // has no harmful effects
+    const Word page = addr >> kPageShift;
+    const Word ofs = addr & kPageMask;
+
+    if (page < nPages && ofs < pageTable[page].size) {
+        switch (pageType(page)) {
+        case PAGE_RAM:
+            pageHost(page)[ofs >> WORDSHIFT] = data;
+            decodeCache->Invalidate(addr);
+            return false;
+        case PAGE_RAM_SHARED:
+            unsharePage(page)[ofs >> WORDSHIFT] = data;
+            decodeCache->Invalidate(addr);
+            return false;
+        case PAGE_MMIO:
+            if (inQuantum)
+                forwardMMIO(cpu, addr, data, true);
+            else
+                busRegWrite(addr, data, cpu);
+            return false;
+        default:
+            break;
         }
-    } else {
-        // Address out of valid write bounds
-        return(true);
     }
 
-    return(false);
+    // Address out of valid write bounds
+    return true;
+}
+
+Word* SystemBus::unsharePage(Word page)
+{
+    boost::mutex::scoped_lock lock(unshareMutex);
+
+    // Another processor may have got here first. Processors which do
+    // not take the lock must not see the page as private before its
+    // new host location, while they may still see the shared one
+    // until then: the old frame stays around until the quantum ends
+    if (pageTable[page].type == PAGE_RAM_SHARED) {
+        __atomic_store_n(&pageTable[page].host, ram->Unshare(page - (RAMBASE >> kPageShift)),
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&pageTable[page].type, PAGE_RAM, __ATOMIC_RELEASE);
+        if (!inQuantum)
+            ram->ReleaseUnshared();
+    }
+    return pageTable[page].host;
 }
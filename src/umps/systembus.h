@@ -22,10 +22,16 @@
 #ifndef UMPS_SYSTEMBUS_H
 #define UMPS_SYSTEMBUS_H
 
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
 #include "base/lang.h"
 #include "base/basic_types.h"
 #include "umps/event.h"
 #include "umps/const.h"
+#include "umps/arch.h"
 #include "umps/time_stamp.h"
 
 class Machine;
@@ -35,8 +41,11 @@ class Processor;
 class RamSpace;
 class BiosSpace;
 class Block;
+class DecodeCache;
 class MPController;
 class InterruptController;
+class SnapshotWriter;
+class SnapshotReader;
 
 class SystemBus {
 public:
@@ -54,6 +63,42 @@ public:
 
     void Skip(uint32_t cycles);
 
+    // This method advances the clock by one tick, for use within the
+    // period returned by IdleCycles() when memory accesses need not
+    // be notified: no event is due and the interval timer cannot
+    // underflow, so all that ClockTick() would do is this
+    void IdleTick() { tod++; }
+
+    // This method returns TRUE if events have been scheduled or the
+    // interval timer has been written since the last call to
+    // ClearScheduleChanged(), i.e. if IdleCycles() may have dropped
+    bool ScheduleChanged() const { return scheduleChanged; }
+    void ClearScheduleChanged() { scheduleChanged = false; }
+
+    // This method returns the last clock tick on which memory or
+    // device registers may have been changed by something other than
+    // a processor store: a device event, a timer interrupt or Watch
+    uint64_t LastEventTick() const { return lastEvent; }
+
+    // These methods support parallel execution of processors on their
+    // own host threads (see Machine). Between BeginQuantum() and
+    // EndQuantum() the bus clock stands still, and MMIO accesses are
+    // forwarded to the thread calling ServeQuantum(), which serves
+    // them until all the nCpus processors have called QuantumDone().
+    // Interrupt line changes for processors other than the one being
+    // served are held back until EndQuantum(), which also advances
+    // the clock by the cycles run.
+    // Processors run up to QuantumLimit() ticks ahead of the bus
+    // clock, which starts as cycles: a timer write or an event
+    // scheduled during the quantum lowers it, down to minCycles, so
+    // that the quantum ends before they are due
+    void BeginQuantum(unsigned int nCpus, uint32_t cycles, uint32_t minCycles);
+    void ServeQuantum();
+    void QuantumDone();
+    void EndQuantum(uint32_t cycles);
+    bool InQuantum() const { return inQuantum; }
+    uint32_t QuantumLimit() const { return __atomic_load_n(&quantumLimit, __ATOMIC_RELAXED); }
+
     // This method reads a data word from memory at physical address
     // addr, returning it thru datap pointer. It also returns TRUE if
     // the address was invalid and an exception was caused, FALSE
@@ -88,7 +133,33 @@ public:
     // control object
     bool DMAVarTransfer(Block * blk, Word startAddr, Word byteLength, bool toMemory);
 
-    uint64_t scheduleEvent(uint64_t delay, Event::Callback callback);
+    // Kinds of events, with the arguments they take
+    enum EventKind {
+        // device (interrupt line arg0, number arg1) completes its operation
+        EVENT_DEVICE_OP,
+        // cpu arg0 is reset, starting from PC arg1 with SP arg2
+        EVENT_CPU_RESET,
+        // cpu arg0 halts
+        EVENT_CPU_HALT,
+        // the machine is powered off
+        EVENT_POWER_OFF,
+        // the IPI sent by cpu arg0 with outbox value arg1 is delivered
+        EVENT_IPI,
+        N_EVENT_KINDS
+    };
+
+    // This method schedules an event to happen delay clock ticks from
+    // now, as given by getEventClock(); the returned handle allows to
+    // cancel it with cancelEvent(), which returns FALSE if the event
+    // already happened
+    Event::Handle scheduleEvent(uint64_t delay, EventKind kind,
+                                Word arg0 = 0, Word arg1 = 0, Word arg2 = 0);
+    bool cancelEvent(Event::Handle event);
+
+    // This method returns the clock tick events are scheduled from:
+    // the bus clock, or during a quantum the clock of the processor
+    // whose device register access is being served
+    uint64_t getEventClock() const { return clockOf(mmioCpu); }
 
     // This method sets the appropriate bits into intCauseDev[] and
     // IntPendMask to signal device interrupt pending; it notifies
@@ -107,21 +178,42 @@ public:
     void DeassertIRQ(unsigned int il, unsigned int target);
 
     Machine* getMachine() { return machine; }
+    const MachineConfig* getConfig() const { return config; }
+
+    // This method returns the decoded instruction cache for physical
+    // memory, shared by all processors
+    DecodeCache* getDecodeCache() { return decodeCache.get(); }
+
+    // This method returns a pointer to the RAM word at physical
+    // address addr, or NULL if addr does not lie in RAM. Writes
+    // through it must be notified to the decode cache
+    Word* getRamPointer(Word addr);
 
     // This method returns the Device object with given "coordinates"
     Device * getDev(unsigned int intL, unsigned int dNum);
 
+    // This method makes all devices write out their buffered output
+    void FlushDevices();
+
+    // This method makes all devices write out the output they have
+    // buffered for longer than their policy allows
+    void FlushExpiredDevices();
+
     // These methods allow to inspect or modify  TimeofDay Clock and
     // Interval Timer (typically for simulation reasons)
 
-    Word getToDLO() const { return TimeStamp::getLo(tod); }
-    Word getToDHI() const { return TimeStamp::getHi(tod); }
-    Word getTimer() const { return timer; }
+    Word getToDLO() const { return TimeStamp::getLo(tod + todOffset); }
+    Word getToDHI() const { return TimeStamp::getHi(tod + todOffset); }
+    Word getTimer() const { return (Word) (timerUnderflow - tod - 1); }
 
     void setToDHI(Word hi);
     void setToDLO(Word lo);
     void setTimer(Word time);
 
+    // This method returns the number of clock ticks since power on; it
+    // is not affected by setToDHI()/setToDLO()
+    uint64_t getClock() const { return tod; }
+
     // These methods allow Watch to inspect or modify single memory
     // locations; they return TRUE if address is invalid or cannot be
     // changed, and FALSE otherwise
@@ -129,6 +221,23 @@ public:
     bool WatchRead(Word addr, Word * datap);
     bool WatchWrite(Word addr, Word data);
 
+    // These methods save and restore the clock, timer, pending events
+    // and the state of all controllers and devices, as part of a
+    // machine snapshot (see Machine::SaveSnapshot()). The processors
+    // must be restored after the bus
+    void Save(SnapshotWriter* out) const;
+    void Restore(SnapshotReader* in);
+
+    // These methods save and restore RAM contents
+    void SaveRam(SnapshotWriter* out) const;
+    void RestoreRam(SnapshotReader* in);
+
+    // This method replaces RAM contents with those of source, sharing
+    // them copy-on-write (see Machine::Clone()). Processors of both
+    // buses must then drop the RAM locations they hold (see
+    // Processor::HostMappingChanged())
+    void ShareRam(SystemBus* source);
+
 private:
     const MachineConfig* const config;
 
@@ -138,18 +247,110 @@ private:
 
     scoped_ptr<MPController> mpController;
 
-    // system clock & interval timer
+    // system clock & interval timer. The clock counts ticks since
+    // power on, and TOD is the clock plus todOffset; the timer is not
+    // updated on every tick, but derived from the clock tick at which
+    // it next underflows
     uint64_t tod;
-    Word timer;
+    uint64_t todOffset;
+    uint64_t timerUnderflow;
 
     // device events queue
     EventQueue * eventQ;
 
+    // see ScheduleChanged()
+    bool scheduleChanged;
+
+    // see LastEventTick()
+    uint64_t lastEvent;
+
     // physical memory spaces
     RamSpace * ram;
     BiosSpace * bios;
     BiosSpace * boot;
 
+    // decoded instructions cache for the memory spaces above
+    scoped_ptr<DecodeCache> decodeCache;
+
+    // Physical address decoding table: the address space up to the
+    // end of RAM is split into 4KB pages, each one mapping (a part
+    // of) a memory space or the MMIO area, so that decoding an
+    // address takes a single lookup
+    enum PageType {
+        PAGE_UNMAPPED,
+        PAGE_RAM,
+        // RAM frame shared with other buses (see RamSpace), to be made
+        // private on first write
+        PAGE_RAM_SHARED,
+        PAGE_ROM,
+        PAGE_MMIO
+    };
+
+    struct PageEntry {
+        PageType type;
+        // number of valid bytes from the start of the page
+        Word size;
+        // host location of the first word in the page (RAM and ROM
+        // pages only); ROM and shared RAM pages must not be written
+        // through it
+        Word* host;
+    };
+
+    static const unsigned int kPageShift = 12;
+    static const Word kPageMask = (1UL << kPageShift) - 1;
+
+    scoped_array<PageEntry> pageTable;
+    Word nPages;
+
+    // These methods read the type and host location of a page while
+    // processors may be running in parallel: unsharePage() stores the
+    // new host location before the type which makes it valid
+    PageType pageType(Word page) const
+    { return (PageType) __atomic_load_n(&pageTable[page].type, __ATOMIC_ACQUIRE); }
+    Word* pageHost(Word page) const
+    { return __atomic_load_n(&pageTable[page].host, __ATOMIC_RELAXED); }
+
+    // MMIO area decoding table, with one entry per word
+    enum MMIORegion {
+        MMIO_REGION_BUS_REGS,
+        MMIO_REGION_IDEV_BITMAP,
+        MMIO_REGION_CDEV_BITMAP,
+        MMIO_REGION_DEV_REGS,
+        MMIO_REGION_PIC,
+        MMIO_REGION_MPCTL
+    };
+
+    unsigned char mmioTable[(MMIO_END - MMIO_BASE) / WS];
+
+    // parallel execution state (see BeginQuantum())
+    struct MMIORequest {
+        Processor* cpu;
+        Word addr;
+        Word data;
+        bool write;
+        bool done;
+    };
+
+    struct HeldIRQ {
+        unsigned int il;
+        unsigned int target;
+        bool asserted;
+    };
+
+    bool inQuantum;
+    unsigned int quantumCpus;
+    uint32_t quantumLimit;
+    uint32_t quantumMinCycles;
+    MMIORequest* mmioRequest;
+    Processor* mmioCpu;
+    std::vector<HeldIRQ> heldIRQs;
+    boost::mutex quantumMutex;
+    boost::condition quantumCond;
+
+    // serializes unsharePage() calls from processors running in
+    // parallel
+    boost::mutex unshareMutex;
+
     // device handling & interrupt generation tables
     Device* devTable[DEVINTUSED][DEVPERINT];
     Word instDevTable[DEVINTUSED];
@@ -163,10 +364,45 @@ private:
     // the addr is valid, and TRUE otherwise
     bool busRead(Word addr, Word* datap, Processor* cpu = 0);
 
+    Event::Callback eventCallback(const Event::Tag& tag);
+
     // This method returns the value for the device field addressed in
     // the "bus register area"
     Word busRegRead(Word addr, Processor* cpu);
 
+    // This method writes data to the device field addressed in the
+    // "bus register area"
+    void busRegWrite(Word addr, Word data, Processor* cpu);
+
+    // This method hands an MMIO access over to the thread serving the
+    // current quantum, and waits for it to be done
+    Word forwardMMIO(Processor* cpu, Word addr, Word data, bool write);
+
+    bool forwardRead(Word addr) const;
+
+    // This method returns TRUE if an interrupt line change for cpu
+    // target must be held back until the end of the current quantum
+    bool holdIRQ(unsigned int target) const;
+
+    uint64_t clockOf(const Processor* cpu) const;
+    void limitQuantum(uint64_t deadline);
+
+    // These methods fill the address decoding tables
+    void mapPages(Word base, Word size, PageType type, Word* host);
+    void mapRam();
+    void mapMMIO(Word start, Word end, MMIORegion region);
+
+    // These methods transfer nWords words between buf and memory,
+    // starting with address startAddr; dmaRam() moves whole pages at
+    // a time, and returns FALSE without accessing memory unless the
+    // range lies entirely in RAM
+    bool dmaTransfer(Word* buf, Word startAddr, Word nWords, bool toMemory);
+    bool dmaRam(Word* buf, Word startAddr, Word nWords, bool toMemory);
+
+    // This method makes the RAM frame mapped by page private, and
+    // returns its host location
+    Word* unsharePage(Word page);
+
     // This method writes the data at physical address addr, and
     // passes it back thru the datap pointer. It also return FALSE if
     // the addr is valid and writable, and TRUE otherwise
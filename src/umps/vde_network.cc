@@ -43,6 +43,8 @@
 
 #include "umps/utility.h"
 #include "umps/error.h"
+#include "umps/libvdeplug_dyn.h"
+#include "umps/net_switch.h"
 
 
 enum request_type { REQ_NEW_CONTROL };
@@ -62,7 +64,6 @@ struct request_v3 {
 
 HIDDEN struct vdepluglib vdepluglib;
 HIDDEN char strbuf[STRBUFLEN];
-HIDDEN char packbuf[MAXPACKETLEN];
 
 
 class netblock {
@@ -93,11 +94,30 @@ private:
     int maxelem,nelem;
 };
 
+// vdeinterface is the backend for VDE switches
+class vdeinterface : public netinterface
+{
+	public:
+		vdeinterface(const char *name, const char *addr, int intnum);
+		virtual ~vdeinterface(void);
+
+	protected:
+		virtual int sendframe(const char *buf, int len);
+		virtual int recvframe(char *buf, int len);
+
+	private:
+		VDECONN *vdeconn;
+		struct pollfd polldata;
+};
+
 unsigned int testnetinterface(const char *name)
 {
     char name2[1024];
     int size;
 
+    if (NetSwitch::IsSwitchName(name))
+        return 1;
+
     if (!vdepluglib.dl_handle)
         libvdeplug_dynopen(vdepluglib);
     /* vde lib does not exist */
@@ -114,21 +134,16 @@ unsigned int testnetinterface(const char *name)
     return 1;
 }
 
-netinterface::netinterface(const char *name, const char *addr, int intnum)
-{ 
-	char name2[1024];
-	int size;
-
-	if ((size=readlink(name,name2,1023)) > 0) {
-		name2[size]=0;
-		name=name2;
-	}
-
-	vdeconn = vdepluglib.vde_open(name, (char*) "uMPS", NULL);
-	queue=NULL;
-	polldata.fd = vdepluglib.vde_datafd(vdeconn);
-	polldata.events = POLLIN | POLLOUT | POLLERR | POLLHUP | POLLNVAL;
+netinterface *opennetinterface(const char *name, const char *addr, int intnum)
+{
+	if (NetSwitch::IsSwitchName(name))
+		return NetSwitch::Connect(name, addr, intnum);
+	else
+		return new vdeinterface(name, addr, intnum);
+}
 
+netinterface::netinterface(const char *addr, int intnum)
+{ 
 	if (addr != NULL) {
 		for (int i=0;i<6;i++)
 			ethaddr[i]=addr[i];
@@ -147,8 +162,7 @@ netinterface::netinterface(const char *name, const char *addr, int intnum)
 
 netinterface::~netinterface(void)
 {
-	vdepluglib.vde_close(vdeconn);
-	if (queue != NULL) delete queue;
+	delete queue;
 }
 
 unsigned int netinterface::readdata(char *buf, int len)
@@ -161,46 +175,72 @@ unsigned int netinterface::readdata(char *buf, int len)
 
 unsigned int netinterface::writedata(char *buf, int len)
 {
-	int retval,pollout;
-	if ((pollout=poll(&polldata,1,0)) < 0) {
+	if (len >= 12 && (mode & NAMED) != 0)
+		memcpy(buf+6,ethaddr,6);
+	return sendframe(buf,len);
+}
+
+unsigned int netinterface::polling()
+{
+	char packbuf[MAXPACKETLEN];
+	int len;
+
+	while ((len=recvframe(packbuf,MAXPACKETLEN)) > 0) {
+		if (mode & PROMISQ //promiquous mode: receive everything
+				|| (len > 12 // header okay and
+					&& (memcmp(packbuf,ethaddr,6)==0 //it is sent to this interface
+						|| (packbuf[0] & 1)))) //or it's a broadcast
+			queue->enqueue(packbuf,len);
+	}
+	return (!queue->empty());
+}
+
+vdeinterface::vdeinterface(const char *name, const char *addr, int intnum)
+	: netinterface(addr, intnum)
+{ 
+	char name2[1024];
+	int size;
+
+	if ((size=readlink(name,name2,1023)) > 0) {
+		name2[size]=0;
+		name=name2;
+	}
+
+	vdeconn = vdepluglib.vde_open(name, (char*) "uMPS", NULL);
+	polldata.fd = vdepluglib.vde_datafd(vdeconn);
+	polldata.events = POLLIN | POLLOUT | POLLERR | POLLHUP | POLLNVAL;
+}
+
+vdeinterface::~vdeinterface(void)
+{
+	vdepluglib.vde_close(vdeconn);
+}
+
+int vdeinterface::sendframe(const char *buf, int len)
+{
+	if (poll(&polldata,1,0) < 0) {
 		sprintf(strbuf,"poll: %s",strerror(errno));
 		Panic(strbuf);
 		return 0; // -1 ??
+	} else if (!(polldata.revents & POLLOUT)) {
+		return 0;
 	} else {
-		if (!(polldata.revents & POLLOUT))
-			retval=0;
-		else {
-			if (len >= 12 && (mode & NAMED) != 0)
-				memcpy(buf+6,ethaddr,6);
-			retval=vdepluglib.vde_send(vdeconn,buf,len,0);
-		}
+		return vdepluglib.vde_send(vdeconn,buf,len,0);
 	}
-	return retval;
 }
 
-
-unsigned int netinterface::polling()
+int vdeinterface::recvframe(char *buf, int len)
 {
-	int len, fd;
-	//socklen_t datainsize;
-	//struct sockaddr_un datain;
-	do {
-		if ((poll(&polldata,1,0)) < 0) {
-			sprintf(strbuf,"poll: %s",strerror(errno));
-			Panic(strbuf);
-		} else 
-			if (polldata.revents & POLLIN) {
-				/* We don't store sender address to avoid EINVAL in recvfrom */
-				len=vdepluglib.vde_recv(vdeconn,packbuf,MAXPACKETLEN,0);
-				if (mode & PROMISQ //promiquous mode: receive everything
-						|| (len > 12 // header okay and
-							&& (memcmp(packbuf,ethaddr,6)==0 //it is sent to this interface
-								|| (packbuf[0] & 1)))) //or it's a broadcast
-					queue->enqueue(packbuf,len);
-			}
+	if (poll(&polldata,1,0) < 0) {
+		sprintf(strbuf,"poll: %s",strerror(errno));
+		Panic(strbuf);
+		return 0;
+	} else if (!(polldata.revents & POLLIN)) {
+		return 0;
+	} else {
+		/* We don't store sender address to avoid EINVAL in recvfrom */
+		return vdepluglib.vde_recv(vdeconn,buf,len,0);
 	}
-	while (polldata.revents & POLLIN);
-	return (!queue->empty());
 }
 
 void netinterface::setaddr(char *iethaddr)
@@ -246,7 +286,7 @@ netblock::netblock(const char *icontent,int ilen)
 netblock::~netblock(void)
 {
 	if (content != NULL)
-		delete(content);
+		delete [] content;
 }
 
 class netblock *netblock::getNext()
@@ -22,26 +22,28 @@
 #ifndef UMPS_VDE_NETWORK_H
 #define UMPS_VDE_NETWORK_H
 
-#include <sys/socket.h>
-#include <sys/poll.h>
-#include <sys/un.h>
-
-#include "umps/libvdeplug_dyn.h"
-
 class netblockq;
 
 #define PROMISQ  0x4
 #define INTERRUPT  0x2
 #define NAMED  0x1
 
+// A network interface may be attached to a VDE switch, whose socket
+// is given by name, or to an in-process switch (see net_switch.h).
+// testnetinterface() returns 0 if name cannot be attached to, e.g.
+// because libvdeplug is not available
 unsigned int testnetinterface(const char *name);
+class netinterface *opennetinterface(const char *name, const char *addr, int intnum);
 
+// netinterface holds what is common to all network backends: the
+// interface address, its mode and the queue of received packets.
+// Backends only move frames to and from the network
 class netinterface
 {
 	public:
-		netinterface(const char *name, const char *addr, int intnum);
+		netinterface(const char *addr, int intnum);
 	
-		~netinterface(void);
+		virtual ~netinterface(void);
 
 		unsigned int readdata(char *buf, int len);
 		unsigned int writedata(char *buf, int len);
@@ -51,11 +53,18 @@ class netinterface
 		void setmode(int imode);
 		unsigned int getmode();
 
-	private:
-		VDECONN *vdeconn;
+	protected:
+		// sends a frame; returns the number of bytes sent, 0 if
+		// the network cannot take it now
+		virtual int sendframe(const char *buf, int len) = 0;
+		// receives the next pending frame into buf; returns its
+		// length, 0 if there is none
+		virtual int recvframe(char *buf, int len) = 0;
+
 		char ethaddr[6];
+
+	private:
 		char mode;
-		struct pollfd polldata;
 		class netblockq *queue;
 };
 